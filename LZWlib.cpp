@@ -111,6 +111,7 @@ int compress(const std::string &uncompressed, Iterator result, uint32_t* widthju
                 }else{
                     last++;
                     // Can increment "tableMaxed" instead of "last" and keep the table size at the max, however this typically results in larger file sizes
+                    // (-x adaptive and -x never do this in lzwStream.c, the adaptive policy clears once the compression ratio drops)
 //                    tableMaxed++;
                 }
             }
@@ -227,7 +228,7 @@ std::string decompress(Iterator begin, Iterator end) {
 //    return 0;
 //}
 
-extern "C" int LZWcompress(uint8_t** input, uint32_t *inlen, uint16_t** output, uint32_t* widthjumps, uint8_t initialcodesize) {
+extern "C" int LZWcompress(uint8_t** input, size_t *inlen, uint16_t** output, uint32_t* widthjumps, uint8_t initialcodesize) {
     std::string invec = std::string(*input, *input + sizeof(uint8_t)*(*inlen));
     std::vector<uint16_t> compressed;
 #if DEBUG
@@ -248,7 +249,7 @@ extern "C" int LZWcompress(uint8_t** input, uint32_t *inlen, uint16_t** output,
     return compressed.size();
 }
 
-extern "C" int LZWcompress9bit(uint8_t* input, uint32_t inlen, uint16_t* output) {
+extern "C" int LZWcompress9bit(uint8_t* input, size_t inlen, uint16_t* output) {
     std::string invec = std::string(input, input + sizeof(uint8_t)*inlen);
     std::vector<uint16_t> compressed;
     printf("inputsize=%lu\n", invec.size());
@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "allocate.h"
+
+#define DEBUG 0
+
+
+void* checkedMalloc(size_t size){
+    // malloc that exits with an error message instead of returning NULL
+    void* data = malloc(size);
+    if(data == NULL && size > 0){
+        printf("Error: Out of memory allocating %llu bytes. Exiting.\n", (unsigned long long) size);
+        exit(-1);
+    }
+    return data;
+}
+
+void* checkedCalloc(size_t count, size_t size){
+    // calloc that exits with an error message instead of returning NULL
+    void* data = calloc(count, size);
+    if(data == NULL && count > 0 && size > 0){
+        printf("Error: Out of memory allocating %llu bytes. Exiting.\n", (unsigned long long) checkedSize(count, size));
+        exit(-1);
+    }
+    return data;
+}
+
+size_t checkedSize(size_t count, size_t size){
+    // count*size, exits with an error message if it does not fit in a size_t
+    if(size != 0 && count > SIZE_MAX/size){
+        printf("Error: Buffer of %llu x %llu bytes is too large. Exiting.\n", (unsigned long long) count, (unsigned long long) size);
+        exit(-1);
+    }
+    return count*size;
+}
+
+void* reserveScratch(ScratchBuffer* scratch, size_t size){
+    // Returns at least size bytes of scratch, which keeps them for the next call
+    // The contents are not kept when it has to grow, and are not zeroed
+    if(size > scratch->size){
+        free(scratch->data);
+        scratch->data = checkedMalloc(size);
+        scratch->size = size;
+    }
+    return scratch->data;
+}
+
+void* growScratch(ScratchBuffer* scratch, size_t size){
+    // Like reserveScratch, but the contents are kept when it has to grow, and it at least doubles so that growing
+    // a piece at a time only copies them a few times
+    if(size > scratch->size){
+        size_t grown = scratch->size < SIZE_MAX/2 && 2*scratch->size > size ? 2*scratch->size : size;
+        void* data = realloc(scratch->data, grown);
+        if(data == NULL){
+            printf("Error: Out of memory allocating %llu bytes. Exiting.\n", (unsigned long long) grown);
+            exit(-1);
+        }
+        scratch->data = data;
+        scratch->size = grown;
+    }
+    return scratch->data;
+}
+
+void freeScratch(ScratchBuffer* scratch){
+    free(scratch->data);
+    scratch->data = NULL;
+    scratch->size = 0;
+}
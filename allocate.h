@@ -0,0 +1,44 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _ALLOCATE_H_
+#define _ALLOCATE_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef struct _ScratchBuffer {
+    // Memory that is kept from one frame to the next and only reallocated when a frame needs more of it
+    void* data;
+    size_t size;  // Bytes allocated
+} ScratchBuffer;
+
+void* checkedMalloc(size_t size);
+void* checkedCalloc(size_t count, size_t size);
+size_t checkedSize(size_t count, size_t size);
+void* reserveScratch(ScratchBuffer* scratch, size_t size);
+void* growScratch(ScratchBuffer* scratch, size_t size);
+void freeScratch(ScratchBuffer* scratch);
+
+#endif
@@ -0,0 +1,927 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Micro-benchmarks for the individual stages of the PNG to GIF pipeline
+// Each stage is timed separately over synthetic and real frames at a few standard sizes
+// Build with "./buildme_<platform>.sh bench" and run "./png2gif_bench -h" for the options
+
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <windows.h>
+#define NULLDEVICE "NUL:"
+#else
+#include <unistd.h>
+#include <time.h>
+#define NULLDEVICE "/dev/null"
+#endif
+
+#include "pngReader.h"
+#include "allocate.h"
+#include "crc.h"
+#include "gifWriter.h"
+#include "lzwStream.h"
+#include "palette.h"
+#include "medianCut.h"
+#include "wuQuant.h"
+#include "octree.h"
+#include "kmeans.h"
+#include "dither.h"
+
+#define MAXRUNS 100
+#define MAXFRAMES 16
+#define IDATCHUNKSIZE 8192  // Typical IDAT chunk size used by PNG encoders
+#define DEFAULTREALFRAME "testCases/movie/file1a_f-01.png"
+
+FILE* benchout;  // Results go here, stdout is silenced to hide the per-stage progress messages
+
+typedef struct _BenchFrame {
+    char name[64];
+    uint32_t width;
+    uint32_t height;
+    uint8_t* rgb;  // 3 bytes per pixel
+} BenchFrame;
+
+typedef struct _BenchOpts {
+    int nrun;
+    int sizes[3];  // Which of 256x256, 1920x1080 and 3840x2160 to run
+    char stages[256];  // Comma separated list of stages to run, empty for all
+} BenchOpts;
+
+double benchTime(){
+    // Returns a monotonic time in seconds
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart/(double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#endif
+}
+
+void benchReport(const char* stage, BenchFrame* frame, double* times, int nrun, double nbytes){
+    // Print throughput statistics over the repeated runs
+    // nbytes is the amount of data processed by the stage, throughput in pixels is always relative to the frame size
+    double npixel = (double)frame->width*(double)frame->height;
+    double mean = 0, var = 0, best = times[0];
+    double mbps[MAXRUNS];
+    
+    for(int i=0;i<nrun;i++){
+        mbps[i] = nbytes/times[i]/1e6;
+        mean += mbps[i];
+        if(times[i] < best){
+            best = times[i];
+        }
+    }
+    mean /= nrun;
+    for(int i=0;i<nrun;i++){
+        var += (mbps[i]-mean)*(mbps[i]-mean);
+    }
+    if(nrun > 1){
+        var /= (nrun-1);
+    }
+    
+    // Mpixel/s from the mean throughput to keep the two columns consistent
+    double mpps = mean*(npixel/nbytes);
+    
+    fprintf(benchout, "%-18s %-22s %10.2f %8.2f %7.1f%% %10.2f %10.3f\n", stage, frame->name, mean, sqrt(var), mean > 0 ? 100*sqrt(var)/mean : 0, mpps, 1e3*best);
+    fflush(benchout);
+}
+
+int stageSelected(BenchOpts* opts, const char* stage){
+    // Stages are matched by prefix so that "defilter" selects all filter types
+    if(opts->stages[0] == '\0'){
+        return 1;
+    }
+    char list[256];
+    strcpy(list, opts->stages);
+    char* tok = strtok(list, ",");
+    while(tok != NULL){
+        if(strncmp(stage, tok, strlen(tok)) == 0){
+            return 1;
+        }
+        tok = strtok(NULL, ",");
+    }
+    return 0;
+}
+
+void makeSyntheticFrame(BenchFrame* frame, uint32_t width, uint32_t height){
+    // Smooth gradients with a little noise, some flat regions and a few hard edges
+    // This gives a realistic mix of unique colors and LZW run lengths
+    uint32_t seed = 12345;
+    uint8_t* ptr;
+    
+    frame->width = width;
+    frame->height = height;
+    frame->rgb = checkedMalloc(sizeof(uint8_t)*3*width*height);
+    sprintf(frame->name, "synthetic %ix%i", width, height);
+    
+    ptr = frame->rgb;
+    for(uint32_t j=0;j<height;j++){
+        for(uint32_t i=0;i<width;i++){
+            // Simple LCG for repeatable noise
+            seed = seed*1103515245 + 12345;
+            int noise = (int)((seed >> 16) & 0x7) - 4;
+            int R, G, B;
+            if(((i*8)/width + (j*8)/height) % 5 == 0){
+                // Flat block
+                R = 0x20;
+                G = 0x60;
+                B = 0xc0;
+            }else{
+                R = (255*i)/width + noise;
+                G = (255*j)/height + noise;
+                B = (255*(i+j))/(width+height) - noise;
+            }
+            *ptr++ = (uint8_t) (R < 0 ? 0 : (R > 255 ? 255 : R));
+            *ptr++ = (uint8_t) (G < 0 ? 0 : (G > 255 ? 255 : G));
+            *ptr++ = (uint8_t) (B < 0 ? 0 : (B > 255 ? 255 : B));
+        }
+    }
+}
+
+int makeRealFrame(BenchFrame* frame, const char* filename, uint32_t width, uint32_t height){
+    // Read a PNG and tile it to fill the requested frame size
+    // Returns 0 if the file could not be used
+    PNGHeader header;
+    FILE* fid = fopen(filename, "rb");
+    if(fid == NULL){
+        return 0;
+    }
+    char message[256];
+    if(readPNGHeader(fid, &header, message) != 0 || checkPNGFormat(&header, message) != 0){
+        fprintf(benchout, "Skipping %s: %s", filename, message);
+        fclose(fid);
+        return 0;
+    }
+    uint8_t* png = checkedMalloc(sizeof(uint8_t)*4*header.Width*header.Height+header.Height);
+    ScratchBuffer idat = {NULL, 0};
+    int status = readPNGFrame(fid, &header, NULL, png, NULL, NULL, NULL, &idat, message);
+    freeScratch(&idat);
+    fclose(fid);
+    if(status != 0){
+        fprintf(benchout, "Skipping %s: %s", filename, message);
+        free(png);
+        return 0;
+    }
+    
+    frame->width = width;
+    frame->height = height;
+    frame->rgb = checkedMalloc(sizeof(uint8_t)*3*width*height);
+    const char* basename = strrchr(filename, '/');
+    basename = (basename == NULL) ? filename : basename+1;
+    snprintf(frame->name, sizeof(frame->name), "%.40s %ix%i", basename, width, height);
+    
+    uint8_t* ptr = frame->rgb;
+    for(uint32_t j=0;j<height;j++){
+        uint8_t* row = &png[3*header.Width*(j % header.Height)];
+        for(uint32_t i=0;i<width;i++){
+            memcpy(ptr, &row[3*(i % header.Width)], 3);
+            ptr += 3;
+        }
+    }
+    
+    free(png);
+    return 1;
+}
+
+uint8_t* filterFrame(BenchFrame* frame, uint8_t filtertype){
+    // Build PNG scanlines that all use filtertype, the payload is just the RGB data
+    // The defilter cost does not depend on the data being a valid filter result
+    size_t rowbytes = 3*frame->width;
+    uint8_t* filtered = checkedMalloc((rowbytes+1)*frame->height);
+    for(uint32_t j=0;j<frame->height;j++){
+        filtered[j*(rowbytes+1)] = filtertype;
+        memcpy(&filtered[j*(rowbytes+1)+1], &frame->rgb[j*rowbytes], rowbytes);
+    }
+    return filtered;
+}
+
+void writeChunk(FILE* fid, const char* type, uint8_t* data, uint32_t length){
+    uint8_t len[4] = {length >> 24, length >> 16, length >> 8, length};
+    uLong crc = crc32(0L, (const Bytef*)type, 4);
+    if(length > 0){
+        // zlib returns 0 for a NULL buffer rather than passing the CRC through, which would break IEND
+        crc = crc32(crc, data, length);
+    }
+    uint8_t crcbytes[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    fwrite(len, 1, 4, fid);
+    fwrite(type, 1, 4, fid);
+    if(length > 0){
+        fwrite(data, 1, length, fid);
+    }
+    fwrite(crcbytes, 1, 4, fid);
+}
+
+void benchPNG(BenchOpts* opts, BenchFrame* frame){
+    // PNG chunk parsing and inflate
+    double times[MAXRUNS];
+    char message[256];  // The PNGs written here are never corrupt, so this is not looked at
+    size_t rawsize = (3*frame->width+1)*frame->height;
+    uint8_t* filtered = filterFrame(frame, 0);
+    uLongf zsize = compressBound(rawsize);
+    uint8_t* zdata = checkedMalloc(zsize);
+    compress2(zdata, &zsize, filtered, rawsize, 6);
+    
+    // Write a complete PNG to a temporary file, splitting the zlib stream into IDAT chunks
+    FILE* fid = tmpfile();
+    uint8_t ihdr[13] = {frame->width >> 24, frame->width >> 16, frame->width >> 8, frame->width,
+        frame->height >> 24, frame->height >> 16, frame->height >> 8, frame->height, 8, 2, 0, 0, 0};
+    fwrite("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8, fid);
+    writeChunk(fid, "IHDR", ihdr, 13);
+    for(size_t pos=0;pos<zsize;pos+=IDATCHUNKSIZE){
+        writeChunk(fid, "IDAT", &zdata[pos], (zsize-pos) < IDATCHUNKSIZE ? (zsize-pos) : IDATCHUNKSIZE);
+    }
+    writeChunk(fid, "IEND", NULL, 0);
+    long filesize = ftell(fid);
+    
+    if(stageSelected(opts, "chunkparse")){
+        for(int r=0;r<opts->nrun;r++){
+            PNGChunk chunk;
+            fseek(fid, 8, SEEK_SET);
+            double t0 = benchTime();
+            memset(chunk.Type, '\0', 5);
+            while(strncmp(chunk.Type, "IEND", 4) != 0){
+                readPNGChunk(fid, &chunk, message);
+                free(chunk.Data);
+            }
+            times[r] = benchTime()-t0;
+        }
+        benchReport("chunkparse", frame, times, opts->nrun, (double)filesize);
+    }
+    
+    if(stageSelected(opts, "inflate")){
+        uint8_t* out = checkedMalloc(rawsize+1000);
+        for(int r=0;r<opts->nrun;r++){
+            z_stream zstrm;
+            zstrm.zalloc = Z_NULL;
+            zstrm.zfree = Z_NULL;
+            zstrm.opaque = Z_NULL;
+            zstrm.avail_in = 0;
+            zstrm.next_in = Z_NULL;
+            double t0 = benchTime();
+            inflateInit(&zstrm);
+            inflateData(&zstrm, zdata, zsize, out, rawsize+1000);
+            inflateEnd(&zstrm);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("inflate", frame, times, opts->nrun, (double)rawsize);
+        free(out);
+    }
+    
+    // Chunk CRC over the compressed data, which is what the reader checks before each inflate
+    const char* crcnames[3] = {"crc32/tables", "crc32/pclmul", "crc32/zlib"};
+    for(int c=0;c<3;c++){
+        if(!stageSelected(opts, crcnames[c]) || (c == 1 && !hasCRC32PCLMUL())){
+            continue;
+        }
+        volatile uint32_t sink = 0;
+        for(int r=0;r<opts->nrun;r++){
+            double t0 = benchTime();
+            for(size_t pos=0;pos<zsize;pos+=IDATCHUNKSIZE){
+                size_t len = (zsize-pos) < IDATCHUNKSIZE ? (zsize-pos) : IDATCHUNKSIZE;
+                if(c == 0){
+                    sink += updateCRC32Tables(0, &zdata[pos], len);
+                }else if(c == 1){
+                    sink += updateCRC32(0, &zdata[pos], len);
+                }else{
+                    sink += (uint32_t)crc32(0L, &zdata[pos], (uInt)len);
+                }
+            }
+            times[r] = benchTime()-t0;
+        }
+        benchReport(crcnames[c], frame, times, opts->nrun, (double)zsize);
+    }
+    
+    fclose(fid);
+    free(zdata);
+    free(filtered);
+}
+
+void benchDefilter(BenchOpts* opts, BenchFrame* frame){
+    // Defilter each filter type separately
+    const char* names[5] = {"defilter/none", "defilter/sub", "defilter/up", "defilter/average", "defilter/paeth"};
+    double times[MAXRUNS];
+    size_t rawsize = (3*frame->width+1)*frame->height;
+    uint8_t* work = checkedMalloc(rawsize);
+    
+    for(uint8_t f=0;f<5;f++){
+        if(!stageSelected(opts, names[f])){
+            continue;
+        }
+        uint8_t* filtered = filterFrame(frame, f);
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, filtered, rawsize);
+            double t0 = benchTime();
+            defilterPNGFrame(frame->width, frame->height, work, 3, NULL);
+            times[r] = benchTime()-t0;
+        }
+        benchReport(names[f], frame, times, opts->nrun, (double)rawsize);
+        free(filtered);
+    }
+    free(work);
+}
+
+void benchPNGFrame(BenchOpts* opts, BenchFrame* frame){
+    // Whole frame reads of truecolor, grayscale and palette PNGs made from the frame, with Paeth filtered rows
+    // Palette PNGs are read as indices, the way their colors go straight to the color table of the GIF
+    // 16-bit PNGs are rounded to 8 bits as each row is read, keeping what was rounded off for dithering with /rgb16d
+    // /adam7 is the truecolor PNG interlaced, each of its passes defiltered and scattered into the frame
+    const char* names[6] = {"pngframe/rgb", "pngframe/gray", "pngframe/indexed", "pngframe/rgb16", "pngframe/rgb16d", "pngframe/adam7"};
+    const uint8_t colortypes[6] = {2, 0, 3, 2, 2, 2};
+    const uint8_t depths[6] = {8, 8, 8, 16, 16, 8};
+    const uint8_t interlaces[6] = {0, 0, 0, 0, 0, 1};
+    double times[MAXRUNS];
+    char message[256];  // The PNGs written here are never corrupt, so this is not looked at
+    size_t npixel = (size_t) frame->width*frame->height;
+    uint8_t* out = checkedMalloc((4*(size_t) frame->width+1)*frame->height);
+    int8_t* detail = checkedMalloc(3*npixel);
+    ScratchBuffer idat = {NULL, 0};
+    
+    // 6x6x6 color cube for the palette PNG
+    uint8_t plte[3*216];
+    for(int k=0;k<216;k++){
+        plte[3*k] = (uint8_t) (51*(k/36));
+        plte[3*k+1] = (uint8_t) (51*((k/6) % 6));
+        plte[3*k+2] = (uint8_t) (51*(k % 6));
+    }
+    
+    for(int c=0;c<6;c++){
+        if(!stageSelected(opts, names[c])){
+            continue;
+        }
+        size_t rowlength = (colortypes[c] == 2 ? 3 : 1)*(depths[c]/8)*(size_t) frame->width;
+        size_t rawsize = (rowlength+1)*frame->height;
+        uint8_t* raw = checkedMalloc(rawsize);
+        for(uint32_t j=0;j<frame->height;j++){
+            uint8_t* row = &raw[j*(rowlength+1)];
+            uint8_t* rgb = &frame->rgb[3*(size_t) j*frame->width];
+            *row++ = 4;
+            for(uint32_t i=0;i<frame->width;i++){
+                if(depths[c] == 16){
+                    // Low bytes that round back to the frame
+                    for(int k=0;k<3;k++){
+                        row[6*i+2*k] = rgb[3*i+k];
+                        row[6*i+2*k+1] = rgb[3*i+k] >= 128 ? rgb[3*i+k] - (uint8_t) ((i+j+k) & 63) : rgb[3*i+k] + (uint8_t) ((i+j+k) & 63);
+                    }
+                }else if(colortypes[c] == 2){
+                    memcpy(&row[3*i], &rgb[3*i], 3);
+                }else if(colortypes[c] == 0){
+                    row[i] = (uint8_t) ((rgb[3*i] + rgb[3*i+1] + rgb[3*i+2])/3);
+                }else{
+                    row[i] = (uint8_t) (36*((rgb[3*i]+25)/51) + 6*((rgb[3*i+1]+25)/51) + (rgb[3*i+2]+25)/51);
+                }
+            }
+        }
+        if(interlaces[c]){
+            // Gather the rows into the seven passes
+            PNGHeader header = {frame->width, frame->height, 8, 2, 0, 0, 1};
+            size_t passsize = getPNGRawSize(&header);
+            uint8_t* passraw = checkedMalloc(passsize);
+            uint8_t* passout = passraw;
+            for(int k=0;k<getPNGPasses(&header);k++){
+                PNGPass p;
+                getPNGPass(&header, k, &p);
+                for(uint32_t j=0;j<p.height && p.width>0;j++){
+                    uint8_t* row = &raw[(p.y0+j*p.dy)*(rowlength+1)];
+                    *passout++ = row[0];
+                    for(uint32_t i=0;i<p.width;i++){
+                        memcpy(passout, &row[1+3*(p.x0+i*p.dx)], 3);
+                        passout += 3;
+                    }
+                }
+            }
+            free(raw);
+            raw = passraw;
+            rawsize = passsize;
+        }
+        uLongf zsize = compressBound(rawsize);
+        uint8_t* zdata = checkedMalloc(zsize);
+        compress2(zdata, &zsize, raw, rawsize, 6);
+        
+        FILE* fid = tmpfile();
+        uint8_t ihdr[13] = {frame->width >> 24, frame->width >> 16, frame->width >> 8, frame->width,
+            frame->height >> 24, frame->height >> 16, frame->height >> 8, frame->height, depths[c], colortypes[c], 0, 0, interlaces[c]};
+        fwrite("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8, fid);
+        writeChunk(fid, "IHDR", ihdr, 13);
+        if(colortypes[c] == 3){
+            writeChunk(fid, "PLTE", plte, sizeof(plte));
+        }
+        for(size_t pos=0;pos<zsize;pos+=IDATCHUNKSIZE){
+            writeChunk(fid, "IDAT", &zdata[pos], (zsize-pos) < IDATCHUNKSIZE ? (zsize-pos) : IDATCHUNKSIZE);
+        }
+        writeChunk(fid, "IEND", NULL, 0);
+        
+        for(int r=0;r<opts->nrun;r++){
+            PNGHeader header;
+            PNGPalette palette;
+            rewind(fid);
+            readPNGHeader(fid, &header, message);
+            double t0 = benchTime();
+            readPNGFrame(fid, &header, NULL, out, colortypes[c] == 3 ? &palette : NULL, c == 4 ? detail : NULL, NULL, &idat, message);
+            times[r] = benchTime()-t0;
+        }
+        benchReport(names[c], frame, times, opts->nrun, (double)npixel);
+        fclose(fid);
+        free(zdata);
+        free(raw);
+    }
+    freeScratch(&idat);
+    free(out);
+    free(detail);
+}
+
+int quantizerSelected(BenchOpts* opts, BenchFrame* frame, const char* stage, uint32_t nunique){
+    // Frames with no more colors than fit in the palette are skipped by the quantizers, which would time nothing
+    if(!stageSelected(opts, stage)){
+        return 0;
+    }
+    if(nunique <= 256){
+        fprintf(benchout, "Skipping %s on %s: it has only %u colors\n", stage, frame->name, nunique);
+        return 0;
+    }
+    return 1;
+}
+
+void benchQuantize(BenchOpts* opts, BenchFrame* frame){
+    // Unique color extraction, median cut, Wu quantizer, octree, k-means refinement, nearest color search and dithering
+    double times[MAXRUNS];
+    uint32_t npixel = frame->width*frame->height;
+    double nbytes = 3.0*npixel;
+    SortedPixel* buffer = checkedMalloc(sizeof(SortedPixel)*npixel);
+    SortedPixel* unique = checkedMalloc(sizeof(SortedPixel)*npixel);
+    SortedPixel* work = checkedMalloc(sizeof(SortedPixel)*npixel);
+    uint32_t nunique = 0;
+    
+    // The unique colors are needed by the later stages, so always find them at least once
+    int nrun = stageSelected(opts, "uniquecolors") ? opts->nrun : 1;
+    for(int r=0;r<nrun;r++){
+        double t0 = benchTime();
+        size_t nsorted;
+        nunique = getUniqueColors(frame->rgb, npixel, buffer, unique, NULL, 0, &nsorted);
+        times[r] = benchTime()-t0;
+    }
+    if(stageSelected(opts, "uniquecolors")){
+        benchReport("uniquecolors", frame, times, opts->nrun, nbytes);
+    }
+    
+    if(quantizerSelected(opts, frame, "mediancut", nunique)){
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, unique, sizeof(SortedPixel)*nunique);
+            double t0 = benchTime();
+            medianCut(work, nunique, 8);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("mediancut", frame, times, opts->nrun, nbytes);
+    }
+    
+    if(quantizerSelected(opts, frame, "wu", nunique)){
+        SortedPixel palette[256];
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, unique, sizeof(SortedPixel)*nunique);
+            double t0 = benchTime();
+            wuQuant(work, nunique, 8, palette);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("wu", frame, times, opts->nrun, nbytes);
+    }
+    
+    if(quantizerSelected(opts, frame, "octree", nunique)){
+        SortedPixel palette[256];
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, unique, sizeof(SortedPixel)*nunique);
+            double t0 = benchTime();
+            Octree* tree = newOctree(256);
+            octreeQuant(tree, work, nunique, 8, palette);
+            freeOctree(tree);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("octree", frame, times, opts->nrun, nbytes);
+    }
+    
+    if(quantizerSelected(opts, frame, "kmeans", nunique)){
+        // Eight k-means iterations starting from the median cut palette, the median cut itself is not timed
+        uint8_t* original = checkedMalloc(sizeof(uint8_t)*3*nunique);
+        for(uint32_t i=0;i<nunique;i++){
+            original[3*i] = unique[i].R;
+            original[3*i+1] = unique[i].G;
+            original[3*i+2] = unique[i].B;
+        }
+        GIFOptStruct medianopts = newGIFOptStructInst();
+        medianopts.colorpalette = Pmedian;
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, unique, sizeof(SortedPixel)*nunique);
+            getColorPalette(medianopts.palette, work, nunique, 8, medianopts);
+            double t0 = benchTime();
+            refinePalette(medianopts.palette, work, original, nunique, 8, 0);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("kmeans", frame, times, opts->nrun, nbytes);
+        free(medianopts.palette);
+        freeGIFScratch(medianopts.scratch);
+        free(medianopts.scratch);
+        free(original);
+    }
+    
+    if(stageSelected(opts, "colortable")){
+        // A whole frame with a local color table as writeGIFFrame does it for -c median, reusing the buffers of the run before
+        GIFOptStruct tableopts = newGIFOptStructInst();
+        tableopts.colorpalette = Pmedian;
+        uint8_t* indices = checkedMalloc(sizeof(uint8_t)*3*npixel);
+        uint8_t* lastframe = checkedCalloc(npixel, 1);
+        FILE* devnull = fopen(NULLDEVICE, "wb");
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(indices, frame->rgb, 3*npixel);
+            double t0 = benchTime();
+            writeGIFLCT(devnull, indices, lastframe, 0, frame->width, frame->height, tableopts, 1);
+            times[r] = benchTime()-t0;
+        }
+        fclose(devnull);
+        benchReport("colortable", frame, times, opts->nrun, nbytes);
+        free(lastframe);
+        free(indices);
+        free(tableopts.palette);
+        freeGIFScratch(tableopts.scratch);
+        free(tableopts.scratch);
+    }
+    
+    // The nearest color search and dithering use the default 685g palette
+    GIFOptStruct gifopts = newGIFOptStructInst();
+    getColorPalette(gifopts.palette, NULL, 0, 8, gifopts);
+    
+    if(stageSelected(opts, "nearestcolor")){
+        for(int r=0;r<opts->nrun;r++){
+            memcpy(work, unique, sizeof(SortedPixel)*nunique);
+            double t0 = benchTime();
+            palettizeColors(gifopts.palette, 255, work, nunique);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("nearestcolor", frame, times, opts->nrun, nbytes);
+    }
+    
+    if(stageSelected(opts, "dither")){
+        // Dither works on the frame in its original pixel order
+        for(uint32_t i=0;i<npixel;i++){
+            buffer[i].R = frame->rgb[3*i];
+            buffer[i].G = frame->rgb[3*i+1];
+            buffer[i].B = frame->rgb[3*i+2];
+        }
+        for(int r=0;r<opts->nrun;r++){
+            for(uint32_t i=0;i<npixel;i++){
+                work[i] = buffer[i];
+                work[i].residualR = 0;
+                work[i].residualG = 0;
+                work[i].residualB = 0;
+            }
+            double t0 = benchTime();
+            dither(gifopts.palette, 255, work, frame->width, frame->height, NULL, 0);
+            times[r] = benchTime()-t0;
+        }
+        benchReport("dither", frame, times, opts->nrun, nbytes);
+    }
+    
+    free(gifopts.palette);
+    freeGIFScratch(gifopts.scratch);
+    free(gifopts.scratch);
+    free(work);
+    free(unique);
+    free(buffer);
+}
+
+void benchLZW(BenchOpts* opts, BenchFrame* frame){
+    // LZW compression and bit packing of a median cut palettized frame
+    double times[MAXRUNS];
+    uint32_t npixel = frame->width*frame->height;
+    
+    // Palettize the frame the same way writeGIFFrame does
+    uint8_t* indices = checkedMalloc(sizeof(uint8_t)*3*npixel);
+    uint8_t* lastframe = checkedCalloc(npixel, 1);
+    memcpy(indices, frame->rgb, 3*npixel);
+    GIFOptStruct gifopts = newGIFOptStructInst();
+    gifopts.colorpalette = Pmedian;
+    FILE* devnull = fopen(NULLDEVICE, "wb");
+    int tablebitsize = writeGIFLCT(devnull, indices, lastframe, 0, frame->width, frame->height, gifopts, 1);
+    fclose(devnull);
+    
+    uint8_t startnbits = tablebitsize+1;
+    if(startnbits < 3){
+        startnbits = 3;
+    }
+    uint16_t clearcode = 1 << (startnbits-1);
+    uint16_t stopcode = clearcode + 1;
+    
+    // Keep all the codes so the bit writer can be timed on its own
+    int maxsegments = npixel/256 + 16;
+    uint16_t* codes = checkedMalloc(sizeof(uint16_t)*(npixel+2*maxsegments));
+    uint32_t widthjumps[10];
+    size_t ncodes = 0;
+    
+    // The codes are needed by the bit writer, so always compress at least once
+    int nrun = stageSelected(opts, "lzw") ? opts->nrun : 1;
+    for(int r=0;r<nrun;r++){
+        uint8_t* frameptr = indices;
+        size_t inlen = npixel;
+        uint16_t* codeptr = codes;
+        int nsegments = 0;
+        
+        double t0 = benchTime();
+        *codeptr++ = clearcode;
+        while(inlen > 0 && nsegments < maxsegments){
+            LZWcompress(&frameptr, &inlen, &codeptr, widthjumps, startnbits);
+            *codeptr++ = (inlen == 0) ? stopcode : clearcode;
+            nsegments++;
+        }
+        times[r] = benchTime()-t0;
+        ncodes = (size_t)(codeptr-codes);
+    }
+    if(stageSelected(opts, "lzw")){
+        benchReport("lzw", frame, times, opts->nrun, (double)npixel);
+    }
+    
+    if(stageSelected(opts, "lzwstream")){
+        // Table lookups, bit packing and sub-blocks together, as done for strips
+        FILE* devnull = fopen(NULLDEVICE, "wb");
+        for(int r=0;r<opts->nrun;r++){
+            LZWStream stream;
+            double t0 = benchTime();
+            startLZWStream(&stream, devnull, tablebitsize, &gifopts.scratch->lzw);
+            writeLZWStream(&stream, indices, npixel);
+            finishLZWStream(&stream);
+            times[r] = benchTime()-t0;
+        }
+        fclose(devnull);
+        benchReport("lzwstream", frame, times, opts->nrun, (double)npixel);
+    }
+    
+    if(stageSelected(opts, "lzwbands")){
+        // One band per processor on separate threads, with sub-blocks, as done for whole frames with -b 0
+        FILE* devnull = fopen(NULLDEVICE, "wb");
+        GIFOptStruct bandopts = gifopts;
+        bandopts.lzwbands = getNumThreads();
+        for(int r=0;r<opts->nrun;r++){
+            double t0 = benchTime();
+            writeGIFImageCompressed(devnull, indices, frame->width, frame->height, tablebitsize, bandopts);
+            times[r] = benchTime()-t0;
+        }
+        fclose(devnull);
+        benchReport("lzwbands", frame, times, opts->nrun, (double)npixel);
+    }
+    
+    // Each clear code policy, with the size it compresses to, since the best policy depends on the image
+    const char* policynames[3] = {"lzwclear/full", "lzwclear/adaptive", "lzwclear/never"};
+    enum _ClearPolicies policies[3] = {ClearFull, ClearAdaptive, ClearNever};
+    long policysizes[3] = {0, 0, 0};
+    int anypolicy = 0;
+    for(int p=0;p<3;p++){
+        if(!stageSelected(opts, policynames[p])){
+            continue;
+        }
+        FILE* tmp = tmpfile();
+        for(int r=0;r<opts->nrun;r++){
+            LZWStream stream;
+            rewind(tmp);
+            double t0 = benchTime();
+            startLZWStream(&stream, tmp, tablebitsize, &gifopts.scratch->lzw);
+            stream.clearpolicy = policies[p];
+            writeLZWStream(&stream, indices, npixel);
+            finishLZWStream(&stream);
+            times[r] = benchTime()-t0;
+        }
+        policysizes[p] = ftell(tmp);
+        fclose(tmp);
+        benchReport(policynames[p], frame, times, opts->nrun, (double)npixel);
+        anypolicy = 1;
+    }
+    if(anypolicy){
+        fprintf(benchout, "%-18s %-22s full %ld, adaptive %ld, never %ld bytes\n", "lzwclear/size", frame->name, policysizes[0], policysizes[1], policysizes[2]);
+    }
+    
+    // Frames with 2, 4 and 16 gray levels, like documents and line art, where long runs of one index dominate
+    const char* tinynames[3] = {"lzwtiny/1bit", "lzwtiny/2bit", "lzwtiny/4bit"};
+    int tinybits[3] = {1, 2, 4};
+    for(int t=0;t<3;t++){
+        if(!stageSelected(opts, tinynames[t])){
+            continue;
+        }
+        uint8_t* levels = checkedMalloc(npixel);
+        for(uint32_t i=0;i<npixel;i++){
+            int gray = (frame->rgb[3*i] + frame->rgb[3*i+1] + frame->rgb[3*i+2])/3;
+            levels[i] = (uint8_t)(gray >> (8-tinybits[t]));
+        }
+        FILE* devnull = fopen(NULLDEVICE, "wb");
+        for(int r=0;r<opts->nrun;r++){
+            LZWStream stream;
+            double t0 = benchTime();
+            startLZWStream(&stream, devnull, tinybits[t], &gifopts.scratch->lzw);
+            writeLZWStream(&stream, levels, npixel);
+            finishLZWStream(&stream);
+            times[r] = benchTime()-t0;
+        }
+        fclose(devnull);
+        free(levels);
+        benchReport(tinynames[t], frame, times, opts->nrun, (double)npixel);
+    }
+    
+    if(stageSelected(opts, "lzwflat")){
+        // Solid blocks of 200 colors on a background, like charts and screenshots, with an 8-bit table
+        uint8_t* flat = checkedMalloc(npixel);
+        for(uint32_t j=0;j<frame->height;j++){
+            for(uint32_t i=0;i<frame->width;i++){
+                uint32_t block = (i/97)*31 + (j/53)*17;
+                flat[j*frame->width+i] = (block % 3 == 0) ? 255 : (uint8_t)(block % 200);
+            }
+        }
+        FILE* devnull = fopen(NULLDEVICE, "wb");
+        for(int r=0;r<opts->nrun;r++){
+            LZWStream stream;
+            double t0 = benchTime();
+            startLZWStream(&stream, devnull, 8, &gifopts.scratch->lzw);
+            writeLZWStream(&stream, flat, npixel);
+            finishLZWStream(&stream);
+            times[r] = benchTime()-t0;
+        }
+        fclose(devnull);
+        free(flat);
+        benchReport("lzwflat", frame, times, opts->nrun, (double)npixel);
+    }
+    
+    if(stageSelected(opts, "bitpack")){
+        // Width of each code, which goes up as the decoder's string table fills
+        uint8_t* widths = checkedMalloc(ncodes);
+        int nbits = startnbits;
+        int nextcode = clearcode + 2;
+        int first = 1;
+        for(size_t k=0;k<ncodes;k++){
+            widths[k] = (uint8_t) nbits;
+            if(codes[k] == clearcode){
+                nbits = startnbits;
+                nextcode = clearcode + 2;
+                first = 1;
+                continue;
+            }
+            if(!first && nextcode < 4096){
+                nextcode++;
+                if(nextcode == (1 << nbits) && nbits < 12){
+                    nbits++;
+                }
+            }
+            first = 0;
+        }
+        
+        for(int r=0;r<opts->nrun;r++){
+            LZWStream stream;
+            startLZWBand(&stream, tablebitsize, ncodes, NULL);
+            double t0 = benchTime();
+            writeLZWCodes(&stream, codes, widths, ncodes);
+            storeLZWBits(&stream);
+            times[r] = benchTime()-t0;
+            freeLZWStream(&stream);
+        }
+        free(widths);
+        // Throughput of the bit writer is measured on its 16-bit code input
+        benchReport("bitpack", frame, times, opts->nrun, 2.0*ncodes);
+    }
+    
+    free(gifopts.palette);
+    freeGIFScratch(gifopts.scratch);
+    free(gifopts.scratch);
+    free(codes);
+    free(lastframe);
+    free(indices);
+}
+
+void benchUsage(char **argv){
+    printf("\npng2gif pipeline stage benchmarks.\n\n");
+    printf("Usage: %s [opts]\n", argv[0]);
+    printf(" opts:\n");
+    printf("  -r, --runs <n>             Number of timed runs per stage (default=5, max=%i)\n", MAXRUNS);
+    printf("  -s, --sizes <list>         Comma separated frame sizes from 256,1080,4k\n");
+    printf("                              (default=256,1080,4k)\n");
+    printf("  -t, --stages <list>        Comma separated stages to run (default=all):\n");
+    printf("                              chunkparse, inflate, crc32[/tables|/pclmul|/zlib],\n");
+    printf("                              defilter[/none|/sub|/up|/average|/paeth],\n");
+    printf("                              pngframe[/rgb|/gray|/indexed|/rgb16|/rgb16d|/adam7],\n");
+    printf("                              uniquecolors, mediancut, wu, octree, kmeans, colortable,\n");
+    printf("                              nearestcolor, dither, lzw, bitpack, lzwstream, lzwbands,\n");
+    printf("                              lzwclear[/full|/adaptive|/never], lzwtiny[/1bit|/2bit|/4bit],\n");
+    printf("                              lzwflat\n");
+    printf("  -i, --image <file.png>     Real frame to benchmark in addition to the synthetic frames,\n");
+    printf("                              tiled to each frame size (default=%s)\n", DEFAULTREALFRAME);
+    printf("  -h, --help                 Print this help\n\n");
+}
+
+int main(int argc, char **argv){
+    BenchOpts opts;
+    char* images[MAXFRAMES];
+    int nimage = 0;
+    int ch;
+    const uint32_t widths[3] = {256, 1920, 3840};
+    const uint32_t heights[3] = {256, 1080, 2160};
+    const char* sizenames[3] = {"256", "1080", "4k"};
+    
+    opts.nrun = 5;
+    opts.sizes[0] = opts.sizes[1] = opts.sizes[2] = 1;
+    opts.stages[0] = '\0';
+    
+    static struct option longopts[] = {
+        {"runs",   required_argument, NULL, 'r'},
+        {"sizes",  required_argument, NULL, 's'},
+        {"stages", required_argument, NULL, 't'},
+        {"image",  required_argument, NULL, 'i'},
+        {"help",   no_argument,       NULL, 'h'},
+        {NULL,     0,                 NULL, 0  }
+    };
+    
+    while ((ch = getopt_long(argc, argv, "r:s:t:i:h", longopts, NULL)) != -1){
+        switch(ch){
+            case 'r':
+                opts.nrun = atoi(optarg);
+                if(opts.nrun < 1 || opts.nrun > MAXRUNS){
+                    printf("Number of runs must be 1 <= x <= %i. Exiting.\n", MAXRUNS);
+                    exit(-1);
+                }
+                break;
+            case 's':
+                for(int k=0;k<3;k++){
+                    opts.sizes[k] = (strstr(optarg, sizenames[k]) != NULL);
+                }
+                break;
+            case 't':
+                strncpy(opts.stages, optarg, sizeof(opts.stages)-1);
+                opts.stages[sizeof(opts.stages)-1] = '\0';
+                break;
+            case 'i':
+                if(nimage < MAXFRAMES){
+                    images[nimage++] = optarg;
+                }
+                break;
+            case 'h':
+            case '?':
+            default:
+                benchUsage(argv);
+                exit(0);
+        }
+    }
+    if(nimage == 0){
+        images[nimage++] = DEFAULTREALFRAME;
+    }
+    
+    // Keep the results and silence the progress messages printed by the pipeline stages
+    benchout = fdopen(dup(fileno(stdout)), "w");
+    freopen(NULLDEVICE, "w", stdout);
+    
+    fprintf(benchout, "%-18s %-22s %10s %8s %8s %10s %10s\n", "stage", "frame", "MB/s", "stddev", "rel", "Mpixel/s", "best ms");
+    
+    for(int k=0;k<3;k++){
+        if(!opts.sizes[k]){
+            continue;
+        }
+        BenchFrame frames[MAXFRAMES+1];
+        int nframe = 0;
+        makeSyntheticFrame(&frames[nframe++], widths[k], heights[k]);
+        for(int n=0;n<nimage;n++){
+            if(makeRealFrame(&frames[nframe], images[n], widths[k], heights[k])){
+                nframe++;
+            }
+        }
+        
+        for(int n=0;n<nframe;n++){
+            benchPNG(&opts, &frames[n]);
+            benchDefilter(&opts, &frames[n]);
+            benchPNGFrame(&opts, &frames[n]);
+            benchQuantize(&opts, &frames[n]);
+            benchLZW(&opts, &frames[n]);
+            free(frames[n].rgb);
+        }
+    }
+    
+    fclose(benchout);
+    
+    return 0;
+}
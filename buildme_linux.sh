@@ -18,6 +18,36 @@ gcc $CFLAGS -c -o palette.o palette.c
 
 gcc $CFLAGS -c -o medianCut.o medianCut.c
 
+gcc $CFLAGS -c -o wuQuant.o wuQuant.c
+
+gcc $CFLAGS -c -o octree.o octree.c
+
+gcc $CFLAGS -c -o kmeans.o kmeans.c
+
 gcc $CFLAGS -c -o dither.o dither.c
 
-g++ $CXXFLAGS -o png2gif png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o dither.o libLZWlib.o tinyfiledialogs.o -lz
+gcc $CFLAGS -c -o framePipeline.o framePipeline.c
+
+gcc $CFLAGS -c -o stripWriter.o stripWriter.c
+
+gcc $CFLAGS -c -o lzwStream.o lzwStream.c
+
+gcc $CFLAGS -c -o allocate.o allocate.c
+
+gcc $CFLAGS -c -o crc.o crc.c
+
+g++ $CXXFLAGS -o png2gif png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o framePipeline.o stripWriter.o lzwStream.o allocate.o crc.o libLZWlib.o tinyfiledialogs.o -lz -lpthread
+
+# Stage micro-benchmarks, built with: ./buildme_linux.sh bench
+if [ "$1" = "bench" ]; then
+    gcc $CFLAGS -c -o bench.o bench.c
+
+    g++ $CXXFLAGS -o png2gif_bench bench.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o lzwStream.o allocate.o crc.o libLZWlib.o -lz -lpthread
+fi
+
+# Byte-exact regression tests, built and run with: ./buildme_linux.sh regression
+if [ "$1" = "regression" ]; then
+    gcc $CFLAGS -o gifDecode testCases/gifDecode.c pngReader.o allocate.o crc.o -lz -lpthread
+
+    (cd testCases && ./runRegression.sh)
+fi
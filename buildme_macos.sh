@@ -20,9 +20,39 @@ $CC $CFLAGS -c -o palette.o palette.c
 
 $CC $CFLAGS -c -o medianCut.o medianCut.c
 
+$CC $CFLAGS -c -o wuQuant.o wuQuant.c
+
+$CC $CFLAGS -c -o octree.o octree.c
+
+$CC $CFLAGS -c -o kmeans.o kmeans.c
+
 $CC $CFLAGS -c -o dither.o dither.c
 
-$CXX $CFLAGS -o png2gif png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o dither.o libLZWlib.o tinyfiledialogs.o -lz
+$CC $CFLAGS -c -o framePipeline.o framePipeline.c
+
+$CC $CFLAGS -c -o stripWriter.o stripWriter.c
+
+$CC $CFLAGS -c -o lzwStream.o lzwStream.c
+
+$CC $CFLAGS -c -o allocate.o allocate.c
+
+$CC $CFLAGS -c -o crc.o crc.c
+
+$CXX $CFLAGS -o png2gif png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o framePipeline.o stripWriter.o lzwStream.o allocate.o crc.o libLZWlib.o tinyfiledialogs.o -lz -lpthread
+
+# Stage micro-benchmarks, built with: ./buildme_macos.sh bench
+if [ "$1" = "bench" ]; then
+    $CC $CFLAGS -c -o bench.o bench.c
+
+    $CXX $CFLAGS -o png2gif_bench bench.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o lzwStream.o allocate.o crc.o libLZWlib.o -lz -lpthread
+fi
+
+# Byte-exact regression tests, built and run with: ./buildme_macos.sh regression
+if [ "$1" = "regression" ]; then
+    $CC $CFLAGS -o gifDecode testCases/gifDecode.c pngReader.o allocate.o crc.o -lz -lpthread
+
+    (cd testCases && ./runRegression.sh)
+fi
 
 # Make an app
 rm -rf png2gif.app
@@ -26,7 +26,28 @@ set CXXFLAGS=-std=c++0x -O3
 
 %CC% %CFLAGS% -c -o medianCut.o medianCut.c
 
+%CC% %CFLAGS% -c -o wuQuant.o wuQuant.c
+
+%CC% %CFLAGS% -c -o octree.o octree.c
+
+%CC% %CFLAGS% -c -o kmeans.o kmeans.c
+
 %CC% %CFLAGS% -c -o dither.o dither.c
 
-%CPP% %CXXFLAGS% -o png2gif.exe png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o dither.o libLZWlib.o tinyfiledialogs.o -lz -lComdlg32 -lOle32 -static
+%CC% %CFLAGS% -c -o framePipeline.o framePipeline.c
+
+%CC% %CFLAGS% -c -o stripWriter.o stripWriter.c
+
+%CC% %CFLAGS% -c -o lzwStream.o lzwStream.c
+
+%CC% %CFLAGS% -c -o allocate.o allocate.c
+
+%CC% %CFLAGS% -c -o crc.o crc.c
+
+%CPP% %CXXFLAGS% -o png2gif.exe png2gif.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o framePipeline.o stripWriter.o lzwStream.o allocate.o crc.o libLZWlib.o tinyfiledialogs.o -lz -lpthread -lComdlg32 -lOle32 -static
 
+rem Stage micro-benchmarks, built with: buildme_win.bat bench
+if "%1"=="bench" (
+    %CC% %CFLAGS% -c -o bench.o bench.c
+    %CPP% %CXXFLAGS% -o png2gif_bench.exe bench.o pngReader.o gifWriter.o pixel.o palette.o medianCut.o wuQuant.o octree.o kmeans.o dither.o lzwStream.o allocate.o crc.o libLZWlib.o -lz -lpthread -static
+)
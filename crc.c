@@ -0,0 +1,183 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <pthread.h>
+
+#include "crc.h"
+
+// Carry-less multiplication folds 64 bytes at a time on x86, chosen at run time since the build does not target a particular processor
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CRC_PCLMUL 1
+#else
+#define CRC_PCLMUL 0
+#endif
+
+#define DEBUG 0
+
+// Reflected CRC-32 polynomial
+#define CRC32_POLY 0xedb88320u
+
+// crctable[k][b] is the CRC of byte b followed by k zero bytes, for slice-by-8
+static uint32_t crctable[8][256];
+static int crcpclmul = 0;
+static pthread_once_t crconce = PTHREAD_ONCE_INIT;
+
+static void initCRC32(){
+    // Fill the tables and check for the carry-less multiply instruction, once for all threads
+    for(int b=0;b<256;b++){
+        uint32_t c = (uint32_t) b;
+        for(int k=0;k<8;k++){
+            c = (c & 1) ? CRC32_POLY ^ (c >> 1) : c >> 1;
+        }
+        crctable[0][b] = c;
+    }
+    for(int b=0;b<256;b++){
+        for(int k=1;k<8;k++){
+            crctable[k][b] = (crctable[k-1][b] >> 8) ^ crctable[0][crctable[k-1][b] & 0xff];
+        }
+    }
+#if CRC_PCLMUL
+    crcpclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+#endif
+#if DEBUG
+    printf("PCLMUL CRC-32 %s\n", crcpclmul ? "available" : "not available");
+#endif
+}
+
+static uint32_t crc32Slice8(uint32_t crc, const uint8_t* data, size_t length){
+    // Update the CRC register (not inverted) 8 bytes at a time with one lookup per byte, all independent of each other
+    
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while(length >= 8){
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data+4, 4);
+        lo ^= crc;
+        crc = crctable[7][lo & 0xff] ^ crctable[6][(lo >> 8) & 0xff] ^ crctable[5][(lo >> 16) & 0xff] ^ crctable[4][lo >> 24]
+            ^ crctable[3][hi & 0xff] ^ crctable[2][(hi >> 8) & 0xff] ^ crctable[1][(hi >> 16) & 0xff] ^ crctable[0][hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+#endif
+    while(length > 0){
+        crc = crctable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    return crc;
+}
+
+#if CRC_PCLMUL
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32PCLMUL(uint32_t crc, const uint8_t* data, size_t length){
+    // Update the CRC register (not inverted) over length bytes, at least 64 and a multiple of 16
+    // Four 128-bit lanes are folded forward by 512 bits at a time, then folded into one, reduced to 64 bits and
+    // finished with a Barrett reduction (Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ")
+    
+    const __m128i fold4 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);  // x^(512+32) and x^(512-32) mod P, bit-reflected
+    const __m128i fold1 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);  // The same for 128 bits
+    const __m128i fold32 = _mm_set_epi64x(0, 0x163cd6124);
+    const __m128i barrett = _mm_set_epi64x(0x1f7011641, 0x1db710641);  // floor(x^64/P) and P
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+    
+    __m128i x1 = _mm_loadu_si128((const __m128i*) data);
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (data+16));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (data+32));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (data+48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    data += 64;
+    length -= 64;
+    
+    while(length >= 64){
+        __m128i h1 = _mm_clmulepi64_si128(x1, fold4, 0x11);
+        __m128i h2 = _mm_clmulepi64_si128(x2, fold4, 0x11);
+        __m128i h3 = _mm_clmulepi64_si128(x3, fold4, 0x11);
+        __m128i h4 = _mm_clmulepi64_si128(x4, fold4, 0x11);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, fold4, 0x00), h1);
+        x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, fold4, 0x00), h2);
+        x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, fold4, 0x00), h3);
+        x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, fold4, 0x00), h4);
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) data));
+        x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*) (data+16)));
+        x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*) (data+32)));
+        x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*) (data+48)));
+        data += 64;
+        length -= 64;
+    }
+    
+    // Fold the four lanes into one, then the remaining 16-byte blocks
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11)), x2);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11)), x3);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11)), x4);
+    while(length >= 16){
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11));
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) data));
+        data += 16;
+        length -= 16;
+    }
+    
+    // 128 bits to 64, then 64 to 32 bits, which also appends the 32 zero bits of the CRC
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, fold1, 0x10));
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), fold32, 0x00);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), x2);
+    
+    // Barrett reduction to the 32-bit remainder
+    x2 = _mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), barrett, 0x10), mask32);
+    x2 = _mm_clmulepi64_si128(x2, barrett, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+uint32_t updateCRC32(uint32_t crc, const uint8_t* data, size_t length){
+    // Continue the CRC over length more bytes, with the fastest method the processor has
+    
+    pthread_once(&crconce, initCRC32);
+    crc = ~crc;
+#if CRC_PCLMUL
+    if(crcpclmul && length >= 64){
+        size_t n = length & ~(size_t) 15;
+        crc = crc32PCLMUL(crc, data, n);
+        data += n;
+        length -= n;
+    }
+#endif
+    crc = crc32Slice8(crc, data, length);
+    return ~crc;
+}
+
+uint32_t updateCRC32Tables(uint32_t crc, const uint8_t* data, size_t length){
+    // Continue the CRC with slice-by-8 only
+    pthread_once(&crconce, initCRC32);
+    return ~crc32Slice8(~crc, data, length);
+}
+
+int hasCRC32PCLMUL(){
+    // Non-zero if updateCRC32 uses carry-less multiplication
+    pthread_once(&crconce, initCRC32);
+    return crcpclmul;
+}
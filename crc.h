@@ -0,0 +1,38 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// CRC-32 as used by PNG chunks and zlib, with the same conventions as zlib's crc32: start from 0 and pass the
+// result back in to continue over more data
+uint32_t updateCRC32(uint32_t crc, const uint8_t* data, size_t length);
+uint32_t updateCRC32Tables(uint32_t crc, const uint8_t* data, size_t length);
+int hasCRC32PCLMUL();
+
+#endif
@@ -23,13 +23,15 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "dither.h"
 
 #define DEBUG 0
 
-void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t width, uint32_t height){
+void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t width, uint32_t height, const uint8_t* alpha, int alphathreshold){
     // Dither the image in frame of size width x height using color table in unique of size nunique
     // Use non-serpentine Floyd-Steinberg dithering
+    // If alpha is given then pixels with less alpha than alphathreshold are transparent, they are skipped and take no error
     
     // Pseudo code from https://en.wikipedia.org/wiki/Floyd–Steinberg_dithering
 //    for each y from top to bottom
@@ -56,6 +58,10 @@ void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t wid
     for(uint32_t j=0; j<height; j++){
         for(uint32_t i=0; i<width; i++){
             
+            if(alpha != NULL && alpha[j*width+i] < alphathreshold){
+                continue;
+            }
+            
             // Get pixel
             oldpixel = frame[j*width+i];
 #if DEBUG
@@ -117,3 +123,84 @@ void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t wid
     }  // for j
     
 }
+
+void ditherRows(SortedPixel* palette, int npalette, uint8_t* frame, uint32_t width, uint32_t nrows, float* residual, int8_t* detail, const uint8_t* alpha, int alphathreshold){
+    // Dither nrows rows of the RGB frame against the palette colors, replacing each pixel by its palette index in place
+    // Same error diffusion as dither, but the error carried into the following row is kept in residual so that a large image can be dithered a strip at a time
+    // residual holds 2 rows of 3*width floats (this row and the next) and must be zeroed at the top of the image
+    // detail, unless it is NULL, holds what each RGB value of a 16-bit source was rounded by, in 1/257 of a level
+    // alpha, unless it is NULL, holds the alpha of each pixel, those with less than alphathreshold are transparent and get index 0
+    
+    float* errorthis = residual;
+    float* errornext = residual + 3*width;
+    SortedPixel pixel;
+    uint32_t ind;
+    float errorR, errorG, errorB;
+    
+    memset(&pixel, 0, sizeof(SortedPixel));
+    
+    for(uint32_t j=0; j<nrows; j++){
+        uint8_t* row = frame + 3*j*width;
+        for(uint32_t i=0; i<width; i++){
+            
+            if(alpha != NULL && alpha[j*width+i] < alphathreshold){
+                frame[j*width+i] = 0;
+                continue;
+            }
+            
+            // Get pixel with the error propagated to it
+            pixel.R = row[3*i];
+            pixel.G = row[3*i+1];
+            pixel.B = row[3*i+2];
+            pixel.residualR = errorthis[3*i];
+            pixel.residualG = errorthis[3*i+1];
+            pixel.residualB = errorthis[3*i+2];
+            if(detail != NULL){
+                pixel.residualR += detail[3*(j*width+i)] / 257.f;
+                pixel.residualG += detail[3*(j*width+i)+1] / 257.f;
+                pixel.residualB += detail[3*(j*width+i)+2] / 257.f;
+            }
+            
+            // Find closest color
+            ind = findClosestColor(palette, npalette, pixel);
+            
+            // Get quantization error for each color
+            errorR = pixel.residualR + (float)pixel.R - (float)palette[ind].R;
+            errorG = pixel.residualG + (float)pixel.G - (float)palette[ind].G;
+            errorB = pixel.residualB + (float)pixel.B - (float)palette[ind].B;
+            
+            // The index never overtakes the RGB bytes still to be read
+            frame[j*width+i] = (uint8_t) ind;
+            
+            // Distribute quantization error to other pixels
+            // Pixel to right
+            if(i < (width-1)){
+                errorthis[3*i+3] += errorR * 7 / 16;
+                errorthis[3*i+4] += errorG * 7 / 16;
+                errorthis[3*i+5] += errorB * 7 / 16;
+            }
+            // Pixel below and left
+            if(i > 0){
+                errornext[3*i-3] += errorR * 3 / 16;
+                errornext[3*i-2] += errorG * 3 / 16;
+                errornext[3*i-1] += errorB * 3 / 16;
+            }
+            // Pixel below
+            errornext[3*i] += errorR * 5 / 16;
+            errornext[3*i+1] += errorG * 5 / 16;
+            errornext[3*i+2] += errorB * 5 / 16;
+            // Pixel below and right
+            if(i < (width-1)){
+                errornext[3*i+3] += errorR * 1 / 16;
+                errornext[3*i+4] += errorG * 1 / 16;
+                errornext[3*i+5] += errorB * 1 / 16;
+            }
+            
+        }  // for i
+        
+        // Move on to the next row
+        memcpy(errorthis, errornext, sizeof(float)*3*width);
+        memset(errornext, 0, sizeof(float)*3*width);
+    }  // for j
+    
+}
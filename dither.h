@@ -29,7 +29,8 @@
 #include <stdint.h>
 #include "pixel.h"
 
-void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t width, uint32_t height);
+void dither(SortedPixel* palette, int npalette, SortedPixel* frame, uint32_t width, uint32_t height, const uint8_t* alpha, int alphathreshold);
+void ditherRows(SortedPixel* palette, int npalette, uint8_t* frame, uint32_t width, uint32_t nrows, float* residual, int8_t* detail, const uint8_t* alpha, int alphathreshold);
 uint32_t findClosestColor(SortedPixel* palette, int npalette, SortedPixel pixel);
 
 #endif
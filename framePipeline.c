@@ -0,0 +1,506 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <string.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "framePipeline.h"
+#include "pngReader.h"
+#include "allocate.h"
+
+#define DEBUG 0
+
+
+void setPipelineError(FramePipeline* pipeline, const char* title, const char* message){
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->error = 1;
+    strncpy(pipeline->errortitle, title, sizeof(pipeline->errortitle)-1);
+    strncpy(pipeline->errormessage, message, sizeof(pipeline->errormessage)-1);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+FrameBuffer* getFreeBuffer(FramePipeline* pipeline, uint32_t width, uint32_t height){
+    // Wait for a free buffer in the ring and make sure that it is allocated
+    pthread_mutex_lock(&pipeline->mutex);
+    while(pipeline->nfree == 0){
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    FrameBuffer* buffer = &pipeline->ring[pipeline->writepos];
+    pthread_mutex_unlock(&pipeline->mutex);
+    
+    // Allocate memory for the frame the first time the buffer is used
+    // Do this here because we only now know the frame size
+    // Always support RGBA size, just in case
+    if(buffer->data == NULL){
+        buffer->data = checkedCalloc(checkedSize(checkedSize(4, width)+1, height)+1000, sizeof(uint8_t));  // RBGA bytes + png scanline filter bytes
+        if(pipeline->keepdetail){
+            buffer->detail = checkedMalloc(checkedSize(checkedSize(3, width), height));
+        }
+        if(pipeline->keepalpha){
+            buffer->alpha = checkedMalloc(checkedSize(width, height));
+        }
+    }
+    buffer->width = width;
+    buffer->height = height;
+    buffer->npalette = 0;
+    buffer->hasdetail = 0;
+    buffer->hasalpha = 0;
+    buffer->screenwidth = width;
+    buffer->screenheight = height;
+    buffer->left = 0;
+    buffer->top = 0;
+    buffer->delay = -1;
+    buffer->disposal = 0;
+    
+    return buffer;
+}
+
+void submitFrame(FramePipeline* pipeline){
+    // Hand the buffer last returned by getFreeBuffer to the encoder
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->writepos = (pipeline->writepos+1) % NFRAMEBUFFERS;
+    pipeline->nfree--;
+    pipeline->nready++;
+#if DEBUG
+    printf("Decoded frame, %i frames ready\n", pipeline->nready);
+#endif
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+void finishDecoding(FramePipeline* pipeline){
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->done = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+void setAnimationFrame(FrameBuffer* buffer, PNGFrameControl* control, int isFirstFrame){
+    // Place a frame of an animated PNG on the screen with its delay, rounded to 1/100 s, and what happens to it after
+    // Disposing to the previous frame means disposing to the background for the first frame
+    buffer->width = control->width;
+    buffer->height = control->height;
+    buffer->left = control->x;
+    buffer->top = control->y;
+    uint32_t delayden = control->delayden > 0 ? control->delayden : 100;
+    uint32_t delay = (200*(uint32_t) control->delaynum + delayden)/(2*delayden);
+    buffer->delay = (int) (delay > 0xffff ? 0xffff : delay);
+    buffer->disposal = control->dispose == 2 && isFirstFrame ? 2 : control->dispose+1;
+}
+
+void* decodeFrames(void* arg){
+    // Decoder thread: read and defilter each PNG into the next free buffer of the ring
+    FramePipeline* pipeline = (FramePipeline*) arg;
+    PNGHeader header;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    char message[256];
+    ScratchBuffer idat = {NULL, 0};  // Compressed image data, reused for every frame
+    PNGPalette palette;
+    int nsubmitted = 0;
+    int failed = 0;
+    
+    for(int i=0; i<pipeline->nfile && !failed; i++){
+        printf("pngfilename=%s\n", pipeline->filenames[i]);
+        FILE* fid = fopen(pipeline->filenames[i], "rb");
+        
+        // Get png header and make sure the frame is the same size
+        if(readPNGHeader(fid, &header, message) != 0){
+            setPipelineError(pipeline, "png2gif error: Corrupt file", message);
+            fclose(fid);
+            break;
+        }
+        
+        // Check for supported PNG formats
+        if(checkPNGFormat(&header, message) != 0){
+            setPipelineError(pipeline, "png2gif error: Unsupported file format", message);
+            fclose(fid);
+            break;
+        }
+        if(i == 0){
+            width = header.Width;
+            height = header.Height;
+        }else if(header.Width != width || header.Height != height){
+            sprintf(message, "Error: All PNG frames must be the same size (%ix%i expected, %ix%i found)\n", width, height, header.Width, header.Height);
+            setPipelineError(pipeline, "png2gif error: Frame size mismatch", message);
+            fclose(fid);
+            break;
+        }
+        
+        // Animated PNGs give a frame per call, each covering the rectangle of its frame control
+        PNGAnimation anim;
+        memset(&anim, 0, sizeof(PNGAnimation));
+        do{
+            FrameBuffer* buffer = getFreeBuffer(pipeline, width, height);
+            
+            // Get png frame in rgb raw format, or as indices with the colors of its palette
+            int8_t* detail = header.BitDepth == 16 ? buffer->detail : NULL;
+            uint8_t* alpha = hasPNGAlpha(header.ColorType) ? buffer->alpha : NULL;
+            // The buffer is not submitted if the frame cannot be read, so the encoder never sees it
+            if(readPNGFrame(fid, &header, &anim, buffer->data, pipeline->keepindices ? &palette : NULL, detail, alpha, &idat, message) != 0){
+                setPipelineError(pipeline, "png2gif error: Corrupt file", message);
+                failed = 1;
+                break;
+            }
+            if(pipeline->keepindices && palette.Size > 0){
+                memset(buffer->palette, 0, sizeof(buffer->palette));
+                for(int k=0;k<palette.Size;k++){
+                    SortedPixel* color = &buffer->palette[k];
+                    color->R = palette.RGB[3*k];
+                    color->G = palette.RGB[3*k+1];
+                    color->B = palette.RGB[3*k+2];
+                    color->pixel = (color->B << 16) + (color->G << 8) + (color->R << 0);
+                    color->colorindex = k;
+                }
+                buffer->npalette = palette.Size;
+            }else{
+                buffer->hasdetail = detail != NULL;
+                buffer->hasalpha = alpha != NULL;
+            }
+            if(anim.animated){
+                setAnimationFrame(buffer, &anim.control, nsubmitted == 0);
+            }
+            
+            submitFrame(pipeline);
+            nsubmitted++;
+        }while(anim.hasnext);
+        fclose(fid);
+    }
+    
+    freeScratch(&idat);
+    finishDecoding(pipeline);
+    
+    return NULL;
+}
+
+size_t readRaw(FILE* fid, uint8_t* data, size_t size){
+    // Read exactly size bytes unless the stream ends, returns the number of bytes read
+    size_t nread = 0;
+    while(nread < size){
+        size_t n = fread(data+nread, 1, size-nread, fid);
+        if(n == 0){
+            break;
+        }
+        nread += n;
+    }
+    return nread;
+}
+
+int readY4MLine(FILE* fid, char* line, int maxlen){
+    // Read one newline terminated header line of a Y4M stream
+    // Returns the line length, -1 on a clean end of stream and -2 if the line is too long or cut off
+    int len = 0;
+    int ch;
+    while((ch = fgetc(fid)) != EOF && ch != '\n'){
+        if(len >= maxlen-1){
+            return -2;
+        }
+        line[len++] = (char) ch;
+    }
+    line[len] = '\0';
+    if(ch == EOF){
+        return len == 0 ? -1 : -2;
+    }
+    return len;
+}
+
+int parseY4MHeader(FramePipeline* pipeline, int* chromaw, int* chromah){
+    // Parse the YUV4MPEG2 stream header for the frame size, frame rate and chroma subsampling
+    // Returns non-zero on an unsupported or broken header
+    char line[1024];
+    char message[256];
+    uint32_t fpsnum = 0, fpsden = 0;
+    char chroma[64] = "420jpeg";  // Default when the C parameter is missing
+    
+    if(readY4MLine(pipeline->rawfid, line, sizeof(line)) < 0 || strncmp(line, "YUV4MPEG2 ", 10) != 0){
+        setPipelineError(pipeline, "png2gif error: Unsupported file format", "Error: Input stream is not a YUV4MPEG2 (Y4M) stream\n");
+        return -1;
+    }
+    
+    char* tok = strtok(line+10, " ");
+    while(tok != NULL){
+        switch(tok[0]){
+            case 'W':
+                pipeline->rawwidth = atoi(tok+1);
+                break;
+            case 'H':
+                pipeline->rawheight = atoi(tok+1);
+                break;
+            case 'F':
+                sscanf(tok+1, "%u:%u", &fpsnum, &fpsden);
+                break;
+            case 'C':
+                strncpy(chroma, tok+1, sizeof(chroma)-1);
+                break;
+            default:
+                // Interlacing, aspect ratio and extensions do not matter here
+                break;
+        }
+        tok = strtok(NULL, " ");
+    }
+    
+    if(pipeline->rawwidth == 0 || pipeline->rawheight == 0){
+        setPipelineError(pipeline, "png2gif error: Unsupported file format", "Error: Y4M stream header does not give the frame size\n");
+        return -1;
+    }
+    
+    // Chroma plane size, only 8-bit streams are supported
+    if(strcmp(chroma, "420jpeg") == 0 || strcmp(chroma, "420paldv") == 0 || strcmp(chroma, "420mpeg2") == 0 || strcmp(chroma, "420") == 0){
+        *chromaw = (pipeline->rawwidth+1)/2;
+        *chromah = (pipeline->rawheight+1)/2;
+    }else if(strcmp(chroma, "422") == 0){
+        *chromaw = (pipeline->rawwidth+1)/2;
+        *chromah = pipeline->rawheight;
+    }else if(strcmp(chroma, "444") == 0){
+        *chromaw = pipeline->rawwidth;
+        *chromah = pipeline->rawheight;
+    }else if(strcmp(chroma, "mono") == 0){
+        *chromaw = 0;
+        *chromah = 0;
+    }else{
+        sprintf(message, "Error: Y4M chroma format C%s is not supported (use 420, 422, 444 or mono with 8 bits)\n", chroma);
+        setPipelineError(pipeline, "png2gif error: Unsupported file format", message);
+        return -1;
+    }
+    
+    // Frame delay in 1/100 s
+    if(fpsnum > 0 && fpsden > 0){
+        uint64_t delay = (200*(uint64_t)fpsden + fpsnum)/(2*(uint64_t)fpsnum);
+        pipeline->rawdelay = (uint16_t) (delay > 0xffff ? 0xffff : delay);
+    }
+    
+    return 0;
+}
+
+static inline uint8_t clampColor(int32_t value){
+    return (uint8_t) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+void convertYUVFrame(uint8_t* frame, uint8_t* yplane, uint8_t* uplane, uint8_t* vplane, uint32_t width, uint32_t height, int chromaw, int chromah){
+    // Convert a planar YUV frame to RGB using the BT.601 limited range coefficients in 16.16 fixed point
+    // Chroma is upsampled by nearest neighbour, mono frames have no chroma planes
+    int xshift = (chromaw > 0 && (uint32_t) chromaw < width) ? 1 : 0;
+    int yshift = (chromah > 0 && (uint32_t) chromah < height) ? 1 : 0;
+    
+    for(uint32_t i=0; i<height; i++){
+        uint8_t* yrow = yplane + (size_t) i*width;
+        uint8_t* urow = uplane + (size_t) (i>>yshift)*chromaw;
+        uint8_t* vrow = vplane + (size_t) (i>>yshift)*chromaw;
+        uint8_t* out = frame + 3*(size_t) i*width;
+        for(uint32_t j=0; j<width; j++){
+            int32_t y = 76309*((int32_t) yrow[j] - 16) + 32768;
+            int32_t u = 0, v = 0;
+            if(chromaw > 0){
+                u = (int32_t) urow[j>>xshift] - 128;
+                v = (int32_t) vrow[j>>xshift] - 128;
+            }
+            out[3*j]   = clampColor((y + 104597*v) >> 16);
+            out[3*j+1] = clampColor((y - 25675*u - 53279*v) >> 16);
+            out[3*j+2] = clampColor((y + 132201*u) >> 16);
+        }
+    }
+}
+
+void* decodeRawFrames(void* arg){
+    // Decoder thread: read raw RGB, RGBA or Y4M frames from stdin into the next free buffer of the ring
+    FramePipeline* pipeline = (FramePipeline*) arg;
+    FILE* fid = pipeline->rawfid;
+    uint8_t* yuv = NULL;
+    int chromaw = 0, chromah = 0;
+    size_t framesize;
+    char line[1024];
+    
+    if(pipeline->source == SourceY4M){
+        if(parseY4MHeader(pipeline, &chromaw, &chromah) != 0){
+            finishDecoding(pipeline);
+            return NULL;
+        }
+        framesize = (size_t) pipeline->rawwidth*pipeline->rawheight + 2*(size_t) chromaw*chromah;
+        yuv = checkedMalloc(framesize);
+    }else if(pipeline->source == SourceRGBA){
+        framesize = 4*(size_t) pipeline->rawwidth*pipeline->rawheight;
+    }else{
+        framesize = 3*(size_t) pipeline->rawwidth*pipeline->rawheight;
+    }
+    
+    uint32_t width = pipeline->rawwidth;
+    uint32_t height = pipeline->rawheight;
+    size_t npixel = (size_t) width*height;
+    
+    for(int i=0; ; i++){
+        // Each Y4M frame starts with its own header line
+        if(pipeline->source == SourceY4M){
+            int len = readY4MLine(fid, line, sizeof(line));
+            if(len == -1){
+                break;
+            }
+            if(len < 0 || strncmp(line, "FRAME", 5) != 0){
+                setPipelineError(pipeline, "png2gif error: Broken input stream", "Error: Y4M frame header not found\n");
+                break;
+            }
+        }
+        
+        FrameBuffer* buffer = getFreeBuffer(pipeline, width, height);
+        
+        size_t nread = readRaw(fid, pipeline->source == SourceY4M ? yuv : buffer->data, framesize);
+        if(nread == 0 && pipeline->source != SourceY4M){
+            // End of stream between two frames
+            break;
+        }
+        if(nread < framesize){
+            char message[256];
+            sprintf(message, "Error: Input stream ended in the middle of frame %i (%zu of %zu bytes)\n", i, nread, framesize);
+            setPipelineError(pipeline, "png2gif error: Broken input stream", message);
+            break;
+        }
+        printf("Read raw frame %i\n", i);
+        
+        if(pipeline->source == SourceY4M){
+            convertYUVFrame(buffer->data, yuv, yuv+npixel, yuv+npixel+(size_t) chromaw*chromah, width, height, chromaw, chromah);
+        }else if(pipeline->source == SourceRGBA){
+            // Drop the alpha channel, in place since the RGB pixel never overruns the RGBA one, keeping it aside if asked to
+            if(pipeline->keepalpha){
+                for(size_t j=0; j<npixel; j++){
+                    buffer->alpha[j] = buffer->data[4*j+3];
+                }
+                buffer->hasalpha = 1;
+            }
+            for(size_t j=0; j<npixel; j++){
+                buffer->data[3*j]   = buffer->data[4*j];
+                buffer->data[3*j+1] = buffer->data[4*j+1];
+                buffer->data[3*j+2] = buffer->data[4*j+2];
+            }
+        }
+        
+        submitFrame(pipeline);
+    }
+    
+    free(yuv);
+    finishDecoding(pipeline);
+    
+    return NULL;
+}
+
+int startFramePipeline(FramePipeline* pipeline, char** filenames, int nfile, int keepindices, int keepdetail, int keepalpha){
+    // Start decoding frames in the background
+    // With keepindices, palette and grayscale PNGs are handed over as indices into their own palette
+    // With keepdetail, 16-bit PNGs also hand over what their RGB values were rounded by, for dithering
+    // With keepalpha, PNGs with an alpha channel also hand over their alpha, and gray+alpha PNGs are read as RGB
+    // Returns non-zero if the decoder thread could not be started
+    memset(pipeline, 0, sizeof(FramePipeline));
+    pipeline->source = SourcePNG;
+    pipeline->filenames = filenames;
+    pipeline->nfile = nfile;
+    pipeline->keepindices = keepindices;
+    pipeline->keepdetail = keepdetail;
+    pipeline->keepalpha = keepalpha;
+    pipeline->nfree = NFRAMEBUFFERS;
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->cond, NULL);
+    
+    return pthread_create(&pipeline->thread, NULL, decodeFrames, pipeline);
+}
+
+int startRawFramePipeline(FramePipeline* pipeline, enum _FrameSource source, uint32_t width, uint32_t height, int keepalpha){
+    // Start reading raw frames from stdin in the background
+    // The frame size is given for RGB24 and RGBA streams, Y4M streams carry it in their header
+    // With keepalpha, RGBA streams also hand over their alpha
+    // Returns non-zero if the decoder thread could not be started
+    memset(pipeline, 0, sizeof(FramePipeline));
+    pipeline->source = source;
+    pipeline->rawfid = stdin;
+    pipeline->rawwidth = width;
+    pipeline->rawheight = height;
+    pipeline->keepalpha = keepalpha;
+    pipeline->nfree = NFRAMEBUFFERS;
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->cond, NULL);
+#if defined(_WIN32) || defined(_WIN64)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    
+    return pthread_create(&pipeline->thread, NULL, decodeRawFrames, pipeline);
+}
+
+FrameBuffer* nextFrame(FramePipeline* pipeline){
+    // Wait for the next decoded frame
+    // Returns NULL once all frames have been handed out or when the decoder hit an error
+    FrameBuffer* buffer = NULL;
+    
+    pthread_mutex_lock(&pipeline->mutex);
+    while(pipeline->nready == 0 && !pipeline->done){
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    if(pipeline->nready > 0 && !pipeline->error){
+        buffer = &pipeline->ring[pipeline->readpos];
+        pipeline->readpos = (pipeline->readpos+1) % NFRAMEBUFFERS;
+        pipeline->nready--;
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    
+    return buffer;
+}
+
+int hasNextFrame(FramePipeline* pipeline){
+    // Wait until it is known whether another frame follows the ones already handed out
+    // Returns non-zero if nextFrame will return a frame
+    pthread_mutex_lock(&pipeline->mutex);
+    while(pipeline->nready == 0 && !pipeline->done){
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    int ready = pipeline->nready > 0 && !pipeline->error;
+    pthread_mutex_unlock(&pipeline->mutex);
+    
+    return ready;
+}
+
+void releaseFrame(FramePipeline* pipeline){
+    // Give the oldest frame held by the encoder back to the decoder
+    // Frames are released in the order they were handed out by nextFrame
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->nfree++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+int coversScreen(FrameBuffer* buffer){
+    // Returns non-zero if the frame covers the whole screen rather than a rectangle of it
+    return buffer->left == 0 && buffer->top == 0 && buffer->width == buffer->screenwidth && buffer->height == buffer->screenheight;
+}
+
+void stopFramePipeline(FramePipeline* pipeline){
+    // Wait for the decoder to finish and free the frame buffers
+    // The encoder must have released all of its frames so that the decoder cannot be left waiting on a buffer
+    pthread_join(pipeline->thread, NULL);
+    for(int i=0;i<NFRAMEBUFFERS;i++){
+        free(pipeline->ring[i].data);
+        free(pipeline->ring[i].detail);
+        free(pipeline->ring[i].alpha);
+    }
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->cond);
+}
@@ -0,0 +1,97 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _FRAMEPIPELINE_H_
+#define _FRAMEPIPELINE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pixel.h"
+
+// Number of frame buffers in the ring
+// The encoder holds the current and the previous frame, the rest are decoded ahead of it
+#define NFRAMEBUFFERS 4
+
+// Where the frames come from
+enum _FrameSource {SourcePNG, SourceRGB24, SourceRGBA, SourceY4M};
+
+typedef struct _FrameBuffer {
+    uint8_t* data;  // RGB frame (room for RGBA and the png scanline filter bytes), or indices if npalette > 0
+    uint32_t width;
+    uint32_t height;
+    int npalette;  // Number of colors of a frame of indices into palette, 0 for RGB frames
+    SortedPixel palette[256];
+    int8_t* detail;  // What each RGB value was rounded by, see readPNGFrame, allocated with data if the pipeline keeps it
+    int hasdetail;   // Set if detail holds this frame's, i.e. for 16-bit RGB frames
+    uint8_t* alpha;  // Alpha of each pixel, allocated with data if the pipeline keeps it
+    int hasalpha;    // Set if alpha holds this frame's, i.e. for RGB frames read from PNGs with alpha and from RGBA streams
+    // Frames of animated PNGs can cover only a width x height rectangle of the screen, from (left,top)
+    uint32_t screenwidth;
+    uint32_t screenheight;
+    uint32_t left;
+    uint32_t top;
+    int delay;     // Frame delay in 1/100 s of animated PNG frames, -1 for other frames
+    int disposal;  // GIF disposal method of animated PNG frames, 0 for other frames
+} FrameBuffer;
+
+typedef struct _FramePipeline {
+    enum _FrameSource source;
+    // Input files for SourcePNG
+    char** filenames;
+    int nfile;
+    int keepindices;  // Read palette and grayscale PNGs as indices into their own palette
+    int keepdetail;   // Keep the rounding of 16-bit PNGs for dithering
+    int keepalpha;    // Keep the alpha of PNGs and RGBA streams for transparency
+    // Raw frame stream on stdin for the other sources
+    FILE* rawfid;
+    uint32_t rawwidth;
+    uint32_t rawheight;
+    uint16_t rawdelay;  // Frame delay in 1/100 s from the stream header (Y4M only), 0 if unknown
+    // Ring of frame buffers, filled in order by the decoder thread and consumed in order by the encoder
+    FrameBuffer ring[NFRAMEBUFFERS];
+    int readpos;   // Next buffer to be handed to the encoder
+    int writepos;  // Next buffer to be filled by the decoder
+    int nready;    // Decoded buffers waiting for the encoder
+    int nfree;     // Buffers available to the decoder
+    int done;      // Decoder has finished, either after the last file or on an error
+    // Error reporting, done on the main thread so that the GUI message box is not opened from the decoder thread
+    int error;
+    char errortitle[256];
+    char errormessage[256];
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} FramePipeline;
+
+int startFramePipeline(FramePipeline* pipeline, char** filenames, int nfile, int keepindices, int keepdetail, int keepalpha);
+int startRawFramePipeline(FramePipeline* pipeline, enum _FrameSource source, uint32_t width, uint32_t height, int keepalpha);
+FrameBuffer* nextFrame(FramePipeline* pipeline);
+int hasNextFrame(FramePipeline* pipeline);
+void releaseFrame(FramePipeline* pipeline);
+int coversScreen(FrameBuffer* buffer);
+void stopFramePipeline(FramePipeline* pipeline);
+
+#endif
@@ -23,18 +23,27 @@
  */
 
 #include <string.h>
+#include <pthread.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "gifWriter.h"
 #include "dither.h"
 #include "palette.h"
+#include "allocate.h"
+#include "lzwStream.h"
 
 #define MAXCODESIZE 12
 #define DEBUG 0
 
 
-// Corresponds to definition in gifWriter.h: enum _Palettes {P685g, P676g, P884, Pweb, Pmedian, Pgray, PgrayT};
-const int _Palette_nbits[] = {8, 8, 8, 8, 0, 0, 8};
-const int _Palette_size[] = {255, 255, 256, 216, 0, 0, 255};
+// Corresponds to definition in gifWriter.h: enum _Palettes {P685g, P676g, P884, Pweb, Pmedian, Pgray, PgrayT, Pwu, Poctree, Pfile, Pindexed};
+// The size of Pfile depends on the palette file, see getPaletteSize
+const int _Palette_nbits[] = {8, 8, 8, 8, 0, 0, 8, 0, 0, 8, 0};
+const int _Palette_size[] = {255, 255, 256, 216, 0, 0, 255, 0, 0, 0, 0};
 
 GIFOptStruct newGIFOptStructInst(){
     // Set defaults
@@ -45,12 +54,117 @@ GIFOptStruct newGIFOptStructInst(){
     gifopts.colorpalette = P685g;
     gifopts.colortablebitsize = 0;
     gifopts.forcebw = 0;
+    gifopts.refine = 0;
     gifopts.palette = malloc(sizeof(SortedPixel)*256);  // This leaks, but is used until program exit
     memset(gifopts.palette, 0, sizeof(SortedPixel)*256);
+    gifopts.detail = NULL;
+    gifopts.alpha = NULL;
+    gifopts.alphathreshold = 0;
+    gifopts.disposal = 1;
+    gifopts.left = 0;
+    gifopts.top = 0;
+    gifopts.octree = NULL;
+    gifopts.palettesize = 0;
+    gifopts.paletteout = NULL;
+    gifopts.lossy = 0;
+    gifopts.clearpolicy = ClearFull;
+    gifopts.lzwbands = 1;
+    gifopts.scratch = checkedCalloc(1, sizeof(GIFScratch));  // This also leaks, its buffers are reused until program exit
     
     return gifopts;
 }
 
+void freeGIFScratch(GIFScratch* scratch){
+    // Free the buffers kept across frames, including those of the tiles
+    freeScratch(&scratch->sorted);
+    freeScratch(&scratch->unique);
+    freeScratch(&scratch->ordered);
+    freeScratch(&scratch->strip);
+    freeScratch(&scratch->laststrip);
+    freeScratch(&scratch->residual);
+    freeScratch(&scratch->detail);
+    freeScratch(&scratch->alpha);
+    freeLZWScratch(&scratch->lzw);
+    for(int b=0;b<MAXTHREADS;b++){
+        freeLZWScratch(&scratch->bands[b]);
+    }
+    if(scratch->tiles != NULL){
+        for(int t=0;t<MAXTHREADS;t++){
+            freeGIFScratch(&scratch->tiles[t]);
+        }
+        free(scratch->tiles);
+        scratch->tiles = NULL;
+    }
+}
+
+int getPaletteBits(GIFOptStruct gifopts){
+    // Number of bits of the global color table, 0 if the palette is variable and goes in a local color table
+    return _Palette_nbits[gifopts.colorpalette];
+}
+
+int getPaletteSize(GIFOptStruct gifopts){
+    // Number of colors in a global color table palette, not counting the transparent index
+    // With alpha, a palette that fills the table gives up its last color to the transparent index
+    int size = _Palette_size[gifopts.colorpalette];
+    if(gifopts.colorpalette == Pfile || gifopts.colorpalette == Pindexed){
+        size = gifopts.palettesize;
+    }
+    if(gifopts.alphathreshold > 0 && getPaletteBits(gifopts) != 0 && size > 255){
+        size = 255;
+    }
+    return size;
+}
+
+int getNumThreads(){
+    // Number of processors to split work over
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = info.dwNumberOfProcessors;
+#else
+    int n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(n < 1){
+        n = 1;
+    }
+    if(n > MAXTHREADS){
+        n = MAXTHREADS;
+    }
+    return n;
+}
+
+int hasTransparentIndex(GIFOptStruct gifopts){
+    // Returns non-zero if index 0xff of the palette is the transparent index
+    // With alpha, every global color table palette has one
+    if(gifopts.alphathreshold > 0 && getPaletteBits(gifopts) != 0){
+        return 1;
+    }
+    switch (gifopts.colorpalette){
+        case P685g:
+        case P676g:
+        case Pweb:
+        case PgrayT:
+            return 1;
+        case Pfile:
+            // Loaded palettes with room to spare get a transparent index
+            return gifopts.palettesize <= 255;
+        default:
+            return 0;
+    }
+}
+
+int getTransparentIndex(GIFOptStruct gifopts, int tablebitsize){
+    // Returns the transparent index of an image whose color table has tablebitsize bits, -1 if it has none
+    // Adaptive palettes keep the last entry of the table free for it in frames with alpha
+    if(hasTransparentIndex(gifopts)){
+        return 0xff;
+    }
+    if(getPaletteBits(gifopts) == 0 && gifopts.colorpalette != Pindexed && gifopts.alpha != NULL){
+        return (1 << tablebitsize)-1;
+    }
+    return -1;
+}
+
 // Write the color palette
 void writeColorPalette(FILE* fid, SortedPixel* palette, int tablesize){
     // Put into a temporary array and then write to file in one big chunk
@@ -64,8 +178,8 @@ void writeColorPalette(FILE* fid, SortedPixel* palette, int tablesize){
 }
 
 // Set transparent indices
-void setTransparent(uint8_t* frame, uint8_t* lastframe, uint32_t npixel){
-    for(int i=0;i<npixel;i++){
+void setTransparent(uint8_t* frame, uint8_t* lastframe, size_t npixel){
+    for(size_t i=0;i<npixel;i++){
         if(*frame == *lastframe){
             *frame = 0xff;  // This is the transparent index for all palettes
         }
@@ -74,6 +188,15 @@ void setTransparent(uint8_t* frame, uint8_t* lastframe, uint32_t npixel){
     }
 }
 
+// Set the transparent index where the alpha is below the threshold
+void setAlphaTransparent(uint8_t* frame, const uint8_t* alpha, size_t npixel, int alphathreshold, uint8_t transparent){
+    for(size_t i=0;i<npixel;i++){
+        if(alpha[i] < alphathreshold){
+            frame[i] = transparent;
+        }
+    }
+}
+
 void writeGIFHeader(FILE* fid, uint32_t width, uint32_t height, GIFOptStruct gifopts){
 
     uint8_t head[] = "\x47\x49\x46\x38\x39\x61";
@@ -85,6 +208,10 @@ void writeGIFHeader(FILE* fid, uint32_t width, uint32_t height, GIFOptStruct gif
     printf("Error: Image has zero width or height.\n");
     exit(-1);
     }
+    if (width > GIF_MAXSIZE || height > GIF_MAXSIZE){
+        printf("Error: Image is %ux%u, but GIF images can be at most %ix%i.\n", width, height, GIF_MAXSIZE, GIF_MAXSIZE);
+        exit(-1);
+    }
     
     // Write gif header
     fwrite(head, 6, 1, fid);
@@ -97,7 +224,7 @@ void writeGIFHeader(FILE* fid, uint32_t width, uint32_t height, GIFOptStruct gif
     fwrite(&h, sizeof(uint16_t), 1, fid);
     
     // If using a global color table then create it and write it here
-    // Pmedian and Pgray do not do this because they are variable size
+    // Pmedian, Pwu, Poctree and Pgray do not do this because they are variable size
     if(_Palette_nbits[gifopts.colorpalette] != 0){
         // Get the color palette
         getColorPalette(gifopts.palette, NULL, 0, 8, gifopts);
@@ -125,189 +252,266 @@ void writeGIFAppExtension(FILE* fid){
 
 void writeGIFFrame(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame){
 
-#if DEBUG
-    printf("Writing gif local image descriptor\n");
-    printf("width=%d, height=%d\n", width, height);
-#endif
-
     // Error checking
     if (width == 0 || height == 0){
     printf("Error: Image has zero width or height.\n");
     exit(-1);
     }
+    if (width > GIF_MAXSIZE || height > GIF_MAXSIZE){
+        printf("Error: Image is %ux%u, but GIF images can be at most %ix%i.\n", width, height, GIF_MAXSIZE, GIF_MAXSIZE);
+        exit(-1);
+    }
+    
+    // Most frames are a single image
+    if((uint64_t) width*height <= FRAME_MAXPIXELS){
+        writeGIFImage(fid, frame, lastframe, 0, width, height, gifopts, isFirstFrame);
+        return;
+    }
+    
+    // Split larger frames into bands of whole rows, each encoded separately to a temporary file
+    // Only the last band has the frame delay, the others are shown right away (note that browsers slow down images with a zero delay)
+    uint32_t tileheight = TILE_MAXPIXELS/width;
+    if(tileheight < 1){
+        tileheight = 1;
+    }
+    uint32_t ntile = (height+tileheight-1)/tileheight;
+    printf("Splitting the frame into %u tiles of %u rows\n", ntile, tileheight);
+    
+    // Frames that already hold indices have one byte per pixel instead of three
+    size_t pixelbytes = gifopts.colorpalette == Pindexed ? 1 : 3;
+    
+    // Adaptive palettes need a palette per tile, and the octree can only be updated by one tile at a time
+    int nthread = getNumThreads();
+    if(gifopts.octree != NULL){
+        nthread = 1;
+    }
+    GIFTile tiles[MAXTHREADS];
+    pthread_t threads[MAXTHREADS];
+    int started[MAXTHREADS];
+    SortedPixel* palettes = checkedMalloc(sizeof(SortedPixel)*256*nthread);
+    if(gifopts.scratch->tiles == NULL){
+        gifopts.scratch->tiles = checkedCalloc(MAXTHREADS, sizeof(GIFScratch));
+    }
+    uint8_t copybuffer[65536];
+    
+    for(uint32_t first=0; first<ntile; first+=nthread){
+        int nbatch = (ntile-first) < nthread ? (ntile-first) : nthread;
+        
+        for(int t=0;t<nbatch;t++){
+            GIFTile* tile = &tiles[t];
+            uint32_t index = first+t;
+            tile->top = index*tileheight;
+            tile->width = width;
+            tile->height = (height-tile->top) < tileheight ? (height-tile->top) : tileheight;
+            tile->frame = frame + pixelbytes*width*tile->top;
+            tile->lastframe = lastframe + pixelbytes*width*tile->top;
+            tile->isFirstFrame = isFirstFrame;
+            tile->gifopts = gifopts;
+            if(index != ntile-1){
+                tile->gifopts.delay = 0;
+            }
+            if(index != 0){
+                // Only save the palette once
+                tile->gifopts.paletteout = NULL;
+            }
+            if(nthread > 1){
+                // The tiles already keep the processors busy
+                tile->gifopts.lzwbands = 1;
+            }
+            // The tile in the same place of each batch runs on its own thread
+            tile->gifopts.scratch = &gifopts.scratch->tiles[t];
+            if(gifopts.detail != NULL){
+                tile->gifopts.detail = gifopts.detail + 3*(size_t) width*tile->top;
+            }
+            if(gifopts.alpha != NULL){
+                tile->gifopts.alpha = gifopts.alpha + (size_t) width*tile->top;
+            }
+            // Clearing a tile to the background would leave only the last tile of the frame on the screen
+            tile->gifopts.disposal = 1;
+            if(getPaletteBits(gifopts) == 0 && gifopts.colorpalette != Pindexed){
+                tile->gifopts.palette = palettes + 256*t;
+                memset(tile->gifopts.palette, 0, sizeof(SortedPixel)*256);
+            }
+            tile->fid = tmpfile();
+            if(tile->fid == NULL){
+                printf("Error: Could not create a temporary file for a tile. Exiting.\n");
+                exit(-1);
+            }
+            started[t] = pthread_create(&threads[t], NULL, writeGIFTile, tile) == 0;
+            if(!started[t]){
+                // Do it on this thread instead
+                writeGIFTile(tile);
+            }
+        }
+        
+        // Append the tiles in order
+        for(int t=0;t<nbatch;t++){
+            if(started[t]){
+                pthread_join(threads[t], NULL);
+            }
+            rewind(tiles[t].fid);
+            size_t n;
+            while((n = fread(copybuffer, 1, sizeof(copybuffer), tiles[t].fid)) > 0){
+                fwrite(copybuffer, 1, n, fid);
+            }
+            fclose(tiles[t].fid);
+        }
+    }
     
+    free(palettes);
+}
+
+void* writeGIFTile(void* arg){
+    // Tile thread: encode one tile as an image of its own
+    GIFTile* tile = (GIFTile*) arg;
+    writeGIFImage(tile->fid, tile->frame, tile->lastframe, tile->top, tile->width, tile->height, tile->gifopts, tile->isFirstFrame);
+    return NULL;
+}
+
+void writeGIFImageDescriptor(FILE* fid, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int transparent){
+    // Write the graphics control extension and the image descriptor up to its packed byte
+    // The packed byte goes with the local color table, since the table size is not known yet
+    // transparent is the transparent index of the image, see getTransparentIndex, -1 if it has none
+
     // Write graphics control extension block
     fwrite("\x21\xF9\x04", 3, 1, fid);
     // Write the packed byte
-    // Set transparent color flag if palette has a transparent index
-    switch (gifopts.colorpalette){
-        case P685g:
-        case P676g:
-        case Pweb:
-        case PgrayT:
-            fwrite("\x05", 1, 1, fid);
-            break;
-        default:
-            fwrite("\x04", 1, 1, fid);
-            break;
-    }
+    // Disposal method, and the transparent color flag if the image has a transparent index
+    fputc((gifopts.disposal << 2) + (transparent >= 0 ? 1 : 0), fid);
     // Write delay time
     fwrite(&gifopts.delay, sizeof(uint16_t), 1, fid);
-    // Write the transparent color index (always at 0xff)
+    // Write the transparent color index (0xff if there is none)
     // Setting this regardless because the transparent color flag determines whether it is used
-    fwrite("\xff", 1, 1, fid);
+    fputc(transparent >= 0 ? transparent : 0xff, fid);
     // Write the block terminator
     fwrite("\x00", 1, 1, fid);
     
     // Write local image descriptor
+    // top is the position of the image in the frame, which itself can be placed anywhere on the screen
     fputc('\x2C', fid);
-    fwrite("\x00\x00\x00\x00", 4, 1, fid);
+    uint16_t l = (uint16_t) gifopts.left;
+    fwrite(&l, 2, 1, fid);
+    uint16_t t = (uint16_t) (gifopts.top+top);
+    fwrite(&t, 2, 1, fid);
     // Write width and height as uint16
     uint16_t w = (uint16_t) width;
     fwrite(&w, 2, 1, fid);
     uint16_t h = (uint16_t) height;
     fwrite(&h, 2, 1, fid);
-    // Wait to write the packed byte until after we know the minimum table size
-    
-    // Write local color table (if necessary) and palettize the image
-    int tablebitsize = writeGIFLCT(fid, frame, lastframe, width, height, gifopts, isFirstFrame);
+}
+
+void writeGIFImage(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame){
+    // Write one image, i.e. a whole frame or one tile of it, top rows down from the top of the logical screen
+
+#if DEBUG
+    printf("Writing gif local image descriptor\n");
+    printf("width=%d, height=%d\n", width, height);
+#endif
+
+    // Write the image descriptor and local color table (if necessary) and palettize the image
+    int tablebitsize = writeGIFLCT(fid, frame, lastframe, top, width, height, gifopts, isFirstFrame);
     
     // Write image data
     printf("Writing gif frame data\n");
-    writeGIFImageCompressed(fid, frame, width, height, tablebitsize);
+    writeGIFImageCompressed(fid, frame, width, height, tablebitsize, gifopts);
 //    writeGIFImageCompressed9bit(fid, frame, width, height);
 //    writeGIFImageUncompressed256(fid, frame, width*height);
 //    writeGIFImageUncompressed128(fid, frame, width*height);
     
 }
 
-void writeGIFImageCompressed(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height, int tablebitsize){
+void writeGIFImageCompressed(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height, int tablebitsize, GIFOptStruct gifopts){
+    // LZW compress the indices in frame and write them as data sub-blocks
     
     printf("Writing compressed frame\n");
     
-    uint32_t length = width*height;
+    // Only colors of the palette itself may be swapped, not the transparent index or unused table entries
+    int npalette = getPaletteBits(gifopts) != 0 ? getPaletteSize(gifopts) : (1 << tablebitsize);
+    if(getPaletteBits(gifopts) == 0 && getTransparentIndex(gifopts, tablebitsize) >= 0){
+        npalette--;
+    }
     
-    uint8_t startnbits = tablebitsize+1;  // Start the LZW table at 9 bit codes
-    if(startnbits < 3){
-        startnbits = 3;
+    // Number of bands of rows to encode separately, each one costs a clear code and a new string table
+    int nband = gifopts.lzwbands;
+    if(nband == 0){
+        nband = getNumThreads();
+        if((uint64_t) width*height/LZWBAND_MINPIXELS < (uint64_t) nband){
+            nband = (int)((uint64_t) width*height/LZWBAND_MINPIXELS);
+        }
+    }
+    if(nband > MAXTHREADS){
+        nband = MAXTHREADS;
+    }
+    if((uint32_t) nband > height){
+        nband = (int) height;
+    }
+    if(nband < 1){
+        nband = 1;
     }
-    uint16_t clearcode = 1 << (startnbits-1);
-    uint16_t stopcode = clearcode + 1;
-#if DEBUG
-    printf("startnbits=%i\n", startnbits);
-    printf("clearcode=0x%x\n", clearcode);
-    printf("stopcode=0x%x\n", stopcode);
-#endif
     
-    uint32_t widthjumps[10] = {0,0,0,0,0,0,0,0,0,0};  // Location in number of codes where code width increases by one (room for jumps from 2 to 12)
-    uint16_t* buffer = malloc(sizeof(uint16_t)*length);  // frame size
-    uint8_t* output = malloc(sizeof(uint8_t)*2*length);    // Don't really know the final size after compression, so let's guess 2*npixel
-    uint8_t* frameptr;
-    uint16_t* bufferptr;
-    uint8_t* outputptr;
-    frameptr = frame;
+    LZWStream stream;
+    startLZWStream(&stream, fid, tablebitsize, &gifopts.scratch->lzw);
+    stream.clearpolicy = gifopts.clearpolicy;
     
-    // Write the LZW minimum code size byte
-    putc(startnbits-1, fid);
+    if(nband == 1){
+        setLZWLossy(&stream, gifopts.palette, npalette, gifopts.lossy);
+        writeLZWStream(&stream, frame, (size_t) width*height);
+        finishLZWStream(&stream);
+        return;
+    }
     
-    // Compress the frame with LZW
-    // Compression occurs until the LZW table is full, then it needs to be started again
-    int ncodes = 0;
-    int packedn = 0;
-    int ret = 0;
-    int startshift = 0;
-    uint64_t remain = 0;
-    int islast = 0;
-    uint32_t inlen = sizeof(uint8_t)*width*height;
-    
-    // Start the compressed codes with a clear code
-    buffer[0] = clearcode;
-    ret++;
-    ncodes++;
-    bufferptr = buffer+1;
-    
-    while(islast == 0){
-#if DEBUG
-        printf("bufferptr=0x%x\n", bufferptr);
-#endif
-        ret += LZWcompress(&frameptr, &inlen, &bufferptr, widthjumps, startnbits);
-        ncodes += ret;
+    // Encode the bands on their own threads, then join their bits in order
+    // Each band but the last ends with a clear code, so the next one can start from a new table
 #if DEBUG
-        printf("frameptr=0x%x\n", frameptr);
-        printf("inlen=%i\n", inlen);
-        printf("ncodes=%i\n", ncodes);
-        printf("widthjumps={%i,%i,%i,%i,%i,%i,%i,%i,%i,%i}\n",widthjumps[0],widthjumps[1],widthjumps[2],widthjumps[3]
-               ,widthjumps[4],widthjumps[5],widthjumps[6],widthjumps[7]
-               ,widthjumps[8],widthjumps[9]);
+    printf("LZW encoding in %i bands\n", nband);
 #endif
-        
-        if(inlen == 0){
-            // End table with stop code
-#if DEBUG
-            printf("End of codes reached, adding stop code\n");
-#endif
-            *bufferptr = stopcode;
-            ret++;
-            ncodes++;
-            islast = 1;
-        }else{
-            // Reset table with clear code
-#if DEBUG
-            printf("*bufferptr=0x%x\n", *bufferptr);
-#endif
-            *bufferptr = clearcode;
-#if DEBUG
-            printf("bufferptr=0x%x\n", bufferptr);
-#endif
-            ret++;
-            ncodes++;
+    GIFBand bands[MAXTHREADS];
+    pthread_t threads[MAXTHREADS];
+    int started[MAXTHREADS];
+    uint32_t bandheight = (height+nband-1)/nband;
+    for(int b=0;b<nband;b++){
+        GIFBand* band = &bands[b];
+        uint32_t top = b*bandheight;
+        uint32_t nrows = (height-top) < bandheight ? (height-top) : bandheight;
+        band->frame = frame + (size_t) width*top;
+        band->length = (size_t) width*nrows;
+        band->islast = (b == nband-1);
+        startLZWBand(&band->stream, tablebitsize, band->length, &gifopts.scratch->bands[b]);
+        band->stream.clearpolicy = gifopts.clearpolicy;
+        setLZWLossy(&band->stream, gifopts.palette, npalette, gifopts.lossy);
+        started[b] = pthread_create(&threads[b], NULL, writeGIFBand, band) == 0;
+        if(!started[b]){
+            // Do it on this thread instead
+            writeGIFBand(band);
         }
-                   
-        bufferptr = buffer;
-        
-        // Pack all codes into bytes
-        packedn += packLSB(bufferptr, &output[packedn], ret, startnbits, &remain, &startshift, widthjumps, islast);
-        
-        // Reset
-        bufferptr = buffer;
-        ret = 0;
     }
-    
-    // Write chunks of encoded bytes
-    int chunksize = 254;
-    outputptr = output;
-    while(packedn > chunksize){
-        putc((uint8_t) chunksize, fid);  // Number of bytes in data chunk
-        fwrite(outputptr, 1, chunksize, fid);
-        outputptr += chunksize;
-        packedn -= chunksize;
-#if DEBUG
-        printf("packedn=%i\n", packedn);
-#endif
+    for(int b=0;b<nband;b++){
+        if(started[b]){
+            pthread_join(threads[b], NULL);
+        }
+        addLZWBand(&stream, &bands[b].stream);
     }
     
-    // Write the remainder
-    // Include signal for last data chunk
-    fwrite(&packedn, 1, 1, fid);  // Number of bytes in data chunk
-    fwrite(outputptr, 1, packedn, fid);
-    
-    // Write signal for last data chunk
-    putc('\x00', fid);
-    
-    // Free allocated memory
-    free(buffer);
-    free(output);
-    
+    // The stop code came with the last band
+    closeLZWStream(&stream);
+}
+
+void* writeGIFBand(void* arg){
+    // Band thread: LZW encode the indices of one band
+    GIFBand* band = (GIFBand*) arg;
+    writeLZWStream(&band->stream, band->frame, band->length);
+    finishLZWBand(&band->stream, band->islast);
+    return NULL;
 }
 
 void writeGIFImageCompressed9bit(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height){
     
     printf("Writing compressed frame\n");
     
-    uint32_t length = width*height;
+    size_t length = (size_t) width*height;
     
-    uint16_t* buffer = malloc(sizeof(uint16_t)*length);  // frame size
-    uint8_t* output = malloc(sizeof(uint8_t)*length);    // frame size
+    uint16_t* buffer = checkedMalloc(checkedSize(length+2, sizeof(uint16_t)));  // frame size
+    uint8_t* output = checkedMalloc(checkedSize(length+2, 2));    // frame size
     uint8_t* frameptr;
     uint16_t* bufferptr;
     uint8_t* outputptr;
@@ -320,7 +524,7 @@ void writeGIFImageCompressed9bit(FILE* fid, uint8_t* frame, uint32_t width, uint
     int n = 1;
     buffer[0] = 0x100;  // LZW table clear
     // Full frame through LZW
-    n += LZWcompress9bit(frame, sizeof(uint8_t)*width*height, &buffer[1]);
+    n += LZWcompress9bit(frame, length, &buffer[1]);
     printf("n=%i\n", n);
     buffer[n] = 0x101;  // LZW table end
     n++;
@@ -352,12 +556,12 @@ void writeGIFImageCompressed9bit(FILE* fid, uint8_t* frame, uint32_t width, uint
     free(output);
 }
 
-void writeGIFImageUncompressed256(FILE* fid, uint8_t* frame, uint32_t length){
+void writeGIFImageUncompressed256(FILE* fid, uint8_t* frame, size_t length){
     
     printf("Writing uncompressed 256 color frame\n");
     
-    uint16_t* buffer = malloc(sizeof(uint16_t)*256);  // color table size
-    uint8_t* output = malloc(sizeof(uint8_t)*256);  // color table size
+    uint16_t* buffer = checkedMalloc(sizeof(uint16_t)*256);  // color table size
+    uint8_t* output = checkedMalloc(sizeof(uint8_t)*256);  // color table size
     uint8_t* frameptr;
     
     int n = length;
@@ -406,7 +610,7 @@ void writeGIFImageUncompressed256(FILE* fid, uint8_t* frame, uint32_t length){
     
 }
 
-void writeGIFImageUncompressed128(FILE* fid, uint8_t* frame, uint32_t length){
+void writeGIFImageUncompressed128(FILE* fid, uint8_t* frame, size_t length){
     
     printf("Writing uncompressed 128 color frame\n");
     
@@ -439,49 +643,75 @@ void writeGIFImageUncompressed128(FILE* fid, uint8_t* frame, uint32_t length){
     
 }
 
-int comparefcn_pixel(const void* first, const void* second){
-    return ((SortedPixel*)first)->pixel - ((SortedPixel*)second)->pixel;
-}
-
+// Comparators compare rather than subtract, since the difference of two uint32_t does not fit in an int
 int comparefcn_sortind(const void* first, const void* second){
-    return ((SortedPixel*)first)->sortedindex - ((SortedPixel*)second)->sortedindex;
-}
-
-int comparefcn_frameind(const void* first, const void* second){
-    return ((SortedPixel*)first)->frameindex - ((SortedPixel*)second)->frameindex;
+    uint32_t a = ((SortedPixel*)first)->sortedindex;
+    uint32_t b = ((SortedPixel*)second)->sortedindex;
+    return (a > b) - (a < b);
 }
 
 int comparefcn_colorind(const void* first, const void* second){
-    return ((SortedPixel*)first)->colorindex - ((SortedPixel*)second)->colorindex;
+    // Colors with the same index are ordered by color, as getUniqueColors leaves them, whatever the qsort of the C library
+    const SortedPixel* a = (const SortedPixel*) first;
+    const SortedPixel* b = (const SortedPixel*) second;
+    if(a->colorindex != b->colorindex){
+        return (int) a->colorindex - (int) b->colorindex;
+    }
+    return (a->pixel > b->pixel) - (a->pixel < b->pixel);
 }
 
-uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame){
-    // lastframe contains the indices from the previous frame after it has been run through this code
-    // For the first frame, lastframe has been initialized to zeros, so all indices are equal to the background color
-    
-    SortedPixel* buffer;// = malloc(sizeof(SortedPixel)*npixel);
-    SortedPixel* unique;//[npixel];
-    SortedPixel* bufferptr;
-    uint8_t* frameptr;
-    uint32_t npixel = width*height;
+void sortPixelsByColor(SortedPixel* pixels, SortedPixel* spare, size_t npixel){
+    // Sort pixels by color with two passes of a 12-bit counting sort, into spare and back
+    // Pixels of the same color stay in the order they were in, and unlike qsort no memory is allocated
+    // Colors are 24-bit and frames have fewer than 2^32 pixels (see FRAME_MAXPIXELS)
+    
+    uint32_t count[2][4096];
+    memset(count, 0, sizeof(count));
+    for(size_t i=0;i<npixel;i++){
+        count[0][pixels[i].pixel & 0xfff]++;
+        count[1][pixels[i].pixel >> 12]++;
+    }
     
-#if DEBUG
-    printf("Writing gif local color table\n");
-    printf("npixel=%d\n", npixel);
-#endif
+    // Turn the counts into the start of each digit
+    for(int pass=0;pass<2;pass++){
+        uint32_t start = 0;
+        for(int d=0;d<4096;d++){
+            uint32_t n = count[pass][d];
+            count[pass][d] = start;
+            start += n;
+        }
+    }
     
-    // Set buffer array to zeros
-    buffer = malloc(sizeof(SortedPixel)*npixel);
-    unique = malloc(sizeof(SortedPixel)*npixel);
-    memset(buffer, 0, sizeof(SortedPixel)*npixel);
-    memset(unique, 0, sizeof(SortedPixel)*npixel);  // Necessary to prevent junk at the end of the color table if there are fewer unique colors than the length of the color table. Also for zeroing out residual for dithering.
+    for(size_t i=0;i<npixel;i++){
+        spare[count[0][pixels[i].pixel & 0xfff]++] = pixels[i];
+    }
+    for(size_t i=0;i<npixel;i++){
+        pixels[count[1][spare[i].pixel >> 12]++] = spare[i];
+    }
+}
+
+uint32_t getUniqueColors(uint8_t* frame, size_t npixel, SortedPixel* buffer, SortedPixel* unique, const uint8_t* alpha, int alphathreshold, size_t* nsorted){
+    // Fill buffer with the RGB frame, sort it by color, and collect the unique colors (with pixel counts) into unique
+    // If alpha is given then the pixels with less alpha than alphathreshold are transparent and left out
+    // Every field of buffer is set here, and the entries of unique after the unique colors are zeroed up to the first 256,
+    // so neither has to be zeroed by the caller
+    // Returns the number of unique colors, and sets nsorted to the number of pixels in buffer
+    
+    SortedPixel* bufferptr = buffer;
+    uint8_t* frameptr = frame;
+    SortedPixel blank;
+    memset(&blank, 0, sizeof(SortedPixel));
     
-    // Set pointers
-    bufferptr = buffer;
-    frameptr = frame;
+    // The table is padded with the zeros after the unique colors if there are fewer of them than its length
+    size_t npadded = npixel < 256 ? npixel : 256;
     
     // Copy frame data into buffer array
-    for(int i=0;i<npixel;i++){
+    for(size_t i=0;i<npixel;i++){
+        if(alpha != NULL && alpha[i] < alphathreshold){
+            frameptr += 3;
+            continue;
+        }
+        *bufferptr = blank;
         memcpy(&(bufferptr->pixel), frameptr, 3);  // Copy three RGB bytes into uint32_t pixel
         bufferptr->R = *frameptr++;
         bufferptr->G = *frameptr++;
@@ -489,10 +719,15 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
         bufferptr->frameindex = i;
         bufferptr++;
     }
+    npixel = bufferptr - buffer;
+    *nsorted = npixel;
+    if(npixel == 0){
+        memset(unique, 0, sizeof(SortedPixel)*npadded);
+        return 0;
+    }
     
-    // Sort the buffer by the pixel color
-    bufferptr = buffer;
-    qsort((void*)bufferptr, npixel, sizeof(SortedPixel), comparefcn_pixel);
+    // Sort the buffer by the pixel color, unique is free to be used as the spare array until it is filled below
+    sortPixelsByColor(buffer, unique, npixel);
 
     // Find unique entries and number of each
     memcpy(&unique[0], &buffer[0], sizeof(SortedPixel));
@@ -502,7 +737,7 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
 #endif
     
     unique[nunique].npixel++;
-    for(int i=1;i<npixel;i++){
+    for(size_t i=1;i<npixel;i++){
         buffer[i].sortedindex = i;
         if(buffer[i].pixel == unique[nunique].pixel){
             unique[nunique].npixel++;
@@ -520,6 +755,80 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
     }
     nunique++;
     
+    // The rest of unique still holds the sort, so it is padded only now
+    if((size_t) nunique < npadded){
+        memset(&unique[nunique], 0, sizeof(SortedPixel)*(npadded-nunique));
+    }
+    
+    return nunique;
+}
+
+uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame){
+    // lastframe contains the indices from the previous frame after it has been run through this code
+    // For the first frame, lastframe has been initialized to zeros, so all indices are equal to the background color
+    // The image descriptor is written here as well, since the transparent index of an adaptive palette depends on the table size
+    
+    SortedPixel* buffer;
+    SortedPixel* unique;
+    SortedPixel* bufferptr;
+    uint8_t* frameptr;
+    size_t npixel = (size_t) width*height;
+    
+#if DEBUG
+    printf("Writing gif local color table\n");
+    printf("npixel=%zu\n", npixel);
+#endif
+    
+    // A palette or grayscale PNG already holds indices, its own palette is written as the local color table as it is
+    // Its indices cannot be compared with those of another table, so there is no transparent index
+    if(gifopts.colorpalette == Pindexed){
+        int tablebitsize = 1;
+        while((1 << tablebitsize) < gifopts.palettesize){
+            tablebitsize++;
+        }
+        writeGIFImageDescriptor(fid, top, width, height, gifopts, -1);
+        fputc((1 << 7) + (tablebitsize-1), fid);
+        writeColorPalette(fid, gifopts.palette, 1 << tablebitsize);
+        
+        if(isFirstFrame && gifopts.paletteout != NULL){
+            writePaletteFile(gifopts.paletteout, gifopts.palette, gifopts.palettesize, 0);
+        }
+        
+        return tablebitsize;
+    }
+    
+    // A global color table palette without dithering needs no unique colors, each pixel is simply mapped to its closest palette color
+    // This gives the same indices as palettizing the unique colors
+    if(getPaletteBits(gifopts) != 0 && gifopts.dither == 0){
+        writeGIFImageDescriptor(fid, top, width, height, gifopts, getTransparentIndex(gifopts, getPaletteBits(gifopts)));
+        fputc(0x00, fid);  // No local color table
+        
+        palettizeFrame(frame, npixel, gifopts.palette, getPaletteSize(gifopts));
+        
+        if(isFirstFrame && gifopts.paletteout != NULL){
+            writePaletteFile(gifopts.paletteout, gifopts.palette, getPaletteSize(gifopts), hasTransparentIndex(gifopts));
+        }
+        if(isFirstFrame == 0 && hasTransparentIndex(gifopts)){
+            setTransparent(frame, lastframe, npixel);
+        }
+        if(gifopts.alpha != NULL){
+            setAlphaTransparent(frame, gifopts.alpha, npixel, gifopts.alphathreshold, 0xff);
+        }
+        
+        return getPaletteBits(gifopts);
+    }
+    
+    // Kept from frame to frame, getUniqueColors zeroes what needs to be
+    buffer = reserveScratch(&gifopts.scratch->sorted, checkedSize(npixel, sizeof(SortedPixel)));
+    unique = reserveScratch(&gifopts.scratch->unique, checkedSize(npixel, sizeof(SortedPixel)));
+    
+    // Sort the frame colors and find the unique entries, leaving out transparent pixels so that they take up no colors
+    size_t nsorted;
+    int nunique = getUniqueColors(frame, npixel, buffer, unique, gifopts.alpha, gifopts.alphathreshold, &nsorted);
+    
+    // An adaptive palette of a frame with alpha keeps its last entry for the transparent index
+    int reserved = getPaletteBits(gifopts) == 0 && gifopts.alpha != NULL;
+    
     // Find the minimum table size
     // This can either be set externally or programmatically found by the number of unique entries
     // Certain color palettes will dictate what this value is
@@ -538,7 +847,7 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
             // Find size programatically
             tablebitsize = 1;
             tablesize = 1 << tablebitsize;
-            while(nunique > tablesize){
+            while(nunique + reserved > tablesize){
                 if(tablebitsize >= 8){
                     break;
                 }
@@ -556,34 +865,53 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
     // Write packed byte of the local image descriptor before writing the local color table
     // Need to do this here because we only just found the minimum size of the table
     // Note that the documentation at https://www.fileformat.info/format/gif/egff.htm is wrong and the packed byte for the local color table looks like the packed byte for the global color table
-    // Only use a local color table is using Pmedian or Pgray, otherwise set size to zero
+    // Only use a local color table is using Pmedian, Pwu, Poctree or Pgray, otherwise set size to zero
     uint8_t packedbyte;
     if(_Palette_nbits[gifopts.colorpalette] == 0){
         packedbyte = (1 << 7) + (tablebitsize-1);
     }else{
         packedbyte = 0x00;
     }
+    int transparent = getTransparentIndex(gifopts, tablebitsize);
+    writeGIFImageDescriptor(fid, top, width, height, gifopts, transparent);
     fputc(packedbyte, fid);
     
-    // Get the color palette if not yet defined (i.e., for Pmedian or Pgray)
+    // Get the color palette if not yet defined (i.e., for Pmedian, Pwu, Poctree or Pgray)
+    // A frame that is all transparent has no colors to build one from
     if(_Palette_nbits[gifopts.colorpalette] == 0){
-        getColorPalette(gifopts.palette, unique, nunique, tablebitsize, gifopts);
+        if(nunique > 0){
+            getColorPalette(gifopts.palette, unique, nunique, tablebitsize, gifopts);
+        }else{
+            memset(gifopts.palette, 0, sizeof(SortedPixel)*tablesize);
+        }
     }
     
-    // Palettize the unique colors (except for Pmedian and Pgray)
-    if(_Palette_size[gifopts.colorpalette] != 0){
-        palettizeColors(gifopts.palette, _Palette_size[gifopts.colorpalette], unique, nunique);
+    // Palettize the unique colors (except for Pmedian, Pwu, Poctree and Pgray)
+    if(getPaletteSize(gifopts) != 0){
+        palettizeColors(gifopts.palette, getPaletteSize(gifopts), unique, nunique);
     }
     // Special palettizing handling for Pgray
     if(gifopts.colorpalette == Pgray){
-        palettizeColors(gifopts.palette, tablesize, unique, nunique);
+        palettizeColors(gifopts.palette, tablesize-reserved, unique, nunique);
+    }
+    if(reserved){
+        freePaletteEntry(gifopts.palette, tablesize-1, unique, nunique);
     }
     
-    // Write the color palette (only if using Pmedian or Pgray)
+    // Write the color palette (only if using Pmedian, Pwu, Poctree or Pgray)
     if(_Palette_nbits[gifopts.colorpalette] == 0){
         writeColorPalette(fid, gifopts.palette, tablesize);
     }
     
+    // Save the palette of the first frame if requested
+    if(isFirstFrame && gifopts.paletteout != NULL){
+        if(getPaletteBits(gifopts) != 0){
+            writePaletteFile(gifopts.paletteout, gifopts.palette, getPaletteSize(gifopts), hasTransparentIndex(gifopts));
+        }else{
+            writePaletteFile(gifopts.paletteout, gifopts.palette, tablesize-reserved, 0);
+        }
+    }
+    
     // Re-sort unique into sorted state, same as buffer still is
     bufferptr = unique;
     qsort((void*)bufferptr, nunique, sizeof(SortedPixel), comparefcn_sortind);
@@ -598,12 +926,32 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
         }
     }
     
-    // Sort the buffer to its original frame order
-    bufferptr = buffer;
-    qsort((void*)bufferptr, npixel, sizeof(SortedPixel), comparefcn_frameind);
+    // Without dithering only the indices are needed, so put them straight into frame in their original order
+    if(gifopts.dither == 0){
+        for(size_t i=0;i<nsorted;i++){
+            frame[buffer[i].frameindex] = buffer[i].colorindex;
+        }
+    }
     
     // Dither the image based on the smaller color palette
     if(gifopts.dither > 0){
+        // Put the buffer back in its original frame order, each pixel goes straight to its place
+        // Transparent pixels are not in the buffer, their places are skipped by dither
+        SortedPixel* ordered = reserveScratch(&gifopts.scratch->ordered, checkedSize(npixel, sizeof(SortedPixel)));
+        for(size_t i=0;i<nsorted;i++){
+            ordered[buffer[i].frameindex] = buffer[i];
+        }
+        buffer = ordered;
+        
+        // Start from the full precision of a 16-bit source, so that its gradients are dithered rather than banded
+        if(gifopts.detail != NULL){
+            for(size_t i=0;i<npixel;i++){
+                buffer[i].residualR = gifopts.detail[3*i] / 257.f;
+                buffer[i].residualG = gifopts.detail[3*i+1] / 257.f;
+                buffer[i].residualB = gifopts.detail[3*i+2] / 257.f;
+            }
+        }
+        
         // Compress unique down to the color table size to speed up dithering
 #if DEBUG
         printf("nunique=%i\n", nunique);
@@ -634,34 +982,23 @@ uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t wid
         
         // Do the dithering
         printf("Dithering the frame\n");
-        dither(unique, nunique, buffer, width, height);
-    }
-    
-    // Store image indices in frame
-    frameptr = frame;
-    for(int i=0;i<npixel;i++){
-        *frameptr++ = buffer[i].colorindex;
+        dither(unique, nunique, buffer, width, height, gifopts.alpha, gifopts.alphathreshold);
+        
+        // Store image indices in frame
+        frameptr = frame;
+        for(size_t i=0;i<npixel;i++){
+            *frameptr++ = buffer[i].colorindex;
+        }
     }
     
     // If using a palette with a transparent index, replace indices that are equal to the last frame with the transparent index
     // Only do this if it is not the first frame
-    if(isFirstFrame == 0){
-        switch (gifopts.colorpalette){
-            case P685g:
-            case P676g:
-            case Pweb:
-            case PgrayT:
-                setTransparent(frame, lastframe, npixel);
-                break;
-            default:
-                // Do nothing
-                break;
-        }
+    if(isFirstFrame == 0 && hasTransparentIndex(gifopts)){
+        setTransparent(frame, lastframe, npixel);
+    }
+    if(gifopts.alpha != NULL){
+        setAlphaTransparent(frame, gifopts.alpha, npixel, gifopts.alphathreshold, (uint8_t) transparent);
     }
-    
-    // Free allocated variables
-    free(unique);
-    free(buffer);
     
     // Return the size of the color table in number of bits
     return tablebitsize;
@@ -732,102 +1069,3 @@ uint32_t convert9to8(uint16_t* input, uint8_t* output, uint32_t length){
     return n;
 }
 
-uint32_t packLSB(uint16_t* input, uint8_t* output, uint32_t length, uint8_t startnbits, uint64_t* remain, int* startshift, uint32_t* widthjumps, int islast){
-    // Convert LZW codes to 8-bit bytes
-    // Starts with startnbits-bit codes, which increase by one at the intervals defined in widthjumps
-    // Zero-pads end if islast != 0
-    // Otherwise saves remaining data in remain and updates startshift with the remaining shift value
-    // Returns number of bytes in output
-    // output is padded with zeros at the end to make full bytes
-    
-    uint64_t buffer = 0;
-    uint64_t tmp;
-    int shift = *startshift;
-    uint32_t n = 0;
-    int nbits = startnbits;
-    int jump = 0;
-    int count = 1;  // For some reason it is necessary to start this at 1, perhaps because of the initial clear code?
-    uint64_t clearcode = 1 << (startnbits-1);
-    
-    buffer = *remain;
-#if DEBUG
-    printf("length=%i\n",length);
-    printf("shift=%i\n",shift);
-    printf("buffer=0x%08llx\n",buffer);
-#endif
-    for(int i=0;i<length;i++){
-        // Grab next nbit-bit code
-        tmp = (uint64_t) input[i];
-#if DEBUG
-        printf("input[%i]=0x%04x\n",i,input[i]);
-#endif
-        
-        // If a clear code is encountered, then reset the counter for checking jumps
-        if(tmp == clearcode){
-            count = 0;
-        }
-        
-        // If at a width increase index then bump up nbits
-        if(nbits < MAXCODESIZE && count > (widthjumps[jump]+1)){
-#if DEBUG
-            printf("widthjumps[jump]=%i\n",widthjumps[jump]);
-            printf("nbits=%i\n",nbits+1);
-#endif
-            jump++;
-            nbits++;
-        }
-        
-        // Shift the input and add it to the buffer
-        buffer += (tmp << shift);
-#if DEBUG
-        printf("shift=%i\n",shift);
-        printf("buffer=0x%08llx\n",buffer);
-#endif
-        
-        // Update the shift value
-        shift += nbits;
-        
-        // Copy the lowest buffer byte to the output if there is one available
-        while(shift >= 8){
-            *output++ = (uint8_t) buffer;
-#if DEBUG
-            printf("output=0x%02x\n",*(output-1));
-#endif
-            n++;
-            // Shift the buffer right to clear the copied byte
-            buffer = buffer >> 8;
-#if DEBUG
-            printf("buffer=0x%08llx\n",buffer);
-#endif
-            
-            // Update the shift
-            shift -= 8;
-        }
-        
-        count++;
-        
-    }
-    
-    // If is the last code to be written then zero-pad the last byte (unnecessary since right shifting already does this) and write out the final byte
-    if(islast != 0){
-        *output++ = (uint8_t) buffer;
-#if DEBUG
-        printf("output=0x%02x\n",*(output-1));
-#endif
-        n++;
-        // Shift the buffer right to clear the copied byte
-        buffer = buffer >> 8;
-        shift = 0;
-    }
-    
-    // Store what remains of the buffer for the next call
-    *remain = buffer;
-    *startshift = shift;
-#if DEBUG
-    printf("nbits=%i\n",nbits);
-    printf("remain=0x%08llx\n",buffer);
-    printf("startshift=%i\n",*startshift);
-#endif
-    
-    return n;
-}
@@ -28,10 +28,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "pixel.h"
+#include "lzwStream.h"
+#include "allocate.h"
+
+// GIF dimensions are stored as uint16
+#define GIF_MAXSIZE 65535
+// Frames with more pixels than this are split into tiles of at most TILE_MAXPIXELS pixels, each its own image with its own color table
+// Each tile is encoded on its own thread, and each needs about 80 bytes per pixel while being palettized
+#define FRAME_MAXPIXELS (1 << 24)
+#define TILE_MAXPIXELS (1 << 22)
+#define MAXTHREADS 16
+// With automatic LZW bands (-b 0), each band has at least this many pixels
+#define LZWBAND_MINPIXELS (1 << 18)
 
 
 // Set up an enum for the palettes and an array with the corresponding number of palette bits (0 if variable)
-enum _Palettes {P685g, P676g, P884, Pweb, Pmedian, Pgray, PgrayT};
+// Pindexed is the palette of a frame that already holds indices, i.e. a palette or grayscale PNG, and is set per frame
+enum _Palettes {P685g, P676g, P884, Pweb, Pmedian, Pgray, PgrayT, Pwu, Poctree, Pfile, Pindexed};
+
+typedef struct _GIFScratch {
+    // Buffers of the encoder that are kept from one frame to the next, so that frames of the same size allocate nothing
+    ScratchBuffer sorted;  // The pixels of the frame sorted by color, see writeGIFLCT
+    ScratchBuffer unique;  // The unique colors of the frame
+    ScratchBuffer ordered;  // The pixels back in frame order for dithering
+    ScratchBuffer strip;  // Rows of the frame and of the previous frame's indices, and the dithering error, see writeGIFStripFrame
+    ScratchBuffer laststrip;
+    ScratchBuffer residual;
+    ScratchBuffer detail;  // Rows of detail for the strip, see writeGIFStripFrame
+    ScratchBuffer alpha;  // Rows of alpha for the strip
+    LZWScratch lzw;  // String table of the image
+    LZWScratch bands[MAXTHREADS];  // String tables of the LZW bands
+    struct _GIFScratch* tiles;  // One per tile thread for frames that are split into tiles, NULL until one is
+} GIFScratch;
 
 typedef struct _GIFOptStruct {
     uint16_t delay;
@@ -39,23 +67,71 @@ typedef struct _GIFOptStruct {
     int dither;
     int colortablebitsize;
     int forcebw;
+    int refine;  // Number of k-means iterations to refine adaptive palettes with, 0 to not refine
     SortedPixel* palette;  // This will eventually point to the palette
+    int8_t* detail;  // What each RGB value of a 16-bit source was rounded by, in 1/257 of a level, for dithering, NULL if nothing was
+    uint8_t* alpha;  // Alpha of each pixel of the frame, NULL if it has none
+    int alphathreshold;  // Pixels with less alpha than this are transparent, 0 to ignore alpha
+    int disposal;  // GIF disposal method of each image, 1 to leave it under the next one, 2 to clear it to the background first
+    uint32_t left;  // Position of the frame on the screen, for frames that cover only part of it
+    uint32_t top;
+    int palettesize;  // Number of colors in the palette for Pfile and Pindexed
+    char* paletteout;  // File to save the palette of the first frame to, NULL to not save it
+    struct _Octree* octree;  // Octree kept across frames for Poctree, NULL to build one per frame
+    int lossy;  // Largest RGB distance by which LZW may change a color to continue a string, 0 for lossless
+    enum _ClearPolicies clearpolicy;  // When LZW starts a new string table once it is full
+    int lzwbands;  // Number of bands of rows to LZW encode on separate threads, 1 for one stream, 0 for one per processor
+    GIFScratch* scratch;  // Buffers kept across frames, only one thread may use them at a time
 } GIFOptStruct;
 
+typedef struct _GIFTile {
+    // One horizontal band of a frame that is too large to be a single image
+    FILE* fid;  // Temporary file the tile is encoded to
+    uint8_t* frame;  // RGB of the tile within the frame, replaced by its indices
+    uint8_t* lastframe;  // Indices of the same tile of the previous frame
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+    GIFOptStruct gifopts;
+    int isFirstFrame;
+} GIFTile;
+
+typedef struct _GIFBand {
+    // Rows of an image that are LZW encoded on their own thread, starting from a new string table
+    LZWStream stream;
+    uint8_t* frame;  // Indices of the band
+    size_t length;
+    int islast;
+} GIFBand;
+
 GIFOptStruct newGIFOptStructInst();
+void freeGIFScratch(GIFScratch* scratch);
+int getPaletteBits(GIFOptStruct gifopts);
+int getPaletteSize(GIFOptStruct gifopts);
+int hasTransparentIndex(GIFOptStruct gifopts);
+int getTransparentIndex(GIFOptStruct gifopts, int tablebitsize);
+int getNumThreads();
 void writeGIFHeader(FILE* fid, uint32_t width, uint32_t height, GIFOptStruct gifopts);
 void writeGIFAppExtension(FILE* fid);
 void writeGIFFrame(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame);
-uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame);
-void writeGIFImageCompressed(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height, int tablebitsize);
+void writeGIFImage(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame);
+void* writeGIFTile(void* arg);
+void* writeGIFBand(void* arg);
+void writeGIFImageDescriptor(FILE* fid, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int transparent);
+void setTransparent(uint8_t* frame, uint8_t* lastframe, size_t npixel);
+void setAlphaTransparent(uint8_t* frame, const uint8_t* alpha, size_t npixel, int alphathreshold, uint8_t transparent);
+int comparefcn_sortind(const void* first, const void* second);
+void sortPixelsByColor(SortedPixel* pixels, SortedPixel* spare, size_t npixel);
+uint32_t getUniqueColors(uint8_t* frame, size_t npixel, SortedPixel* buffer, SortedPixel* unique, const uint8_t* alpha, int alphathreshold, size_t* nsorted);
+uint32_t writeGIFLCT(FILE* fid, uint8_t* frame, uint8_t* lastframe, uint32_t top, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame);
+void writeGIFImageCompressed(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height, int tablebitsize, GIFOptStruct gifopts);
 void writeGIFImageCompressed9bit(FILE* fid, uint8_t* frame, uint32_t width, uint32_t height);
-void writeGIFImageUncompressed256(FILE* fid, uint8_t* frame, uint32_t length);
-void writeGIFImageUncompressed128(FILE* fid, uint8_t* frame, uint32_t length);
+void writeGIFImageUncompressed256(FILE* fid, uint8_t* frame, size_t length);
+void writeGIFImageUncompressed128(FILE* fid, uint8_t* frame, size_t length);
 uint32_t convert9to8(uint16_t* input, uint8_t* output, uint32_t length);
-uint32_t packLSB(uint16_t* input, uint8_t* output, uint32_t length, uint8_t startnbits, uint64_t* remain, int* startshift, uint32_t* widthjumps, int islast);
 
 // From LZWlib.cpp
-int LZWcompress(uint8_t** input, uint32_t *inlen, uint16_t** output, uint32_t* widthjumps, uint8_t initialcodesize);
-int LZWcompress9bit(uint8_t* input, uint32_t inlen, uint16_t* output);
+int LZWcompress(uint8_t** input, size_t *inlen, uint16_t** output, uint32_t* widthjumps, uint8_t initialcodesize);
+int LZWcompress9bit(uint8_t* input, size_t inlen, uint16_t* output);
 
 #endif
@@ -0,0 +1,239 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "kmeans.h"
+#include "gifWriter.h"
+#include "allocate.h"
+
+#define DEBUG 0
+
+
+uint8_t findNearestKMeans(KMeansPalette* palette, float R, float G, float B){
+    // Returns the index of the palette color closest to R, G, B, the lowest index wins a tie
+#if defined(__SSE2__)
+    // Four palette colors at a time, each lane keeps its own closest color
+    __m128 r = _mm_set1_ps(R);
+    __m128 g = _mm_set1_ps(G);
+    __m128 b = _mm_set1_ps(B);
+    __m128 bestdist = _mm_set1_ps(FLT_MAX);
+    __m128i bestind = _mm_setzero_si128();
+    __m128i ind = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i four = _mm_set1_epi32(4);
+    
+    for(int i=0;i<palette->npadded;i+=4){
+        __m128 dr = _mm_sub_ps(_mm_loadu_ps(palette->R+i), r);
+        __m128 dg = _mm_sub_ps(_mm_loadu_ps(palette->G+i), g);
+        __m128 db = _mm_sub_ps(_mm_loadu_ps(palette->B+i), b);
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+        __m128 closer = _mm_cmplt_ps(dist, bestdist);
+        bestdist = _mm_or_ps(_mm_and_ps(closer, dist), _mm_andnot_ps(closer, bestdist));
+        bestind = _mm_or_si128(_mm_and_si128(_mm_castps_si128(closer), ind), _mm_andnot_si128(_mm_castps_si128(closer), bestind));
+        ind = _mm_add_epi32(ind, four);
+    }
+    
+    // Pick the closest of the four lanes
+    float dists[4];
+    int32_t inds[4];
+    _mm_storeu_ps(dists, bestdist);
+    _mm_storeu_si128((__m128i*) inds, bestind);
+    int best = 0;
+    for(int i=1;i<4;i++){
+        if(dists[i] < dists[best] || (dists[i] == dists[best] && inds[i] < inds[best])){
+            best = i;
+        }
+    }
+    return (uint8_t) inds[best];
+#else
+    float bestdist = FLT_MAX;
+    int bestind = 0;
+    for(int i=0;i<palette->npalette;i++){
+        float dr = palette->R[i]-R;
+        float dg = palette->G[i]-G;
+        float db = palette->B[i]-B;
+        float dist = dr*dr + dg*dg + db*db;
+        if(dist < bestdist){
+            bestdist = dist;
+            bestind = i;
+        }
+    }
+    return (uint8_t) bestind;
+#endif
+}
+
+void* assignKMeans(void* arg){
+    // Assignment step for one range of unique colors: move each color to its closest palette color and sum up the colors of each palette color
+    KMeansJob* job = (KMeansJob*) arg;
+    
+    job->nchanged = 0;
+    memset(job->sumR, 0, sizeof(job->sumR));
+    memset(job->sumG, 0, sizeof(job->sumG));
+    memset(job->sumB, 0, sizeof(job->sumB));
+    memset(job->weight, 0, sizeof(job->weight));
+    
+    for(uint32_t i=job->start;i<job->end;i++){
+        uint8_t* color = job->original + 3*i;
+        uint8_t ind = findNearestKMeans(job->palette, color[0], color[1], color[2]);
+        if(ind != job->unique[i].colorindex){
+            job->unique[i].colorindex = ind;
+            job->nchanged++;
+        }
+        uint64_t w = job->unique[i].npixel;
+        job->sumR[ind] += w*color[0];
+        job->sumG[ind] += w*color[1];
+        job->sumB[ind] += w*color[2];
+        job->weight[ind] += w;
+    }
+    
+    return NULL;
+}
+
+int refinePalette(SortedPixel* palette, SortedPixel* unique, uint8_t* original, uint32_t nunique, int niter, int keepbw){
+    // Refine an adaptive palette with Lloyd (k-means) iterations over the unique colors, weighted by their number of pixels
+    // Starts from the palette and colorindex set by the quantizer, original holds the RGB of the unique colors before they were quantized
+    // Each iteration assigns every unique color to its closest palette color and then moves each palette color to the mean of its colors
+    // Stops early once no unique color changes palette color
+    // If keepbw is set then black and white palette colors (from forcebw) stay where they are
+    // On return the unique colors are set to their palette color, same as after medianCut
+    // Returns the number of iterations done
+    
+    KMeansPalette kpalette;
+    KMeansJob* jobs;
+    pthread_t threads[MAXTHREADS];
+    int started[MAXTHREADS];
+    
+    // Only the palette colors that the quantizer used take part
+    int npalette = 0;
+    for(uint32_t i=0;i<nunique;i++){
+        if(unique[i].colorindex >= npalette){
+            npalette = unique[i].colorindex+1;
+        }
+    }
+    kpalette.npalette = npalette;
+    kpalette.npadded = (npalette+3) & ~3;
+    for(int i=0;i<kpalette.npadded;i++){
+        if(i < npalette){
+            // Adaptive palettes are only guaranteed to have the pixel field set
+            kpalette.R[i] = (float) ((palette[i].pixel >> 0) & 0xff);
+            kpalette.G[i] = (float) ((palette[i].pixel >> 8) & 0xff);
+            kpalette.B[i] = (float) ((palette[i].pixel >> 16) & 0xff);
+        }else{
+            kpalette.R[i] = kpalette.G[i] = kpalette.B[i] = 1.0e4f;
+        }
+    }
+    
+    // Split the unique colors over threads if there are enough of them
+    int nthread = getNumThreads();
+    if(nunique/KMEANS_MINCOLORS_PER_THREAD < nthread){
+        nthread = nunique/KMEANS_MINCOLORS_PER_THREAD;
+    }
+    if(nthread < 1){
+        nthread = 1;
+    }
+    jobs = checkedMalloc(sizeof(KMeansJob)*nthread);
+    for(int t=0;t<nthread;t++){
+        jobs[t].palette = &kpalette;
+        jobs[t].original = original;
+        jobs[t].unique = unique;
+        jobs[t].start = (uint32_t) (((uint64_t) nunique*t)/nthread);
+        jobs[t].end = (uint32_t) (((uint64_t) nunique*(t+1))/nthread);
+    }
+    
+    int iter;
+    for(iter=0;iter<niter;iter++){
+        // Assignment step
+        for(int t=1;t<nthread;t++){
+            started[t] = pthread_create(&threads[t], NULL, assignKMeans, &jobs[t]) == 0;
+            if(!started[t]){
+                // Do it on this thread instead
+                assignKMeans(&jobs[t]);
+            }
+        }
+        assignKMeans(&jobs[0]);
+        uint32_t nchanged = jobs[0].nchanged;
+        for(int t=1;t<nthread;t++){
+            if(started[t]){
+                pthread_join(threads[t], NULL);
+            }
+            nchanged += jobs[t].nchanged;
+        }
+#if DEBUG
+        printf("k-means iteration %i: %i unique colors changed palette color\n", iter, nchanged);
+#endif
+        // The first assignment can only move colors away from their quantizer box, so only later ones can converge
+        if(nchanged == 0 && iter > 0){
+            break;
+        }
+        
+        // Update step, palette colors without any unique colors stay where they are
+        for(int i=0;i<npalette;i++){
+            uint64_t sumR = 0, sumG = 0, sumB = 0, weight = 0;
+            for(int t=0;t<nthread;t++){
+                sumR += jobs[t].sumR[i];
+                sumG += jobs[t].sumG[i];
+                sumB += jobs[t].sumB[i];
+                weight += jobs[t].weight[i];
+            }
+            if(weight == 0){
+                continue;
+            }
+            if(keepbw && kpalette.R[i] == kpalette.G[i] && kpalette.G[i] == kpalette.B[i] && (kpalette.R[i] == 0.0f || kpalette.R[i] == 255.0f)){
+                continue;
+            }
+            kpalette.R[i] = (float) ((sumR + weight/2)/weight);
+            kpalette.G[i] = (float) ((sumG + weight/2)/weight);
+            kpalette.B[i] = (float) ((sumB + weight/2)/weight);
+        }
+    }
+    
+    // Make the assignment match the final palette
+    if(iter == niter){
+        for(int t=0;t<nthread;t++){
+            assignKMeans(&jobs[t]);
+        }
+    }
+    free(jobs);
+    
+    // Write back the palette and set each unique color to its palette color
+    for(int i=0;i<npalette;i++){
+        palette[i].R = (uint8_t) kpalette.R[i];
+        palette[i].G = (uint8_t) kpalette.G[i];
+        palette[i].B = (uint8_t) kpalette.B[i];
+        palette[i].pixel = (palette[i].B << 16) + (palette[i].G << 8) + (palette[i].R << 0);
+    }
+    for(uint32_t i=0;i<nunique;i++){
+        SortedPixel* color = &palette[unique[i].colorindex];
+        unique[i].pixel = color->pixel;
+        unique[i].R = color->R;
+        unique[i].G = color->G;
+        unique[i].B = color->B;
+    }
+    
+    return iter;
+}
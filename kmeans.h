@@ -0,0 +1,64 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _KMEANS_H_
+#define _KMEANS_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pixel.h"
+
+// Unique colors per thread below which the assignment step is not split over threads
+#define KMEANS_MINCOLORS_PER_THREAD 4096
+
+typedef struct _KMeansPalette {
+    // Palette colors laid out for the SIMD distance computation, padded to a multiple of 4 with colors that are never closest
+    float R[256];
+    float G[256];
+    float B[256];
+    int npalette;
+    int npadded;
+} KMeansPalette;
+
+typedef struct _KMeansJob {
+    // One thread's share of the assignment step
+    KMeansPalette* palette;
+    uint8_t* original;    // RGB of the unique colors before quantizing
+    SortedPixel* unique;  // Weights and assigned colorindex of the unique colors
+    uint32_t start;
+    uint32_t end;
+    uint32_t nchanged;    // Number of unique colors that moved to another palette color
+    // Weighted color sums of each palette color over this thread's unique colors
+    uint64_t sumR[256];
+    uint64_t sumG[256];
+    uint64_t sumB[256];
+    uint64_t weight[256];
+} KMeansJob;
+
+int refinePalette(SortedPixel* palette, SortedPixel* unique, uint8_t* original, uint32_t nunique, int niter, int keepbw);
+uint8_t findNearestKMeans(KMeansPalette* palette, float R, float G, float B);
+void* assignKMeans(void* arg);
+
+#endif
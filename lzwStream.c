@@ -0,0 +1,566 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "lzwStream.h"
+#include "allocate.h"
+
+#define MAXCODESIZE 12  // In bits
+#define DEBUG 0
+
+static inline void storeLZW64(uint8_t* out, uint64_t bits){
+    // Unaligned little endian 8-byte store
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+    memcpy(out, &bits, 8);
+}
+
+static inline size_t countLZWRun(const uint8_t* indices, size_t length, uint8_t c){
+    // Number of indices equal to c at the start of indices, compared 16 at a time with SSE2 (or 8 at a time without)
+    size_t n = 0;
+#if defined(__SSE2__)
+    __m128i pattern16 = _mm_set1_epi8((char) c);
+    while(n+16 <= length){
+        __m128i block = _mm_loadu_si128((const __m128i*)(indices+n));
+        int differ = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern16)) ^ 0xffff;
+        if(differ != 0){
+            return n + __builtin_ctz(differ);
+        }
+        n += 16;
+    }
+#endif
+    uint64_t pattern = 0x0101010101010101ull*c;
+    while(n+8 <= length){
+        uint64_t word;
+        memcpy(&word, indices+n, 8);
+        uint64_t diff = word ^ pattern;
+        if(diff != 0){
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return n + (__builtin_clzll(diff) >> 3);
+#else
+            return n + (__builtin_ctzll(diff) >> 3);
+#endif
+        }
+        n += 8;
+    }
+    while(n < length && indices[n] == c){
+        n++;
+    }
+    return n;
+}
+
+static inline void putLZWBits(LZWStream* stream, uint64_t bits, int nbits){
+    // Append the nbits (at most 12) low bits of bits
+    // Once the buffer holds 48 bits or more, all 8 bytes are stored and out moves on by 6 bytes
+    stream->bitbuffer |= bits << stream->shift;
+    stream->shift += nbits;
+    if(stream->shift >= 48){
+        storeLZW64(stream->out + stream->nout, stream->bitbuffer);
+        stream->nout += 6;
+        stream->bitbuffer >>= 48;
+        stream->shift -= 48;
+        if(stream->nout >= stream->flushat){
+            writeLZWBlocks(stream);
+        }
+    }
+}
+
+void startLZWStream(LZWStream* stream, FILE* fid, int tablebitsize, LZWScratch* scratch){
+    // Write the LZW minimum code size byte and the clear code that starts the image data
+    // The tables and output buffer are taken from scratch and left there for the next image, or allocated for
+    // this image only if scratch is NULL
+    
+    initLZWStream(stream, fid, tablebitsize, scratch);
+    putc(stream->startnbits-1, fid);
+    writeLZWCode(stream, stream->clearcode);
+}
+
+void initLZWStream(LZWStream* stream, FILE* fid, int tablebitsize, LZWScratch* scratch){
+    // Set up the encoder with an empty string table, without writing anything
+    
+    if(scratch == NULL){
+        memset(&stream->own, 0, sizeof(LZWScratch));
+        scratch = &stream->own;
+    }
+    stream->scratch = scratch;
+    stream->fid = fid;
+    stream->startnbits = tablebitsize+1;
+    if(stream->startnbits < 3){
+        stream->startnbits = 3;
+    }
+    stream->clearcode = 1 << (stream->startnbits-1);
+    stream->stopcode = stream->clearcode + 1;
+    stream->keys = reserveScratch(&scratch->keys, sizeof(uint32_t)*(1 << LZWHASH_BITS));
+    stream->codes = reserveScratch(&scratch->codes, sizeof(uint16_t)*(1 << LZWHASH_BITS));
+    stream->bitbuffer = 0;
+    stream->shift = 0;
+    stream->neighbors = NULL;
+    // Only the parts for the indices that have runs are ever touched, so this costs little memory for flat images
+    stream->runcodes = reserveScratch(&scratch->runcodes, sizeof(uint16_t)*stream->clearcode*LZWRUN_MAXLENGTH);
+    stream->clearpolicy = ClearFull;
+    stream->nin = 0;
+    stream->clearin = 0;
+    stream->out = reserveScratch(&scratch->out, 255*LZWOUT_BLOCKS + 16);  // Room for the last 8-byte store past flushat
+    stream->nout = 0;
+    stream->flushat = 255*LZWOUT_BLOCKS;
+    
+    clearLZWTable(stream);
+}
+
+void startLZWBand(LZWStream* stream, int tablebitsize, size_t length, LZWScratch* scratch){
+    // Start one band of an image whose indices are split over several encoders, e.g. to run them on separate threads
+    // The band starts with a new string table, just after the clear code that ends the band before it (or starts the image),
+    // and its bits are kept in memory until they are added to the stream of the image with addLZWBand
+    // Each index gives at most one code, so 2 bytes per index are always enough
+    
+    initLZWStream(stream, NULL, tablebitsize, scratch);
+    stream->out = reserveScratch(&stream->scratch->out, checkedSize(length+16, 2));
+    stream->flushat = SIZE_MAX;
+}
+
+void finishLZWBand(LZWStream* stream, int islast){
+    // Write the code of the last string and the clear code that starts the next band, or the stop code after the last band
+    // The bits that do not fill a byte are left in the bit buffer
+    
+    if(stream->prefix >= 0){
+        writeLZWCode(stream, (uint16_t) stream->prefix);
+    }
+    writeLZWCode(stream, islast ? stream->stopcode : stream->clearcode);
+    storeLZWBits(stream);
+    
+    freeLZWTables(stream);
+}
+
+void freeLZWTables(LZWStream* stream){
+    // Free the string table and the lookups made from it, but not out
+    // A scratch given to startLZWStream keeps them for the next image instead
+    
+    if(stream->scratch != &stream->own){
+        return;
+    }
+    freeScratch(&stream->own.keys);
+    freeScratch(&stream->own.codes);
+    freeScratch(&stream->own.runcodes);
+    freeScratch(&stream->own.neighbors);
+}
+
+void freeLZWStream(LZWStream* stream){
+    // Free the tables and out, unless they are kept in a scratch
+    
+    if(stream->scratch == &stream->own){
+        freeLZWScratch(&stream->own);
+    }
+}
+
+void freeLZWScratch(LZWScratch* scratch){
+    freeScratch(&scratch->keys);
+    freeScratch(&scratch->codes);
+    freeScratch(&scratch->runcodes);
+    freeScratch(&scratch->neighbors);
+    freeScratch(&scratch->out);
+}
+
+void addLZWBand(LZWStream* stream, LZWStream* band){
+    // Append the bits of a finished band to the stream, right after the bits already written, and free the band
+    
+    for(size_t i=0;i<band->nout;i++){
+        putLZWBits(stream, band->out[i], 8);
+    }
+    putLZWBits(stream, band->bitbuffer, band->shift);
+    
+    freeLZWStream(band);
+}
+
+void clearLZWTable(LZWStream* stream){
+    // Start a new string table, which also starts the code widths over
+    
+    memset(stream->keys, 0, sizeof(uint32_t)*(1 << LZWHASH_BITS));
+    stream->prefix = -1;
+    stream->nbits = stream->startnbits;
+    stream->maxdictsize = 1 << stream->nbits;
+    stream->dictsize = (1 << (stream->nbits-1)) + 2;  // Clear and stop codes follow the single indices
+    stream->tablemaxed = 0;
+    stream->last = 0;
+    stream->codenbits = stream->startnbits;
+    stream->widen = 0;
+    stream->nbitsout = 0;
+    
+    // The only runs in a new table are the single indices
+    stream->prefixrun = 0;
+    for(int c=0;c<stream->clearcode;c++){
+        stream->nrun[c] = 1;
+    }
+}
+
+void setLZWLossy(LZWStream* stream, SortedPixel* palette, int npalette, int lossy){
+    // Allow an index to be encoded as another palette index whose color is no more than lossy away (RGB distance)
+    // when that continues the current string, which gives longer strings and so fewer codes
+    // The palette distances are worked out once here, as a list of the indices within the tolerance of each index
+    // Indices past npalette (e.g. the transparent index) are never swapped
+    // The indices themselves are left as they are, so the next frame is made transparent where it matches this frame
+    // before the swaps, and the color shown there is still within the tolerance
+    
+    if(lossy <= 0){
+        return;
+    }
+    // A swapped index breaks up runs, so they are found through the hash table like other strings
+    stream->runcodes = NULL;
+    stream->neighbors = reserveScratch(&stream->scratch->neighbors, 256*256);
+    memset(stream->nneighbors, 0, sizeof(stream->nneighbors));
+    int maxdist = lossy*lossy;
+    int dist[256];
+    
+    // The color table is written from the pixel field, which adaptive palettes do not copy to R, G and B
+    for(int c=0;c<npalette && c<256;c++){
+        uint8_t* near = &stream->neighbors[256*c];
+        int n = 0;
+        for(int d=0;d<npalette && d<256;d++){
+            int dR = (int)(palette[c].pixel & 0xff) - (int)(palette[d].pixel & 0xff);
+            int dG = (int)((palette[c].pixel >> 8) & 0xff) - (int)((palette[d].pixel >> 8) & 0xff);
+            int dB = (int)((palette[c].pixel >> 16) & 0xff) - (int)((palette[d].pixel >> 16) & 0xff);
+            int dd = dR*dR + dG*dG + dB*dB;
+            if(d == c || dd > maxdist){
+                continue;
+            }
+            // Insert in order of distance
+            int k = n++;
+            while(k > 0 && dist[k-1] > dd){
+                near[k] = near[k-1];
+                dist[k] = dist[k-1];
+                k--;
+            }
+            near[k] = (uint8_t) d;
+            dist[k] = dd;
+        }
+        stream->nneighbors[c] = n;
+    }
+}
+
+uint32_t findLZWSlot(LZWStream* stream, uint32_t key){
+    // Slot of the string table that holds key, or the empty slot where it would go
+    uint32_t mask = (1 << LZWHASH_BITS) - 1;
+    uint32_t slot = (key*2654435761u) >> (32-LZWHASH_BITS);
+    while(stream->keys[slot] != 0 && stream->keys[slot] != key){
+        slot = (slot+1) & mask;
+    }
+    return slot;
+}
+
+void writeLZWStream(LZWStream* stream, const uint8_t* indices, size_t length){
+    // Encode the next length indices of the image
+    // Follows LZWcompress step by step, including when the code width goes up and when the table is cleared
+    
+    int runs = (stream->runcodes != NULL);
+    for(size_t i=0;i<length;i++){
+        uint8_t c = indices[i];
+        
+        // Single indices are always in the table
+        if(stream->prefix < 0){
+            stream->prefix = c;
+            stream->prefixrun = runs;
+            stream->runindex = c;
+            continue;
+        }
+        
+        // Runs of one index go through the run strings of the table instead
+        // A single index is stepped here, as most runs in photos are that short, and the scan only pays off for longer ones
+        if(runs){
+            if(stream->prefixrun > 0 && c == stream->runindex){
+                if(i+1 < length && indices[i+1] == c){
+                    i += writeLZWRun(stream, indices+i, length-i, stream->nin + i) - 1;
+                    continue;
+                }
+                if(stream->prefixrun < stream->nrun[c]){
+                    stream->prefixrun++;
+                    stream->prefix = stream->runcodes[c*LZWRUN_MAXLENGTH + stream->prefixrun];
+                    continue;
+                }
+                // One too long for the table, so it is added below with prefixrun still set
+            }else{
+                stream->prefixrun = 0;
+            }
+        }
+        
+        // Look for the current string plus c
+        uint32_t key = (((uint32_t) stream->prefix << 8) | c) + 1;
+        uint32_t slot = findLZWSlot(stream, key);
+        if(stream->keys[slot] == key){
+            stream->prefix = stream->codes[slot];
+            continue;
+        }
+        
+        // Otherwise look for the current string plus a close enough color, closest first
+        if(stream->neighbors != NULL && stream->nneighbors[c] > 0){
+            uint8_t* near = &stream->neighbors[256*c];
+            int found = 0;
+            for(int k=0;k<stream->nneighbors[c];k++){
+                uint32_t altkey = (((uint32_t) stream->prefix << 8) | near[k]) + 1;
+                uint32_t altslot = findLZWSlot(stream, altkey);
+                if(stream->keys[altslot] == altkey){
+                    stream->prefix = stream->codes[altslot];
+                    found = 1;
+                    break;
+                }
+            }
+            if(found){
+                continue;
+            }
+        }
+        
+        addLZWString(stream, slot, key, c, stream->nin + i);
+    }
+    stream->nin += length;
+}
+
+size_t writeLZWRun(LZWStream* stream, const uint8_t* indices, size_t length, uint64_t pos){
+    // Encode the run of the index at the start of indices, when the current string is a run of the same index
+    // The run strings of the table are c, cc, ccc, ... up to nrun[c] long, so the run can be followed without hashing,
+    // and only the string that is one longer than the longest one in the table has to be added
+    // pos is the number of indices before the run, returns the length of the run
+    
+    uint8_t c = stream->runindex;
+    uint16_t* runcodes = &stream->runcodes[c*LZWRUN_MAXLENGTH];
+    size_t nrun = countLZWRun(indices, length, c);
+    size_t done = 0;
+    while(done < nrun){
+        size_t k = (size_t) stream->prefixrun;
+        size_t longest = (size_t) stream->nrun[c];
+        
+        // The rest of the run is in the table
+        if(k + (nrun-done) <= longest){
+            stream->prefixrun = (int)(k + nrun - done);
+            stream->prefix = runcodes[stream->prefixrun];
+            break;
+        }
+        
+        // Go to the longest run string, which the next index makes one too long
+        done += longest - k;
+        stream->prefixrun = (int) longest;
+        stream->prefix = (longest > 1) ? runcodes[longest] : c;
+        uint32_t key = (((uint32_t) stream->prefix << 8) | c) + 1;
+        uint32_t slot = findLZWSlot(stream, key);
+        addLZWString(stream, slot, key, c, pos + done);
+        done++;
+    }
+    return nrun;
+}
+
+void addLZWString(LZWStream* stream, uint32_t slot, uint32_t key, uint8_t c, uint64_t pos){
+    // The current string plus c is not in the table, so write the code of the current string and add the string
+    // plus c to the table at slot, then start the next string with c
+    // pos is the number of indices before c, for the adaptive clear policy
+    
+    writeLZWCode(stream, (uint16_t) stream->prefix);
+    if(stream->tablemaxed < 2){
+        stream->keys[slot] = key;
+        stream->codes[slot] = (uint16_t) stream->dictsize;
+        // A run one longer than the longest one so far
+        if(stream->prefixrun > 0 && c == stream->runindex){
+            stream->nrun[c] = (uint16_t)(stream->prefixrun + 1);
+            stream->runcodes[c*LZWRUN_MAXLENGTH + stream->nrun[c]] = (uint16_t) stream->dictsize;
+        }
+        stream->dictsize++;
+    }
+    stream->prefix = c;
+    stream->prefixrun = (stream->runcodes != NULL);
+    stream->runindex = c;
+    
+    // If the table is full, then increase its size
+    if(stream->tablemaxed < 1 && stream->dictsize >= stream->maxdictsize){
+        stream->widen = 1;
+        stream->nbits++;
+        stream->maxdictsize = 1 << stream->nbits;
+        if(stream->nbits >= MAXCODESIZE){
+            stream->tablemaxed++;
+        }
+    }
+    
+    // One more code once the largest table is full, then start over with a clear code
+    if(stream->tablemaxed >= 1 && stream->dictsize >= stream->maxdictsize && stream->clearpolicy == ClearFull){
+        if(stream->last > 0){
+#if DEBUG
+            printf("Table cleared after %llu indices\n", (unsigned long long)(pos - stream->clearin));
+#endif
+            writeLZWCode(stream, stream->clearcode);
+            clearLZWTable(stream);
+            stream->clearin = pos;
+            stream->prefix = c;
+            stream->prefixrun = (stream->runcodes != NULL);
+            return;
+        }
+        stream->last++;
+    }
+    
+    // Or keep the full table without adding strings, and for the adaptive policy clear it once it compresses worse
+    if(stream->tablemaxed >= 1 && stream->dictsize >= stream->maxdictsize && stream->clearpolicy != ClearFull){
+        if(stream->tablemaxed == 1){
+            stream->tablemaxed = 2;
+            stream->checkpoint = pos;
+            stream->ratio = 0;
+        }
+        if(stream->clearpolicy == ClearAdaptive && checkLZWRatio(stream, pos)){
+#if DEBUG
+            printf("Table cleared after %llu indices, %.3f indices per bit\n", (unsigned long long)(pos - stream->clearin), stream->ratio);
+#endif
+            writeLZWCode(stream, stream->clearcode);
+            clearLZWTable(stream);
+            stream->clearin = pos;
+            stream->prefix = c;
+            stream->prefixrun = (stream->runcodes != NULL);
+        }
+    }
+}
+
+int checkLZWRatio(LZWStream* stream, uint64_t nin){
+    // Every LZWCHECK_GAP indices once the table is full, compare the indices per bit since the last clear code
+    // with the best seen so far, starting from the ratio when the table filled
+    // Returns 1 if it has dropped, meaning that the table no longer suits the image and should be cleared
+    
+    if(nin < stream->checkpoint){
+        return 0;
+    }
+    stream->checkpoint = nin + LZWCHECK_GAP;
+    double ratio = (double)(nin - stream->clearin)/(double)stream->nbitsout;
+    if(ratio > stream->ratio){
+        stream->ratio = ratio;
+        return 0;
+    }
+    return 1;
+}
+
+void finishLZWStream(LZWStream* stream){
+    // Write the code of the last string, the stop code and the last sub-blocks
+    
+    if(stream->prefix >= 0){
+        writeLZWCode(stream, (uint16_t) stream->prefix);
+    }
+    writeLZWCode(stream, stream->stopcode);
+    
+    closeLZWStream(stream);
+}
+
+void closeLZWStream(LZWStream* stream){
+    // Write the last sub-blocks of a stream whose stop code has been written, and free it
+    
+    // Round the last bits up to a whole byte
+    storeLZWBits(stream);
+    if(stream->shift > 0){
+        stream->out[stream->nout++] = (uint8_t) stream->bitbuffer;
+        stream->bitbuffer = 0;
+        stream->shift = 0;
+    }
+    
+    // Write the full sub-blocks, then the remainder and the signal for the last data chunk
+    writeLZWBlocks(stream);
+    if(stream->nout > 0){
+        putc((int) stream->nout, stream->fid);
+        fwrite(stream->out, 1, stream->nout, stream->fid);
+    }
+    putc('\x00', stream->fid);
+    
+    freeLZWStream(stream);
+}
+
+void writeLZWCode(LZWStream* stream, uint16_t code){
+    // Append one code at the current code width
+    
+    putLZWBits(stream, code, stream->codenbits);
+    stream->nbitsout += stream->codenbits;
+    
+    // The decoder adds the string for a code when it reads the code after it, so its table grows one code after
+    // the encoder's and the width goes up for the code after the next one
+    if(stream->widen){
+        stream->widen = 0;
+        stream->codenbits++;
+    }
+}
+
+void writeLZWCodes(LZWStream* stream, const uint16_t* codes, const uint8_t* widths, size_t n){
+    // Append n codes with the given widths, e.g. codes from another encoder
+    // Same as putLZWBits, but with the bit buffer in local variables, which the stores to out cannot change
+    
+    uint64_t bitbuffer = stream->bitbuffer;
+    int shift = stream->shift;
+    uint8_t* out = stream->out;
+    size_t nout = stream->nout;
+    uint64_t nbitsout = 0;
+    for(size_t i=0;i<n;i++){
+        bitbuffer |= (uint64_t) codes[i] << shift;
+        shift += widths[i];
+        nbitsout += widths[i];
+        if(shift >= 48){
+            storeLZW64(out + nout, bitbuffer);
+            nout += 6;
+            bitbuffer >>= 48;
+            shift -= 48;
+            if(nout >= stream->flushat){
+                stream->nout = nout;
+                writeLZWBlocks(stream);
+                nout = stream->nout;
+            }
+        }
+    }
+    stream->bitbuffer = bitbuffer;
+    stream->shift = shift;
+    stream->nout = nout;
+    stream->nbitsout += nbitsout;
+}
+
+void storeLZWBits(LZWStream* stream){
+    // Move the whole bytes of the bit buffer to out, as one unaligned 8-byte little endian store
+    
+    storeLZW64(stream->out + stream->nout, stream->bitbuffer);
+    int nbytes = stream->shift >> 3;
+    stream->nout += nbytes;
+    stream->bitbuffer = (nbytes < 8) ? (stream->bitbuffer >> (8*nbytes)) : 0;
+    stream->shift &= 7;
+    
+    if(stream->nout >= stream->flushat){
+        writeLZWBlocks(stream);
+    }
+}
+
+void writeLZWBlocks(LZWStream* stream){
+    // Write the bytes in out as data sub-blocks of 255 bytes, each after its length byte, and keep the rest in out
+    
+    uint8_t blocks[256*LZWOUT_BLOCKS];
+    size_t done = 0;
+    while(stream->nout-done >= 255){
+        int nblock = 0;
+        while(nblock < LZWOUT_BLOCKS && stream->nout-done >= 255){
+            blocks[256*nblock] = 255;
+            memcpy(&blocks[256*nblock+1], stream->out+done, 255);
+            done += 255;
+            nblock++;
+        }
+        fwrite(blocks, 1, 256*nblock, stream->fid);
+    }
+    memmove(stream->out, stream->out+done, stream->nout-done);
+    stream->nout -= done;
+}
@@ -0,0 +1,125 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _LZWSTREAM_H_
+#define _LZWSTREAM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "pixel.h"
+#include "allocate.h"
+
+// Number of slots in the string table hash, must be a power of 2 and well above the 4097 codes the table can hold
+#define LZWHASH_BITS 13
+// Number of full 255-byte sub-blocks to collect before writing them out
+#define LZWOUT_BLOCKS 64
+// Longest run of one index the string table can hold, one index plus one per code (see writeLZWRun)
+#define LZWRUN_MAXLENGTH 4098
+// Number of indices between compression ratio checks of the adaptive clear code policy
+// compress(1) checks every 10000 bytes, but GIF frames are often small and a stale table costs more with 12-bit codes
+#define LZWCHECK_GAP 1024
+
+// When to start a new string table once it holds 4096 codes
+// ClearFull: right away, one code after it fills (as LZWcompress does)
+// ClearAdaptive: keep using the full table and clear it once the compression ratio drops
+// ClearNever: keep using the full table until the end of the image
+enum _ClearPolicies {ClearFull, ClearAdaptive, ClearNever};
+
+typedef struct _LZWScratch {
+    // Tables and output buffer of an encoder, kept from one image to the next so that they are only allocated once
+    ScratchBuffer keys;
+    ScratchBuffer codes;
+    ScratchBuffer runcodes;
+    ScratchBuffer neighbors;
+    ScratchBuffer out;
+} LZWScratch;
+
+typedef struct _LZWStream {
+    // LZW encoder that takes the indices of an image a piece at a time and writes its data sub-blocks as it goes
+    // Gives exactly the same codes as LZWcompress on the whole image, unless lossy matching or another clear policy is turned on
+    FILE* fid;
+    uint16_t clearcode;
+    uint16_t stopcode;
+    int startnbits;
+    // String table, each string is the code of its prefix plus one more index
+    uint32_t* keys;  // (prefix << 8 | index) + 1 of each slot, 0 if empty
+    uint16_t* codes;
+    int prefix;  // Code of the string matched so far, -1 if none
+    // Strings that are a run of one index (NULL with lossy matching)
+    uint16_t* runcodes;  // Code of the run of k>1 times index c at [c*LZWRUN_MAXLENGTH + k], for k up to nrun[c]
+    uint16_t nrun[256];  // Longest run of each index in the table
+    int prefixrun;  // Length of the string matched so far if it is a run of one index, 0 if not
+    uint8_t runindex;  // Index of that run
+    // Lossy matching, see setLZWLossy
+    uint8_t* neighbors;  // For each index, the other palette indices within the tolerance, closest first (NULL if lossless)
+    int nneighbors[256];
+    // Clear code policy, ClearFull unless set after startLZWStream
+    enum _ClearPolicies clearpolicy;
+    uint64_t nin;  // Indices encoded so far
+    uint64_t clearin;  // Indices encoded at the last clear code
+    uint64_t nbitsout;  // Bits written since the last clear code
+    uint64_t checkpoint;  // Indices encoded at the next ratio check
+    double ratio;  // Best indices per bit since the last clear code
+    int nbits;
+    int dictsize;
+    int maxdictsize;
+    int tablemaxed;
+    int last;
+    // Bit writer
+    int codenbits;  // Width of the next code written
+    int widen;  // 1 if the width goes up after the next code
+    uint64_t bitbuffer;  // Bits not stored yet, the first in the least significant bit
+    int shift;  // Number of bits in bitbuffer
+    uint8_t* out;  // Bytes not written as sub-blocks yet, or all the bytes of a band (see startLZWBand)
+    size_t nout;
+    size_t flushat;  // Sub-blocks are written once nout reaches this
+    // Memory
+    LZWScratch* scratch;  // Where the tables and out are kept, own if no scratch was given
+    LZWScratch own;  // Freed along with the stream
+} LZWStream;
+
+void startLZWStream(LZWStream* stream, FILE* fid, int tablebitsize, LZWScratch* scratch);
+void initLZWStream(LZWStream* stream, FILE* fid, int tablebitsize, LZWScratch* scratch);
+void setLZWLossy(LZWStream* stream, SortedPixel* palette, int npalette, int lossy);
+void writeLZWStream(LZWStream* stream, const uint8_t* indices, size_t length);
+size_t writeLZWRun(LZWStream* stream, const uint8_t* indices, size_t length, uint64_t pos);
+void addLZWString(LZWStream* stream, uint32_t slot, uint32_t key, uint8_t c, uint64_t pos);
+void freeLZWTables(LZWStream* stream);
+void freeLZWStream(LZWStream* stream);
+void freeLZWScratch(LZWScratch* scratch);
+uint32_t findLZWSlot(LZWStream* stream, uint32_t key);
+int checkLZWRatio(LZWStream* stream, uint64_t nin);
+void finishLZWStream(LZWStream* stream);
+void closeLZWStream(LZWStream* stream);
+void startLZWBand(LZWStream* stream, int tablebitsize, size_t length, LZWScratch* scratch);
+void finishLZWBand(LZWStream* stream, int islast);
+void addLZWBand(LZWStream* stream, LZWStream* band);
+void clearLZWTable(LZWStream* stream);
+void writeLZWCode(LZWStream* stream, uint16_t code);
+void writeLZWCodes(LZWStream* stream, const uint16_t* codes, const uint8_t* widths, size_t n);
+void storeLZWBits(LZWStream* stream);
+void writeLZWBlocks(LZWStream* stream);
+
+#endif
@@ -148,15 +148,31 @@ CutBin splitBin(CutBin* bin){
 }
 
 int comparefcnR(const void* first, const void* second){
-    return (int)((SortedPixel*)first)->R - (int)((SortedPixel*)second)->R;
+    // Colors with the same value are ordered by the whole color, so that the order does not depend on the qsort of the C library
+    const SortedPixel* a = (const SortedPixel*) first;
+    const SortedPixel* b = (const SortedPixel*) second;
+    if(a->R != b->R){
+        return (int) a->R - (int) b->R;
+    }
+    return (a->pixel > b->pixel) - (a->pixel < b->pixel);
 }
 
 int comparefcnG(const void* first, const void* second){
-    return ((SortedPixel*)first)->G - ((SortedPixel*)second)->G;
+    const SortedPixel* a = (const SortedPixel*) first;
+    const SortedPixel* b = (const SortedPixel*) second;
+    if(a->G != b->G){
+        return (int) a->G - (int) b->G;
+    }
+    return (a->pixel > b->pixel) - (a->pixel < b->pixel);
 }
 
 int comparefcnB(const void* first, const void* second){
-    return ((SortedPixel*)first)->B - ((SortedPixel*)second)->B;
+    const SortedPixel* a = (const SortedPixel*) first;
+    const SortedPixel* b = (const SortedPixel*) second;
+    if(a->B != b->B){
+        return (int) a->B - (int) b->B;
+    }
+    return (a->pixel > b->pixel) - (a->pixel < b->pixel);
 }
 
 void getRange(CutBin* bin){
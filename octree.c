@@ -0,0 +1,247 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "octree.h"
+#include "allocate.h"
+
+#define DEBUG 0
+
+
+Octree* newOctree(uint32_t budget){
+    // Create an empty octree that keeps at most budget leaves
+    // Every leaf has at most OCTREE_DEPTH ancestors and one leaf can be added before the tree is reduced, which bounds the pool
+    Octree* tree = checkedMalloc(sizeof(Octree));
+    tree->poolsize = OCTREE_DEPTH*(budget+1)+1;
+    tree->pool = checkedMalloc(sizeof(OctreeNode)*tree->poolsize);
+    
+    // Chain all nodes into the free list
+    for(int i=0;i<tree->poolsize;i++){
+        tree->pool[i].next = i+1;
+    }
+    tree->pool[tree->poolsize-1].next = -1;
+    tree->freelist = 0;
+    for(int i=0;i<OCTREE_DEPTH;i++){
+        tree->reducible[i] = -1;
+    }
+    tree->nleaf = 0;
+    tree->budget = budget;
+    tree->stamp = 0;
+    
+    // Root node
+    tree->root = tree->freelist;
+    tree->freelist = tree->pool[tree->root].next;
+    memset(&tree->pool[tree->root], 0, sizeof(OctreeNode));
+    memset(tree->pool[tree->root].child, 0xff, sizeof(tree->pool[tree->root].child));
+    tree->pool[tree->root].next = -1;
+    tree->reducible[0] = tree->root;
+    
+    return tree;
+}
+
+void freeOctree(Octree* tree){
+    free(tree->pool);
+    free(tree);
+}
+
+int32_t allocOctreeNode(Octree* tree, int level){
+    // Take a node from the pool, nodes at the bottom level are leaves
+    int32_t ind = tree->freelist;
+    if(ind < 0){
+        printf("Error: Octree node pool exhausted. Exiting.\n");
+        exit(-1);
+    }
+    OctreeNode* node = &tree->pool[ind];
+    tree->freelist = node->next;
+    
+    memset(node, 0, sizeof(OctreeNode));
+    memset(node->child, 0xff, sizeof(node->child));
+    node->next = -1;
+    node->level = level;
+    if(level == OCTREE_DEPTH){
+        node->isleaf = 1;
+        tree->nleaf++;
+    }else{
+        // Internal nodes can later be merged into a leaf
+        node->next = tree->reducible[level];
+        tree->reducible[level] = ind;
+    }
+    
+    return ind;
+}
+
+void octreeInsert(Octree* tree, uint8_t R, uint8_t G, uint8_t B, uint64_t npixel){
+    // Add npixel pixels of one color to the tree
+    // Each level picks the child from one bit of each channel, until a leaf is reached
+    int32_t ind = tree->root;
+    
+    while(!tree->pool[ind].isleaf){
+        int level = tree->pool[ind].level;
+        int shift = 7-level;
+        int childind = (((R >> shift) & 1) << 2) | (((G >> shift) & 1) << 1) | ((B >> shift) & 1);
+        if(tree->pool[ind].child[childind] < 0){
+            int32_t child = allocOctreeNode(tree, level+1);
+            tree->pool[ind].child[childind] = child;
+        }
+        ind = tree->pool[ind].child[childind];
+    }
+    
+    OctreeNode* leaf = &tree->pool[ind];
+    leaf->npixel += npixel;
+    leaf->sumR += npixel*R;
+    leaf->sumG += npixel*G;
+    leaf->sumB += npixel*B;
+    
+    // Keep the tree within its leaf budget
+    while(tree->nleaf > tree->budget){
+        octreeReduce(tree);
+    }
+}
+
+void octreeReduce(Octree* tree){
+    // Merge the children of one node on the deepest level with internal nodes into that node
+    // The children are all leaves there, pick the node with the fewest pixels so that the most common colors are kept
+    int level = OCTREE_DEPTH-1;
+    while(level > 0 && tree->reducible[level] < 0){
+        level--;
+    }
+    
+    int32_t best = -1;
+    int32_t bestprev = -1;
+    uint64_t bestnpixel = 0;
+    int32_t prev = -1;
+    for(int32_t ind=tree->reducible[level]; ind>=0; ind=tree->pool[ind].next){
+        uint64_t npixel = 0;
+        for(int i=0;i<8;i++){
+            if(tree->pool[ind].child[i] >= 0){
+                npixel += tree->pool[tree->pool[ind].child[i]].npixel;
+            }
+        }
+        if(best < 0 || npixel < bestnpixel){
+            best = ind;
+            bestprev = prev;
+            bestnpixel = npixel;
+        }
+        prev = ind;
+    }
+    if(best < 0){
+        // Nothing left to reduce
+        return;
+    }
+    
+    // Take the node out of the reducible list
+    OctreeNode* node = &tree->pool[best];
+    if(bestprev < 0){
+        tree->reducible[level] = node->next;
+    }else{
+        tree->pool[bestprev].next = node->next;
+    }
+    node->next = -1;
+    
+    // Merge the children into the node and give them back to the pool
+    for(int i=0;i<8;i++){
+        int32_t child = node->child[i];
+        if(child < 0){
+            continue;
+        }
+        node->npixel += tree->pool[child].npixel;
+        node->sumR += tree->pool[child].sumR;
+        node->sumG += tree->pool[child].sumG;
+        node->sumB += tree->pool[child].sumB;
+        tree->pool[child].next = tree->freelist;
+        tree->freelist = child;
+        node->child[i] = -1;
+        tree->nleaf--;
+    }
+    node->isleaf = 1;
+    tree->nleaf++;
+#if DEBUG
+    printf("Reduced octree node at level %i, %i leaves left\n", level, tree->nleaf);
+#endif
+}
+
+int32_t octreeFindLeaf(Octree* tree, uint8_t R, uint8_t G, uint8_t B){
+    // Find the leaf that holds a color, -1 if the color was never inserted
+    int32_t ind = tree->root;
+    
+    while(!tree->pool[ind].isleaf){
+        int shift = 7-tree->pool[ind].level;
+        int childind = (((R >> shift) & 1) << 2) | (((G >> shift) & 1) << 1) | ((B >> shift) & 1);
+        ind = tree->pool[ind].child[childind];
+        if(ind < 0){
+            return -1;
+        }
+    }
+    
+    return ind;
+}
+
+void octreeQuant(Octree* tree, SortedPixel* unique, uint32_t length, int tablebitsize, SortedPixel* palette){
+    // Add the unique colors of a frame to the tree and take the frame palette from the leaves that its colors end up in
+    // The tree can be kept from frame to frame, so that the palette follows the colors of the whole animation so far
+    // Each unique color is set to the mean color of its leaf, same as medianCut
+    
+    int tablesize = 1 << tablebitsize;  // = 2^tablebitsize
+    
+    for(int i=0;i<length;i++){
+        octreeInsert(tree, unique[i].R, unique[i].G, unique[i].B, unique[i].npixel);
+    }
+    
+    for(int i=0;i<tablesize;i++){
+        memset(&palette[i], 0, sizeof(SortedPixel));
+        palette[i].colorindex = i;
+    }
+    
+    // Number the leaves in the order their colors are found
+    // Leaves of earlier frames that this frame does not use are left out of its palette
+    tree->stamp++;
+    int count = 0;
+    for(int i=0;i<length;i++){
+        OctreeNode* leaf = &tree->pool[octreeFindLeaf(tree, unique[i].R, unique[i].G, unique[i].B)];
+        if(leaf->stamp != tree->stamp){
+            if(count >= tablesize){
+                printf("Error: Octree has more colors than the color table. Exiting.\n");
+                exit(-1);
+            }
+            leaf->stamp = tree->stamp;
+            leaf->colorindex = count;
+            palette[count].R = (uint8_t) ((leaf->sumR + leaf->npixel/2) / leaf->npixel);
+            palette[count].G = (uint8_t) ((leaf->sumG + leaf->npixel/2) / leaf->npixel);
+            palette[count].B = (uint8_t) ((leaf->sumB + leaf->npixel/2) / leaf->npixel);
+            palette[count].pixel = (palette[count].B << 16) + (palette[count].G << 8) + (palette[count].R << 0);
+#if DEBUG
+            printf("leaf #%i npixel=%llu color=%i,%i,%i\n", count, (unsigned long long) leaf->npixel, palette[count].R, palette[count].G, palette[count].B);
+#endif
+            count++;
+        }
+        
+        uint8_t index = leaf->colorindex;
+        unique[i].pixel = palette[index].pixel;
+        unique[i].R = palette[index].R;
+        unique[i].G = palette[index].G;
+        unique[i].B = palette[index].B;
+        unique[i].colorindex = index;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _OCTREE_H_
+#define _OCTREE_H_
+
+#include <stdlib.h>
+#include "pixel.h"
+
+// Depth of the tree, one level per bit of each color channel
+#define OCTREE_DEPTH 8
+
+typedef struct _OctreeNode {
+    uint64_t npixel;  // Number of pixels in this leaf
+    uint64_t sumR;    // Sums of the pixel colors in this leaf
+    uint64_t sumG;
+    uint64_t sumB;
+    int32_t child[8]; // Pool index of each child, -1 if there is none
+    int32_t next;     // Next node in the reducible list of its level, or in the free list
+    uint32_t stamp;   // Palette the colorindex belongs to
+    uint8_t level;
+    uint8_t isleaf;
+    uint8_t colorindex;
+} OctreeNode;
+
+typedef struct _Octree {
+    OctreeNode* pool;  // All nodes come from here, so the memory use is fixed by the leaf budget
+    int32_t poolsize;
+    int32_t freelist;
+    int32_t root;
+    int32_t reducible[OCTREE_DEPTH];  // Internal nodes of each level
+    uint32_t nleaf;
+    uint32_t budget;   // Maximum number of leaves, i.e. palette colors
+    uint32_t stamp;    // Incremented each time a palette is taken from the tree
+} Octree;
+
+Octree* newOctree(uint32_t budget);
+void freeOctree(Octree* tree);
+void octreeInsert(Octree* tree, uint8_t R, uint8_t G, uint8_t B, uint64_t npixel);
+void octreeReduce(Octree* tree);
+int32_t octreeFindLeaf(Octree* tree, uint8_t R, uint8_t G, uint8_t B);
+void octreeQuant(Octree* tree, SortedPixel* unique, uint32_t length, int tablebitsize, SortedPixel* palette);
+
+#endif
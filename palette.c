@@ -25,6 +25,10 @@
 #include <string.h>
 #include "palette.h"
 #include "medianCut.h"
+#include "wuQuant.h"
+#include "octree.h"
+#include "kmeans.h"
+#include "allocate.h"
 
 #define DEBUG 0
 
@@ -386,8 +390,85 @@ void getGrayTPalette(SortedPixel* palette){
 }
 
 
+int readPaletteFile(const char* filename, SortedPixel* palette){
+    // Load a palette from an Adobe color table (.act) file
+    // The file holds 256 RGB colors, optionally followed by the number of colors and the transparent index (both big-endian uint16)
+    // Returns the number of colors
+    
+    uint8_t act[772];
+    
+    FILE* fid = fopen(filename, "rb");
+    if(fid == NULL){
+        printf("Error: Cannot open palette file %s. Exiting.\n", filename);
+        exit(-1);
+    }
+    size_t length = fread(act, 1, sizeof(act), fid);
+    int extra = fgetc(fid);
+    fclose(fid);
+    if((length != 768 && length != 772) || extra != EOF){
+        printf("Error: Palette file %s is not an .act color table (768 or 772 bytes). Exiting.\n", filename);
+        exit(-1);
+    }
+    
+    int ncolors = 256;
+    if(length == 772){
+        ncolors = (act[768] << 8) + act[769];
+        if(ncolors == 0 || ncolors > 256){
+            ncolors = 256;
+        }
+    }
+    
+    memset(palette, 0, sizeof(SortedPixel)*256);
+    for(int i=0;i<ncolors;i++){
+        palette[i].R = act[3*i];
+        palette[i].G = act[3*i+1];
+        palette[i].B = act[3*i+2];
+        palette[i].pixel = (palette[i].B << 16) + (palette[i].G << 8) + (palette[i].R << 0);
+        palette[i].colorindex = i;
+    }
+    
+    return ncolors;
+}
+
+void writePaletteFile(const char* filename, SortedPixel* palette, int ncolors, int transparent){
+    // Save a palette as an Adobe color table (.act) file with the number of colors and the transparent index
+    // If transparent is set then index 0xff is the transparent index
+    
+    uint8_t act[772];
+    
+    memset(act, 0, sizeof(act));
+    for(int i=0;i<ncolors;i++){
+        // Adaptive palettes are only guaranteed to have the pixel field set
+        memcpy(&act[3*i], &(palette[i].pixel), 3);
+    }
+    act[768] = (ncolors >> 8) & 0xff;
+    act[769] = ncolors & 0xff;
+    act[770] = transparent ? 0x00 : 0xff;
+    act[771] = 0xff;
+    
+    FILE* fid = fopen(filename, "wb");
+    if(fid == NULL || fwrite(act, 1, sizeof(act), fid) != sizeof(act)){
+        printf("Error: Cannot write palette file %s. Exiting.\n", filename);
+        exit(-1);
+    }
+    fclose(fid);
+    printf("Wrote %i color palette to %s\n", ncolors, filename);
+}
+
 void getColorPalette(SortedPixel* palette, SortedPixel* unique, uint32_t nunique, int tablebitsize, GIFOptStruct gifopts){
- 
+    
+    // The adaptive palettes overwrite the unique colors, so keep them for refining if requested
+    // Nothing to refine if every unique color gets its own palette entry
+    uint8_t* original = NULL;
+    if(gifopts.refine > 0 && nunique > (1 << tablebitsize) && (gifopts.colorpalette == Pmedian || gifopts.colorpalette == Pwu || gifopts.colorpalette == Poctree)){
+        original = checkedMalloc(sizeof(uint8_t)*3*nunique);
+        for(int i=0;i<nunique;i++){
+            original[3*i] = unique[i].R;
+            original[3*i+1] = unique[i].G;
+            original[3*i+2] = unique[i].B;
+        }
+    }
+    
     switch(gifopts.colorpalette){
         case P685g:
             getP685gPalette(palette);
@@ -407,9 +488,62 @@ void getColorPalette(SortedPixel* palette, SortedPixel* unique, uint32_t nunique
         case PgrayT:
             getGrayTPalette(palette);
             break;
+        case Pfile:
+            // Already loaded from the palette file by readPaletteFile
+            break;
+        case Pwu:
+            // Shrink the color palette to an optimal set via Wu's quantizer
+            wuQuant(unique, nunique, tablebitsize, palette);
+            break;
+        case Poctree:
+            // Shrink the color palette by merging octree leaves, keeping the tree from earlier frames if there is one
+            if(gifopts.octree != NULL){
+                octreeQuant(gifopts.octree, unique, nunique, tablebitsize, palette);
+            }else{
+                Octree* tree = newOctree(1 << tablebitsize);
+                octreeQuant(tree, unique, nunique, tablebitsize, palette);
+                freeOctree(tree);
+            }
+            break;
         case Pmedian:
         default:
             doMedianCut(palette, unique, nunique, tablebitsize, gifopts);
             break;
     }
+    
+    // Refine the adaptive palette with k-means iterations
+    // Median cut sorts the unique colors, so put them back in the order of the saved colors first
+    if(original != NULL){
+        qsort((void*)unique, nunique, sizeof(SortedPixel), comparefcn_sortind);
+        int niter = refinePalette(palette, unique, original, nunique, gifopts.refine, gifopts.forcebw);
+        printf("Refined the color palette in %i iterations\n", niter);
+        free(original);
+    }
+}
+
+void freePaletteEntry(SortedPixel* palette, int entry, SortedPixel* unique, uint32_t nunique){
+    // Move the unique colors that were given palette entry entry to the closest of the entries before it, and clear it
+    // This keeps the last entry of an adaptive palette free for the transparent index
+    // Adaptive palettes are only guaranteed to have the pixel field set
+    SortedPixel colors[256];
+    memset(colors, 0, sizeof(colors));
+    for(int i=0;i<entry;i++){
+        colors[i].pixel = palette[i].pixel;
+        colors[i].R = palette[i].pixel & 0xff;
+        colors[i].G = (palette[i].pixel >> 8) & 0xff;
+        colors[i].B = (palette[i].pixel >> 16) & 0xff;
+    }
+    
+    for(uint32_t i=0;i<nunique;i++){
+        if(unique[i].colorindex != entry){
+            continue;
+        }
+        int ind = findClosestColor(colors, entry, unique[i]);
+        unique[i].colorindex = ind;
+        unique[i].R = colors[ind].R;
+        unique[i].G = colors[ind].G;
+        unique[i].B = colors[ind].B;
+        unique[i].pixel = colors[ind].pixel;
+    }
+    memset(&palette[entry], 0, sizeof(SortedPixel));
 }
@@ -25,4 +25,7 @@
 #include "pixel.h"
 #include "gifWriter.h"
 
+int readPaletteFile(const char* filename, SortedPixel* palette);
+void writePaletteFile(const char* filename, SortedPixel* palette, int ncolors, int transparent);
 void getColorPalette(SortedPixel* palette, SortedPixel* unique, uint32_t nunique, int tablebitsize, GIFOptStruct gifopts);
+void freePaletteEntry(SortedPixel* palette, int entry, SortedPixel* unique, uint32_t nunique);
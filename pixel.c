@@ -23,8 +23,10 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "pixel.h"
+#include "allocate.h"
 
 
 uint32_t findClosestColor(SortedPixel* palette, int npalette, SortedPixel pixel){
@@ -69,3 +71,33 @@ void palettizeColors(SortedPixel* palette, int tablesize, SortedPixel* unique, u
 #endif
     }
 }
+
+
+void palettizeFrame(uint8_t* frame, size_t npixel, SortedPixel* palette, int tablesize){
+    // Replace each RGB pixel of frame by the index of its closest palette color, in place
+    // Neighbouring pixels mostly share a handful of colors, so the closest colors are kept in a direct-mapped cache
+    // Gives the same indices as palettizeColors on the unique colors of the frame
+    
+    int cachesize = 1 << COLORCACHE_BITS;
+    ColorCacheEntry* cache = checkedCalloc(cachesize, sizeof(ColorCacheEntry));
+    SortedPixel pix;
+    memset(&pix, 0, sizeof(SortedPixel));
+    
+    uint8_t* rgb = frame;
+    for(size_t i=0;i<npixel;i++){
+        uint32_t key = (1 << 24) | (rgb[2] << 16) | (rgb[1] << 8) | rgb[0];
+        ColorCacheEntry* entry = &cache[(key*2654435761u) >> (32-COLORCACHE_BITS)];
+        if(entry->key != key){
+            pix.R = rgb[0];
+            pix.G = rgb[1];
+            pix.B = rgb[2];
+            entry->key = key;
+            entry->colorindex = findClosestColor(palette, tablesize, pix);
+        }
+        // The index never overtakes the RGB bytes still to be read
+        frame[i] = entry->colorindex;
+        rgb += 3;
+    }
+    
+    free(cache);
+}
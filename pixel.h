@@ -34,6 +34,7 @@ typedef struct _SortedPixel {
     uint8_t G;
     uint8_t B;
     uint8_t colorindex;
+    // Indices and counts fit in 32 bits since frames of more than FRAME_MAXPIXELS pixels are split into tiles
     uint32_t frameindex;
     uint32_t sortedindex;
     uint32_t npixel;
@@ -43,7 +44,16 @@ typedef struct _SortedPixel {
     float residualB;
 } SortedPixel;
 
+// Number of entries in the nearest color cache of palettizeFrame, must be a power of 2
+#define COLORCACHE_BITS 14
+
+typedef struct _ColorCacheEntry {
+    uint32_t key;  // Pixel color with bit 24 set once the entry is used
+    uint8_t colorindex;
+} ColorCacheEntry;
+
 uint32_t findClosestColor(SortedPixel* palette, int npalette, SortedPixel pixel);
 void palettizeColors(SortedPixel* palette, int tablesize, SortedPixel* unique, uint32_t nunique);
+void palettizeFrame(uint8_t* frame, size_t npixel, SortedPixel* palette, int tablesize);
 
 #endif
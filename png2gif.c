@@ -28,6 +28,8 @@
 #include <getopt.h>
 #if defined(_WIN32) || defined(_WIN64)
 #include <direct.h>
+#include <io.h>
+#include <fcntl.h>
 #include <windows.h>
 #define GetCurrentDir _getcwd
 #else
@@ -39,6 +41,10 @@
 
 #include "pngReader.h"
 #include "gifWriter.h"
+#include "framePipeline.h"
+#include "stripWriter.h"
+#include "octree.h"
+#include "palette.h"
 
 #define MAX_ARG 256
 const char pathSeparator =
@@ -49,10 +55,18 @@ const char pathSeparator =
 #endif
 
 int useGUI = 0;
+FILE* gifstdout = NULL;  // GIF output stream when writing to stdout with -o -
 
 typedef struct _OptStruct {
     int fileind;
     int nfile;
+    char* outfile;
+    int delayset;
+    int paletteset;  // A palette was chosen with -c, -p or -f, otherwise palette and grayscale PNGs keep their own
+    enum _FrameSource source;
+    uint32_t rawwidth;
+    uint32_t rawheight;
+    int strips;
     GIFOptStruct gifopts;
 } OptStruct;
 
@@ -62,6 +76,13 @@ OptStruct newOptStructInst(){
     
     opts.fileind = 0;
     opts.nfile = 0;
+    opts.outfile = NULL;
+    opts.delayset = 0;
+    opts.paletteset = 0;
+    opts.source = SourcePNG;
+    opts.rawwidth = 0;
+    opts.rawheight = 0;
+    opts.strips = 0;
     opts.gifopts = newGIFOptStructInst();
     
     return opts;
@@ -73,29 +94,35 @@ int startGUI(char **argv);
 
 
 int main (int argc, char **argv) {
-    FILE *fid;
     FILE *fidgif;
     char giffilename[FILENAME_MAX];
     int pngfileind;
-    uint8_t* frame0=NULL;
-    uint8_t* frame1=NULL;
-    uint8_t* curframeptr=NULL;
-    uint8_t* lastframeptr=NULL;
-    int frameselect = 0;
+    FramePipeline pipeline;
+    FrameBuffer* curframe=NULL;
+    FrameBuffer* lastframe=NULL;
     int isFirstFrame = 1;
-    PNGHeader header;
+    int headerWritten = 0;
     
     // argParser will update where argc and argv point to, so need to pass in by reference
     OptStruct opts = argParser(&argc, &argv);
     
+    // If the gif is given with -o then all files are inputs
     // If only one file then use same basename for .gif
-    strcpy(giffilename, argv[opts.fileind]);
-    if(opts.nfile == 1){
+    // Raw frames come from stdin, so the only file is the gif
+    if(opts.outfile != NULL){
+        strcpy(giffilename, opts.outfile);
+        pngfileind = opts.fileind;
+    }else if(opts.source != SourcePNG){
+        strcpy(giffilename, argv[opts.fileind]);
+        pngfileind = opts.fileind+1;
+    }else if(opts.nfile == 1){
+        strcpy(giffilename, argv[opts.fileind]);
         pngfileind = opts.fileind;
         // Replace extension
         int namelen = strlen(giffilename);
         strcpy(giffilename+namelen-4, ".gif");
     }else{
+        strcpy(giffilename, argv[opts.fileind]);
         pngfileind = opts.fileind+1;
     }
     
@@ -104,80 +131,128 @@ int main (int argc, char **argv) {
     // Open the gif file
     fidgif = NULL;
     
-    for(int i=pngfileind; i<argc; i++){
-        printf("pngfilename=%s\n", argv[i]);
-        fid = fopen(argv[i], "rb");
-        
-        // Get png header and make sure the frame is the same size
-        readPNGHeader(fid, &header);
-        
-        // Check for supported PNG formats
-        if(header.ColorType != 2 && header.ColorType != 6){
-            printf("Error: PNG reader only supports 24-bit or 32-bit Truecolor images (this image colorType=%i)\n", header.ColorType);
-            if(useGUI == 1){
-                tinyfd_messageBox("png2gif error: Unsupported file format", "Error: PNG reader only supports 24-bit or 32-bit Truecolor images, this file is not supported.\n", "ok", "error", 1);
-            }
+    // A global color table palette can be applied a strip of rows at a time, so that large PNGs are never held in memory whole
+    if(opts.source == SourcePNG && getPaletteBits(opts.gifopts) != 0 && (opts.strips || isLargePNG(argv[pngfileind], !opts.paletteset))){
+        fidgif = gifstdout != NULL ? gifstdout : fopen(giffilename, "wb");
+        if(fidgif == NULL){
+            printf("Error: Cannot open %s for writing\n", giffilename);
             return -1;
         }
-        if(header.Interlace != 0){
-            printf("Error: PNG reader does not support interlaced images\n");
-            if(useGUI == 1){
-                tinyfd_messageBox("png2gif error: Unsupported file format", "Error: PNG reader does not support interlaced images, this file is not supported.\n", "ok", "error", 1);
+        writeGIFStrips(fidgif, &argv[pngfileind], argc-pngfileind, opts.gifopts);
+        putc('\x3B', fidgif);
+        fclose(fidgif);
+        printf("Finished!\n\n");
+        return(0);
+    }
+    
+    // Read and defilter the PNG files on a separate thread so that the next frame is decoded while the current one is encoded
+    int status;
+    if(opts.source == SourcePNG){
+        status = startFramePipeline(&pipeline, &argv[pngfileind], argc-pngfileind, !opts.paletteset, opts.gifopts.dither > 0, opts.gifopts.alphathreshold > 0);
+    }else{
+        status = startRawFramePipeline(&pipeline, opts.source, opts.rawwidth, opts.rawheight, opts.gifopts.alphathreshold > 0);
+    }
+    if(status != 0){
+        printf("Error: Could not start the frame reader thread\n");
+        return -1;
+    }
+    
+    while((curframe = nextFrame(&pipeline)) != NULL){
+        
+        // If just starting then open the file and write the gif header
+        // Keep track of the header explicitly since stdout or a pipe cannot be asked for its position
+        if(!headerWritten){
+            if(gifstdout != NULL){
+                fidgif = gifstdout;
+            }else{
+                fidgif = fopen(giffilename, "wb");
             }
-            return -1;
+            if(fidgif == NULL){
+                printf("Error: Cannot open %s for writing\n", giffilename);
+                return -1;
+            }
+            writeGIFHeader(fidgif, curframe->screenwidth, curframe->screenheight, opts.gifopts);
+            
+            // If more than one frame then write the application extension to enable looping animations
+            // The length of a raw stream or an animated PNG is only known once the next frame has been read
+            if((opts.source == SourcePNG && (argc-pngfileind) > 1) || hasNextFrame(&pipeline)){
+                writeGIFAppExtension(fidgif);
+            }
+            
+            // Use the frame rate of the stream unless a delay was given
+            if(!opts.delayset && pipeline.rawdelay > 0){
+                opts.gifopts.delay = pipeline.rawdelay;
+                printf(" Using %.2f s between frames from the stream frame rate\n", opts.gifopts.delay/100.0);
+            }
+            headerWritten = 1;
         }
         
-        // Allocate memory for the frame if we are just starting
-        // Do this here because we only now know the frame size
-        // Always support RGBA size, just in case
-        if(frame0==NULL){
-            frame0 = malloc(sizeof(uint8_t)*4*header.Width*header.Height+header.Height);  // RBG bytes + png scanline filter bytes
-            memset(frame0, 0, sizeof(uint8_t)*4*header.Width*header.Height);
-            frame1 = malloc(sizeof(uint8_t)*4*header.Width*header.Height+header.Height);  // RBG bytes + png scanline filter bytes
-            memset(frame1, 0, sizeof(uint8_t)*4*header.Width*header.Height);
+        // Palette and grayscale PNGs that were read as indices use their own palette as the color table of the frame
+        GIFOptStruct frameopts = opts.gifopts;
+        if(curframe->npalette > 0){
+            frameopts.colorpalette = Pindexed;
+            frameopts.palette = curframe->palette;
+            frameopts.palettesize = curframe->npalette;
         }
-        
-        // Figure out which frame is the current and previous frame
-        if(frameselect == 0){
-            curframeptr = frame0;
-            lastframeptr = frame1;
-            // Update frameselect
-            frameselect = 1;
-        }else{
-            curframeptr = frame1;
-            lastframeptr = frame0;
-            // Update frameselect
-            frameselect = 0;
+        if(curframe->hasdetail){
+            frameopts.detail = curframe->detail;
         }
-        
-        // Get png frame in rgb raw format
-        if(header.ColorType == 2){
-            readPNGFrame(fid, header.Width, header.Height, curframeptr, 3);
-        }else if(header.ColorType == 6){
-            readPNGFrame(fid, header.Width, header.Height, curframeptr, 4);
-        }else{
-            printf("Error: Should never get here, unsupported PNG color type\n");
-            return -1;
+        if(curframe->hasalpha){
+            frameopts.alpha = curframe->alpha;
         }
         
-        // If just starting then open the file and write the gif header
-        if(fidgif <= 0){
-            fidgif = fopen(giffilename, "wb");
-	}
-        if(ftell(fidgif) == 0){
-            writeGIFHeader(fidgif, header.Width, header.Height, opts.gifopts);
-            
-            // If more than one frame then write the application extension to enable looping animations
-            if((argc-pngfileind) > 1){
-                writeGIFAppExtension(fidgif);
-            }
+        // Frames of animated PNGs keep their place on the screen, delay and disposal, unless a delay was given
+        frameopts.left = curframe->left;
+        frameopts.top = curframe->top;
+        if(curframe->delay >= 0 && !opts.delayset){
+            frameopts.delay = (uint16_t) curframe->delay;
+        }
+        if(curframe->disposal > 0){
+            frameopts.disposal = curframe->disposal;
         }
         
         // Write frame to gif
-        writeGIFFrame(fidgif, curframeptr, lastframeptr, header.Width, header.Height, opts.gifopts, isFirstFrame);
+        // The previous frame holds the indices it was encoded with, it is not used for the first frame or when either frame
+        // has its own palette, since their indices are then into different color tables
+        // With alpha each frame is drawn on a cleared screen, so there is no previous frame to leave pixels of
+        // Nor is the previous frame what is on the screen if either frame covers only part of it or it is cleared afterwards
+        int uselast = !isFirstFrame && curframe->npalette == 0 && lastframe->npalette == 0 && opts.gifopts.alphathreshold == 0 &&
+                      coversScreen(curframe) && coversScreen(lastframe) && lastframe->disposal <= 1;
+        writeGIFFrame(fidgif, curframe->data, uselast ? lastframe->data : curframe->data, curframe->width, curframe->height, frameopts, !uselast);
         isFirstFrame = 0;
         
-        fclose(fid);
+        // Only the palette of the first frame is saved
+        opts.gifopts.paletteout = NULL;
+        
+        // Send each frame on as soon as it is encoded so that a reader on the other end of a pipe can start on it
+        fflush(fidgif);
+        
+        // The previous frame is no longer needed, so hand its buffer back to the decoder
+        if(lastframe != NULL){
+            releaseFrame(&pipeline);
+        }
+        lastframe = curframe;
+    }
+    if(lastframe != NULL){
+        releaseFrame(&pipeline);
+    }
+    
+    // Wait for the decoder and free frame memory
+    stopFramePipeline(&pipeline);
+    
+    // Report errors from the PNG reader
+    if(pipeline.error){
+        printf("%s", pipeline.errormessage);
+        if(useGUI == 1){
+            tinyfd_messageBox(pipeline.errortitle, pipeline.errormessage, "ok", "error", 1);
+        }
+        return -1;
+    }
+    
+    // An empty raw stream gives no frames to write
+    if(fidgif == NULL){
+        printf("Error: No frames were read\n");
+        return -1;
     }
     
     // Write the gif end byte
@@ -186,10 +261,6 @@ int main (int argc, char **argv) {
     // Close gif
     fclose(fidgif);
     
-    // Free frame memory
-    free(frame1);
-    free(frame0);
-    
     printf("Finished!\n\n");
     
     return(0);
@@ -198,28 +269,111 @@ int main (int argc, char **argv) {
 void usage(char **argv){
     printf("\nPNG to GIF converter.\n\n");
     printf("Usage: %s [opts] [GIFfile] PNGfile1 [PNGfile2 ...]\n", argv[0]);
+    printf("       %s [opts] -o <GIFfile> PNGfile1 [PNGfile2 ...]\n", argv[0]);
+    printf("       %s [opts] -r <format> [-z <W>x<H>] GIFfile < rawframes\n", argv[0]);
     printf(" If GIFfile is omitted then it will be inferred by the name of PNGfile1.\n");
+    printf(" Animated PNGs give a frame for each of their frames, with their own delays unless -t is given.\n");
     printf(" opts:\n");
+    printf("  -o, --output <GIFfile>     Write the GIF to GIFfile, all other files are inputs\n");
+    printf("                              (use - to write to stdout, messages then go to stderr)\n");
     printf("  -t, --timedelay <delay>    Time delay between frames in seconds (float)\n");
     printf("                              (default=0.25)\n");
     printf("  -d, --dither               Turn on dithering\n");
-    printf("  -c, --colorpalette <name>  Set a specific color palette to be used.\n");
+    printf("  -c, --colorpalette <name>  Set a specific color palette to be used. Palette and grayscale\n");
+    printf("                              PNGs otherwise keep their own colors (unless -p or -f is given)\n");
     printf("     Color palette options for <name>:\n");
     printf("      685g    6-8-5 level RGB with 15 gray and 1 transparent (default)\n");
     printf("      676g    6-7-6 level RGB with 3 gray and 1 transparent\n");
     printf("      884     8-8-4 level RGB with 0 gray and 0 transparent\n");
     printf("      web     6-6-6 level RGB, also known as the web palette, no transparent\n");
     printf("      median  Adaptive palette using the median cut algorithm, no transparent\n");
+    printf("      wu      Adaptive palette using Wu's variance minimizing quantizer, no transparent\n");
+    printf("      octree  Adaptive palette from an octree of the colors of all frames so far,\n");
+    printf("              no transparent\n");
     printf("      gray    Grayscale palette, no transparent, size determined by -n flag\n");
     printf("      grayT   Grayscale palette, with transparent, size determined by -n flag\n");
+    printf("  -p, --palette-in <file>    Use the palette in an .act color table file for all frames,\n");
+    printf("                              with a transparent index if it has no more than 255 colors\n");
+    printf("  -e, --palette-out <file>   Save the palette of the first frame to an .act color table file\n");
     printf("  -n, --ncolorbits <nbits>   Number of color bits to use in the color palette\n");
     printf("                              (default=8)\n");
     printf("  -f, --forcebw              Force black and white into color palette\n");
+    printf("  -k, --refine <niter>       Refine median, wu and octree palettes with up to niter\n");
+    printf("                              k-means iterations (default=0)\n");
+    printf("  -q, --lossy <tolerance>    Lossy LZW compression, colors may be changed to another palette\n");
+    printf("                              color up to tolerance away (RGB distance, e.g. 20-60) if that\n");
+    printf("                              compresses better (default=0, lossless)\n");
+    printf("  -x, --clear <policy>       When LZW starts over once its string table is full\n");
+    printf("     Clear policy options for <policy>:\n");
+    printf("      full      Start over as soon as the table is full (default)\n");
+    printf("      adaptive  Keep the full table until the compression ratio drops\n");
+    printf("      never     Keep the full table until the end of the frame\n");
+    printf("  -b, --bands <n>            LZW encode each frame in n bands of rows on separate threads,\n");
+    printf("                              slightly larger but faster for large frames (default=1,\n");
+    printf("                              0 for one per processor, at most %i, not used with -l)\n", MAXTHREADS);
+    printf("  -r, --raw <format>         Read raw frames from stdin instead of PNG files\n");
+    printf("     Raw frame options for <format>:\n");
+    printf("      rgb24   Packed 8-bit RGB, frame size given by -z flag\n");
+    printf("      rgba    Packed 8-bit RGBA, alpha is dropped unless -a is given, frame size given by -z flag\n");
+    printf("      y4m     YUV4MPEG2 stream, frame size and rate are read from the stream\n");
+    printf("  -z, --size <W>x<H>         Frame size of rgb24 and rgba streams\n");
+    printf("  -y, --crc <mode>           What to do when a PNG chunk fails its CRC check\n");
+    printf("     CRC options for <mode>:\n");
+    printf("      strict  Stop with an error (default)\n");
+    printf("      warn    Print a warning and convert the file anyway\n");
+    printf("      off     Do not check CRCs\n");
+    printf("  -a, --alpha-threshold <n>  Make pixels of PNGs and rgba streams with alpha below n (1-255) transparent,\n");
+    printf("                              instead of dropping alpha (default=0, alpha is dropped)\n");
+    printf("  -l, --strips               Read and encode PNGs a strip of rows at a time to save memory,\n");
+    printf("                              only with fixed palettes and palette files (always done\n");
+    printf("                              for frames of more than 16M pixels)\n");
     printf("  -s, --silent               Silent mode\n");
     printf("  -v, --version              Print version number\n");
     printf("  -h, --help                 Print this help\n\n");
 }
 
+enum _FrameSource checkRawOption(char* option){
+    
+    if(strcmp("rgb24", option) == 0){
+        return SourceRGB24;
+    }else if(strcmp("rgba", option) == 0){
+        return SourceRGBA;
+    }else if(strcmp("y4m", option) == 0){
+        return SourceY4M;
+    }else{
+        printf("Unknown raw frame format %s. Exiting.\n", option);
+        exit(-1);
+    }
+}
+
+enum _ClearPolicies checkClearOption(char* option){
+    
+    if(strcmp("full", option) == 0){
+        return ClearFull;
+    }else if(strcmp("adaptive", option) == 0){
+        return ClearAdaptive;
+    }else if(strcmp("never", option) == 0){
+        return ClearNever;
+    }else{
+        printf("Unknown clear policy %s. Exiting.\n", option);
+        exit(-1);
+    }
+}
+
+enum _CRCChecks checkCRCOption(char* option){
+    
+    if(strcmp("strict", option) == 0){
+        return CRCStrict;
+    }else if(strcmp("warn", option) == 0){
+        return CRCWarn;
+    }else if(strcmp("off", option) == 0){
+        return CRCOff;
+    }else{
+        printf("Unknown CRC check %s. Exiting.\n", option);
+        exit(-1);
+    }
+}
+
 int checkPaletteOption(char* option){
     
     if(strcmp("685g", option) == 0){
@@ -232,6 +386,10 @@ int checkPaletteOption(char* option){
         return Pweb;
     }else if(strcmp("median", option) == 0){
         return Pmedian;
+    }else if(strcmp("wu", option) == 0){
+        return Pwu;
+    }else if(strcmp("octree", option) == 0){
+        return Poctree;
     }else if(strcmp("gray", option) == 0){
         return Pgray;
     }else if(strcmp("grayT", option) == 0){
@@ -248,6 +406,9 @@ OptStruct argParser(int* argc, char ***argv){
     char** args = *argv;
     int ch;
     int printStartText = 1;
+    int silent = 0;
+    int writeToStdout = 0;
+    char* paletteFile = NULL;
     OptStruct opts = newOptStructInst();
 
     // Because Windows is Windows, need to check to see if we are executing from the command line or from a double-click (see https://devblogs.microsoft.com/oldnewthing/20160125-00/?p=92922 except that you can't pass in nullptr or 0 to GetConsoleProcessList)
@@ -262,11 +423,23 @@ OptStruct argParser(int* argc, char ***argv){
 #endif
     
     static struct option longopts[] = {
+        {"output",       required_argument, NULL, 'o'},
         {"timedelay",    required_argument, NULL, 't'},
         {"dither",       no_argument,       NULL, 'd'},
         {"colorpalette", required_argument, NULL, 'c'},
         {"ncolorbits",   required_argument, NULL, 'n'},
         {"forcebw",      no_argument,       NULL, 'f'},
+        {"refine",       required_argument, NULL, 'k'},
+        {"palette-in",   required_argument, NULL, 'p'},
+        {"palette-out",  required_argument, NULL, 'e'},
+        {"lossy",        required_argument, NULL, 'q'},
+        {"clear",        required_argument, NULL, 'x'},
+        {"bands",        required_argument, NULL, 'b'},
+        {"raw",          required_argument, NULL, 'r'},
+        {"size",         required_argument, NULL, 'z'},
+        {"crc",          required_argument, NULL, 'y'},
+        {"alpha-threshold", required_argument, NULL, 'a'},
+        {"strips",       no_argument,       NULL, 'l'},
         {"silent",       no_argument,       NULL, 's'},
         {"usegui",       no_argument,       NULL, 'g'},
         {"version",      no_argument,       NULL, 'v'},
@@ -277,11 +450,13 @@ OptStruct argParser(int* argc, char ***argv){
     // First check for silent mode to ensure that we are indeed silent
     // Also check for -v or -h to avoid startup and option string printing
     // Check for GUI flag as well
-    while ((ch = getopt_long(narg, args, "t:dc:n:fsgvh" ,longopts, NULL)) != -1){
+    while ((ch = getopt_long(narg, args, "o:t:dc:n:fk:p:e:q:x:b:r:z:y:a:lsgvh" ,longopts, NULL)) != -1){
         switch(ch){
             case 's':
-                // Set up silent mode
-                freopen("/dev/null", "w" ,stdout);
+                silent = 1;
+                break;
+            case 'o':
+                writeToStdout = strcmp(optarg, "-") == 0;
                 break;
             case 'v':
             case 'h':
@@ -294,6 +469,20 @@ OptStruct argParser(int* argc, char ***argv){
                 break;
         }
     }
+    
+    // When the GIF goes to stdout, keep a binary stream on the real stdout for it and send all messages to stderr
+    if(writeToStdout){
+        gifstdout = fdopen(dup(fileno(stdout)), "wb");
+        dup2(fileno(stderr), fileno(stdout));
+#if defined(_WIN32) || defined(_WIN64)
+        _setmode(_fileno(gifstdout), _O_BINARY);
+#endif
+    }
+    
+    // Set up silent mode
+    if(silent){
+        freopen("/dev/null", "w" ,stdout);
+    }
 
     // Update argv if using a GUI
     if(useGUI > 0){
@@ -315,12 +504,13 @@ OptStruct argParser(int* argc, char ***argv){
     
     // Reset optind for getopt
     optind = 0;
-    while ((ch = getopt_long(narg, args, "t:dc:n:fsgvh" ,longopts, NULL)) != -1){
+    while ((ch = getopt_long(narg, args, "o:t:dc:n:fk:p:e:q:x:b:r:z:y:a:lsgvh" ,longopts, NULL)) != -1){
         switch(ch){
             case 't':
                 // Delay between frames in 1/100 sec
                 opts.gifopts.delay = (uint16_t) (100*atof(optarg));
-                printf(" Using %i ms between frames\n", opts.gifopts.delay);
+                opts.delayset = 1;
+                printf(" Using %.2f s between frames\n", opts.gifopts.delay/100.0);
                 break;
             case 'd':
                 opts.gifopts.dither = 1;
@@ -328,6 +518,7 @@ OptStruct argParser(int* argc, char ***argv){
                 break;
             case 'c':
                 opts.gifopts.colorpalette = checkPaletteOption(optarg);
+                opts.paletteset = 1;
                 printf(" Color palette \"%s\" will be used.\n", optarg);
                 break;
             case 'n':
@@ -337,8 +528,78 @@ OptStruct argParser(int* argc, char ***argv){
                 break;
             case 'f':
                 opts.gifopts.forcebw = 1;
+                opts.paletteset = 1;
                 printf(" Black and white colors will be forced.\n");
                 break;
+            case 'p':
+                paletteFile = optarg;
+                opts.paletteset = 1;
+                break;
+            case 'e':
+                opts.gifopts.paletteout = optarg;
+                printf(" Color palette will be saved to %s.\n", optarg);
+                break;
+            case 'k':
+                opts.gifopts.refine = atoi(optarg);
+                printf(" Color palette will be refined with up to %i k-means iterations.\n", opts.gifopts.refine);
+                break;
+            case 'q':
+                opts.gifopts.lossy = atoi(optarg);
+                if(opts.gifopts.lossy < 0 || opts.gifopts.lossy > 442){
+                    printf("Bad lossy tolerance %s, expected 0 to 442. Exiting.\n", optarg);
+                    exit(-1);
+                }
+                printf(" Lossy LZW compression with a tolerance of %i will be used.\n", opts.gifopts.lossy);
+                break;
+            case 'b':
+                opts.gifopts.lzwbands = atoi(optarg);
+                if(opts.gifopts.lzwbands < 0){
+                    printf("Bad number of bands %s. Exiting.\n", optarg);
+                    exit(-1);
+                }
+                printf(" LZW encoding in %i bands.\n", opts.gifopts.lzwbands);
+                break;
+            case 'x':
+                opts.gifopts.clearpolicy = checkClearOption(optarg);
+                printf(" LZW clear policy \"%s\" will be used.\n", optarg);
+                break;
+            case 'o':
+                opts.outfile = optarg;
+                printf(" Writing GIF to %s.\n", writeToStdout ? "stdout" : optarg);
+                break;
+            case 'r':
+                opts.source = checkRawOption(optarg);
+                printf(" Raw \"%s\" frames will be read from stdin.\n", optarg);
+                break;
+            case 'z':
+                if(sscanf(optarg, "%ux%u", &opts.rawwidth, &opts.rawheight) != 2 || opts.rawwidth == 0 || opts.rawheight == 0){
+                    printf("Bad frame size %s, expected <W>x<H>. Exiting.\n", optarg);
+                    exit(-1);
+                }
+                printf(" Raw frames are %ix%i pixels.\n", opts.rawwidth, opts.rawheight);
+                break;
+            case 'y':
+                setPNGCRCCheck(checkCRCOption(optarg));
+                printf(" PNG CRC check \"%s\" will be used.\n", optarg);
+                break;
+            case 'a':
+                opts.gifopts.alphathreshold = atoi(optarg);
+                if(opts.gifopts.alphathreshold < 0 || opts.gifopts.alphathreshold > 255){
+                    printf("Bad alpha threshold %s, expected 0 to 255. Exiting.\n", optarg);
+                    exit(-1);
+                }
+                // Frames with transparent pixels are cleared before the next one, so that the frame under them does not show through
+                opts.gifopts.disposal = opts.gifopts.alphathreshold > 0 ? 2 : 1;
+                printf(" Pixels with alpha below %i will be transparent.\n", opts.gifopts.alphathreshold);
+                break;
+            case 'l':
+                opts.strips = 1;
+                printf(" PNGs will be read and encoded a strip of rows at a time.\n");
+                break;
+            case 's':
+            case 'g':
+                // Already handled above
+                break;
             case 'v':
                 printf("\n png2gif version %s\n\n", VERSION);
                 exit(0);
@@ -350,28 +611,59 @@ OptStruct argParser(int* argc, char ***argv){
         }
     }
     
+    // Forcing black and white switches to the median cut palette, which would throw away the colors of a palette file
+    if(paletteFile != NULL && opts.gifopts.forcebw == 1){
+        printf("Error: -f cannot be used with a palette file (-p), add black and white to the palette file instead. Exiting.\n");
+        exit(-1);
+    }
+    
+    // A palette file replaces the color palette option
+    if(paletteFile != NULL){
+        opts.gifopts.colorpalette = Pfile;
+        opts.gifopts.palettesize = readPaletteFile(paletteFile, opts.gifopts.palette);
+        printf(" Color palette with %i colors will be loaded from %s.\n", opts.gifopts.palettesize, paletteFile);
+    }
+    
     // If forcing black and white colors then we also force the medianCut palette to be used
     if(opts.gifopts.forcebw == 1){
         opts.gifopts.colorpalette = checkPaletteOption("median");
         printf(" Forcing usage of \"median\" color palette due to forcebw flag.\n");
     }
     
+    // The octree is kept from frame to frame, with as many leaves as the largest color table allows
+    if(opts.gifopts.colorpalette == Poctree){
+        opts.gifopts.octree = newOctree(opts.gifopts.colortablebitsize > 0 ? 1 << opts.gifopts.colortablebitsize : 256);
+    }
+    
     opts.fileind = optind;
     opts.nfile = narg - optind;
     
-    if(opts.nfile < 1){
+    if(opts.nfile < 1 && !(opts.source != SourcePNG && opts.outfile != NULL)){
         usage(*argv);
         exit(0);
     }
     
+    // Raw frames are read from stdin, the only file is the gif and it doesn't have to exist
+    if(opts.source != SourcePNG){
+        if(opts.nfile != (opts.outfile == NULL ? 1 : 0)){
+            printf("%s: Raw frames are read from stdin, only the GIF file can be given. Exiting\n", (*argv)[0]);
+            exit(-1);
+        }
+        if(opts.source != SourceY4M && opts.rawwidth == 0){
+            printf("%s: The frame size of raw %s frames must be given with -z <W>x<H>. Exiting\n", (*argv)[0], opts.source == SourceRGBA ? "rgba" : "rgb24");
+            exit(-1);
+        }
+        return opts;
+    }
+    
     // Make sure files exist and can be opened
     // If the gif output file then it doesn't have to exist
     for(int i=opts.fileind; i<narg; i++){
         FILE* fid = fopen(args[i], "r");
         
         if(fid == 0){
-            // If first file and there is more than one file then it is a gif and can be missing
-            if(i == opts.fileind && opts.nfile > 1){
+            // If first file and there is more than one file then it is a gif and can be missing, unless the gif was given with -o
+            if(i == opts.fileind && opts.nfile > 1 && opts.outfile == NULL){
                 continue;
             }
             printf("%s: Cannot open file %s. Exiting\n", (*argv)[0], args[i]);
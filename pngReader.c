@@ -25,15 +25,62 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "pngReader.h"
+#include "allocate.h"
+#include "crc.h"
 
 #define DEBUG 0
 #define DEBUG_FILTER 0
 #define DEBUG_INFLATE 0
 
+// Set once from the command line, before any frames are read
+static enum _CRCChecks pngcrccheck = CRCStrict;
+
+// First column, first row, column step and row step of each pass of an image, see getPNGPass
+// Images that are not interlaced have the one pass of every pixel, Adam7 interlaced ones have seven
+static const uint8_t progressivepass[1][4] = {{0, 0, 1, 1}};
+static const uint8_t adam7passes[7][4] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4}, {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+
+static int readPNGControlData(FILE* fid, PNGChunk* chunk, uint8_t* data, uint32_t length, char* message);
+
+void setPNGCRCCheck(enum _CRCChecks check){
+    pngcrccheck = check;
+}
+
+uint32_t updatePNGCRC(uint32_t crc, const uint8_t* data, size_t length){
+    // Continue the CRC of a chunk over more of its type and data, right after they are read while they are still in cache
+    if(pngcrccheck == CRCOff){
+        return 0;
+    }
+    return updateCRC32(crc, data, length);
+}
+
+int checkPNGCRC(const char* type, uint32_t crc, const uint8_t* stored, char* message){
+    // Compare the CRC worked out over the type and data of a chunk with the one stored after it
+    // Returns non-zero if the chunk is corrupt and CRCs are checked strictly, with the reason in message (room for 256 characters)
+    if(pngcrccheck == CRCOff){
+        return 0;
+    }
+    uint32_t expected = (uint32_t) byteswap((uint8_t*) stored);
+    if(crc == expected){
+        return 0;
+    }
+    if(pngcrccheck == CRCStrict){
+        sprintf(message, "Error: PNG %.4s chunk is corrupt (CRC %08x, expected %08x)\n", type, crc, expected);
+        return -1;
+    }
+    printf("Warning: PNG %.4s chunk is corrupt (CRC %08x, expected %08x)\n", type, crc, expected);
+    return 0;
+}
+
 
-void readPNGHeader(FILE* fid, PNGHeader *header){
+int readPNGHeader(FILE* fid, PNGHeader *header, char* message){
+    // Read the signature and the IHDR chunk
+    // Returns non-zero if the file is not a PNG or its header cannot be read, with the reason in message (room for 256 characters)
     uint8_t buffer[9];
     PNGChunk chunk;
     uint8_t head[]="\x89\x50\x4E\x47\x0D\x0A\x1A\x0A";
@@ -42,18 +89,27 @@ void readPNGHeader(FILE* fid, PNGHeader *header){
     buffer[8] = 0;
     
     if( strncmp((char*)buffer, (char*)head, 8) != 0 ){
-        printf("Error: Input file is not a .png file\n");
-        printf("Test header is \"%s\"\n", head);
-        printf("File header is \"%s\"\n", buffer);
+        sprintf(message, "Error: Input file is not a .png file\n");
+        return -1;
     }
     
     memset(chunk.Type, '\0', 5);
+    chunk.Data = NULL;
     while(!feof(fid) && (strncmp((char*)chunk.Type, "IHDR", 4) != 0)){
-        readPNGChunk(fid, &chunk);
+        free(chunk.Data);
+        chunk.Data = NULL;
+        if(readPNGChunk(fid, &chunk, message) != 0){
+            return -1;
+        }
 #if DEBUG
         printf("chunk.Type=%s len=%i cmp=%i\n", chunk.Type, chunk.Length, strncmp((char*)chunk.Type, "IHDR", 4));
 #endif
     }
+    if(strncmp((char*)chunk.Type, "IHDR", 4) != 0 || chunk.Length < 13){
+        free(chunk.Data);
+        sprintf(message, "Error: PNG has no IHDR chunk\n");
+        return -1;
+    }
     
     // Read width and height
     header->Width = byteswap(&chunk.Data[0]);
@@ -61,12 +117,13 @@ void readPNGHeader(FILE* fid, PNGHeader *header){
 
     // Error checking
     if (header->Width == 0 || header->Height == 0){
-    printf("Error: Image has zero width or height.\n");
-    exit(-1);
+        free(chunk.Data);
+        sprintf(message, "Error: Image has zero width or height.\n");
+        return -1;
     }
     
     // Read other header data
-    // We'll be assuming that BitDepth=8, ColorType=2 or 6, and the rest are 0
+    // See checkPNGFormat for the formats that can be read
     header->BitDepth = chunk.Data[8];
     header->ColorType = chunk.Data[9];
     header->Compression = chunk.Data[10];
@@ -80,39 +137,250 @@ void readPNGHeader(FILE* fid, PNGHeader *header){
     printf("width=%i height=%i\n", header->Width, header->Height);
 #endif
     
+    return 0;
+}
+
+int checkPNGFormat(PNGHeader* header, char* message){
+    // Returns non-zero if the PNG cannot be read, with the reason in message (room for 256 characters)
+    // Grayscale (0), truecolor (2), palette (3), gray with alpha (4) and truecolor with alpha (6) images can be read
+    // at every bit depth that PNG allows: 1, 2, 4, 8 and 16 bits for grayscale, up to 8 for palette and 8 or 16 for the rest
+    uint8_t depth = header->BitDepth;
+    if(header->ColorType != 0 && header->ColorType != 2 && header->ColorType != 3 && header->ColorType != 4 && header->ColorType != 6){
+        sprintf(message, "Error: PNG colorType=%i is not a valid color type\n", header->ColorType);
+        return -1;
+    }
+    if((depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) ||
+       (header->ColorType == 3 && depth == 16) ||
+       (header->ColorType != 0 && header->ColorType != 3 && depth < 8)){
+        sprintf(message, "Error: PNG bitDepth=%i is not valid for colorType=%i\n", header->BitDepth, header->ColorType);
+        return -1;
+    }
+    if(header->Interlace > 1){
+        sprintf(message, "Error: PNG interlace method %i is not valid\n", header->Interlace);
+        return -1;
+    }
+    return 0;
+}
+
+uint8_t getPNGChannels(uint8_t colorType){
+    // Samples per pixel of each color type
+    switch(colorType){
+        case 2:
+            return 3;
+        case 4:
+            return 2;
+        case 6:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+int hasPNGAlpha(uint8_t colorType){
+    // Returns non-zero for the color types with an alpha channel, gray+alpha and RGBA
+    return colorType == 4 || colorType == 6;
+}
+
+uint8_t getPNGBytesPerPixel(PNGHeader* header){
+    // Bytes per pixel of the image data, which is also the distance back to the pixel before when defiltering
+    // Pixels of less than a byte are defiltered a byte at a time
+    uint8_t bits = getPNGChannels(header->ColorType)*header->BitDepth;
+    return bits < 8 ? 1 : bits/8;
+}
+
+size_t getPNGRowBytes(PNGHeader* header, uint32_t width){
+    // Bytes of one defiltered scanline of width pixels, without its filter type byte, rows of sub-byte pixels end on a whole byte
+    size_t bits = checkedSize((size_t) getPNGChannels(header->ColorType)*header->BitDepth, width);
+    return (bits+7)/8;
+}
+
+int getPNGPasses(PNGHeader* header){
+    // Number of passes the image data is stored in
+    return header->Interlace == 1 ? 7 : 1;
+}
+
+void getPNGPass(PNGHeader* header, int pass, PNGPass* p){
+    // Where the pixels of one pass go in the image, and how many of them there are
+    // Passes of Adam7 images narrower than 5 pixels or shorter than 5 rows may be empty, and then have no image data at all
+    const uint8_t* layout = header->Interlace == 1 ? adam7passes[pass] : progressivepass[0];
+    p->x0 = layout[0];
+    p->y0 = layout[1];
+    p->dx = layout[2];
+    p->dy = layout[3];
+    p->width = header->Width > p->x0 ? (header->Width - p->x0 + p->dx-1)/p->dx : 0;
+    p->height = header->Height > p->y0 ? (header->Height - p->y0 + p->dy-1)/p->dy : 0;
+}
+
+size_t getPNGRawSize(PNGHeader* header){
+    // Bytes of inflated image data, the scanlines of every pass with their filter type bytes
+    size_t rawsize = 0;
+    PNGPass p;
+    for(int k=0;k<getPNGPasses(header);k++){
+        getPNGPass(header, k, &p);
+        if(p.width > 0){
+            rawsize += checkedSize(getPNGRowBytes(header, p.width)+1, p.height);
+        }
+    }
+    return rawsize;
 }
 
-void readPNGFrame(FILE* fid, uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel){
+int readPNGFrame(FILE* fid, PNGHeader* header, PNGAnimation* anim, uint8_t* frame, PNGPalette* palette, int8_t* detail, uint8_t* alpha, ScratchBuffer* idat, char* message){
+    // Read the image data chunks that follow the header, then inflate and defilter them into frame as RGB
+    // If palette is given then palette and grayscale images are read as one index per pixel instead, with their colors
+    // or gray levels in palette, so that they need no quantizing
+    // If detail is given then the RGB values of 16-bit images are also kept to better than 8 bits, see convertPNG16Row,
+    // with 3*width*height bytes
+    // If alpha is given then the alpha of images that have an alpha channel is kept as well, a byte per pixel with width*height
+    // bytes, and gray+alpha images are read as RGB even if palette is given, since they need room for a transparent index
+    // frame must have room for (4*width+1)*height bytes, the compressed data is collected in idat, which is kept for the next frame
+    // If anim is given, zeroed before the first call, then animated PNGs are read a frame per call, each one only the size
+    // of its rectangle in anim->control, until anim->hasnext is no longer set. The default image is skipped if it is not
+    // one of the frames. Without anim only the default image is read
+    // Returns non-zero if the frame cannot be read, with the reason in message (room for 256 characters)
     
     PNGChunk chunk;
-    uint32_t framesize = height + bytesPerPixel*width*height+1000;  // Includes height bytes of filter codes
-    uint8_t* buffer = malloc(framesize);
-    uint32_t bufferloc = 0;
+    PNGAnimation still;
+    size_t framesize = getPNGRawSize(header) + 1000;
+    uint8_t* buffer = reserveScratch(idat, framesize);
+    size_t bufferloc = 0;
+    // Stored or incompressible deflate is a little larger than the image, so the buffer grows as the data arrives,
+    // up to a size no encoder gets near
+    size_t maxdata = checkedSize(getPNGRawSize(header), 2) + (1 << 20);
     
     int ret;
     
     printf("Reading PNG frame\n");
     
+    if(anim == NULL){
+        memset(&still, 0, sizeof(PNGAnimation));
+        anim = &still;
+    }
+    
+    // The frame control of this frame was read by the previous call, otherwise frames that have none cover the image
+    int hascontrol = anim->hasnext;
+    if(anim->hasnext){
+        anim->control = anim->next;
+        anim->hasnext = 0;
+    }else{
+        memset(&anim->control, 0, sizeof(PNGFrameControl));
+        anim->control.width = header->Width;
+        anim->control.height = header->Height;
+    }
+    
     memset(chunk.Type, '\0', 5);
     while(!feof(fid) && (strncmp((char*)chunk.Type, "IEND", 4) != 0)){
-        readPNGChunk(fid, &chunk);
+        // Read the length and type, the data of image data chunks goes straight to the buffer and other chunks are skipped
+        if(fread(chunk.DataLength, 1, 4, fid) < 4 || fread(chunk.Type, 1, 4, fid) < 4){
+            break;
+        }
+        chunk.Length = byteswap(chunk.DataLength);
 #if DEBUG
         printf("chunk.Type=%s len=%i cmp=%i\n", chunk.Type, chunk.Length, strncmp((char*)chunk.Type, "IHDR", 4));
 #endif
         
-        if(strncmp((char*)chunk.Type, "IDAT", 4)!=0){
+        if(strncmp((char*)chunk.Type, "PLTE", 4)==0){
+            if(readPNGPalette(fid, &chunk, &anim->palette, message) != 0){
+                return -1;
+            }
+            continue;
+        }
+        if(anim != &still && strncmp((char*)chunk.Type, "acTL", 4)==0){
+            uint8_t data[8];
+            if(readPNGControlData(fid, &chunk, data, 8, message) != 0){
+                return -1;
+            }
+            anim->animated = 1;
+            anim->nframes = (uint32_t) byteswap(data);
+            anim->nplays = (uint32_t) byteswap(&data[4]);
+            continue;
+        }
+        if(anim->animated && strncmp((char*)chunk.Type, "fcTL", 4)==0){
+            // The frame control of the next frame ends this one
+            if(hascontrol){
+                if(readPNGFrameControl(fid, &chunk, header, &anim->next, message) != 0){
+                    return -1;
+                }
+                anim->hasnext = 1;
+                break;
+            }
+            if(readPNGFrameControl(fid, &chunk, header, &anim->control, message) != 0){
+                return -1;
+            }
+            hascontrol = 1;
+            continue;
+        }
+        // Frames after the first have their data in fdAT chunks, which start with a sequence number, and the default
+        // image is not part of the animation if no frame control comes before it
+        int isfdat = anim->animated && strncmp((char*)chunk.Type, "fdAT", 4)==0;
+        if((!isfdat && strncmp((char*)chunk.Type, "IDAT", 4)!=0) || (anim->animated && !hascontrol)){
+            if(skipPNGChunk(fid, &chunk, message) != 0){
+                return -1;
+            }
             continue;
         }
         
-        // Copy the chunk data to the current buffer position
-        memcpy(&buffer[bufferloc], chunk.Data, sizeof(uint8_t)*chunk.Length);
-        bufferloc += sizeof(uint8_t)*chunk.Length;
+        // Read the chunk data to the current buffer position, a piece at a time so that the CRC is worked out
+        // while each piece is still in cache, and check it before anything is inflated
+        uint32_t crc = updatePNGCRC(0, (uint8_t*) chunk.Type, 4);
+        uint32_t left = chunk.Length;
+        if(isfdat){
+            uint8_t sequence[4];
+            if(chunk.Length < 4 || fread(sequence, 1, 4, fid) < 4){
+                sprintf(message, "Error: PNG fdAT chunk ends early\n");
+                return -1;
+            }
+            crc = updatePNGCRC(crc, sequence, 4);
+            left -= 4;
+        }
+        while(left > 0){
+            size_t n = left < PNGROW_INPUTSIZE ? left : PNGROW_INPUTSIZE;
+            if(bufferloc+n > maxdata){
+                sprintf(message, "Error: PNG image data is more than twice the size of the image\n");
+                return -1;
+            }
+            buffer = growScratch(idat, bufferloc+n);
+            n = fread(&buffer[bufferloc], 1, n, fid);
+            if(n == 0){
+                break;
+            }
+            crc = updatePNGCRC(crc, &buffer[bufferloc], n);
+            bufferloc += n;
+            left -= (uint32_t) n;
+        }
+        fread(chunk.CRC, 1, 4, fid);
+        if(checkPNGCRC(chunk.Type, crc, chunk.CRC, message) != 0){
+            return -1;
+        }
 #if DEBUG
 //        printf("data=%s\n",chunk.Data);
-        printf("bufferloc=%d\n",bufferloc);
+        printf("bufferloc=%zu\n",bufferloc);
 #endif
     }
     
+    if(header->ColorType == 3 && anim->palette.Size == 0){
+        sprintf(message, "Error: PNG palette image has no PLTE chunk\n");
+        return -1;
+    }
+    
+    // The frame is decoded as an image the size of its rectangle
+    PNGHeader frameheader = *header;
+    frameheader.Width = anim->control.width;
+    frameheader.Height = anim->control.height;
+    header = &frameheader;
+    PNGPalette plte = anim->palette;
+    uint32_t width = header->Width;
+    uint32_t height = header->Height;
+    uint8_t bytesPerPixel = getPNGBytesPerPixel(header);
+    size_t rowlength = getPNGRowBytes(header, width);
+    size_t rawsize = getPNGRawSize(header);  // Includes the filter codes
+    
+    // 8-bit truecolor images are inflated to the start of frame and defiltered in place a whole frame at a time
+    // The others, and all interlaced images, are inflated, defiltered and unpacked to RGB or indices a row at a time
+    int truecolor = header->ColorType == 2 || header->ColorType == 6;
+    int keepalpha = alpha != NULL && hasPNGAlpha(header->ColorType);
+    int keepindices = palette != NULL && !truecolor && !keepalpha;
+    size_t outlength = keepindices ? width : 3*(size_t) width;
+    
     // Inflate the data
     /* allocate inflate state */
     z_stream zstrm;
@@ -124,27 +392,280 @@ void readPNGFrame(FILE* fid, uint32_t width, uint32_t height, uint8_t* frame, ui
     ret = inflateInit(&zstrm);
     if (ret != Z_OK){
         zerr(ret);
-        return;
+        sprintf(message, "Error: Could not start inflating the PNG image data\n");
+        return -1;
     }
     
-    inflateData(&zstrm, buffer, bufferloc, frame, framesize);
+    if(palette != NULL){
+        palette->Size = 0;  // RGB frame
+    }
+    
+    if(truecolor && header->BitDepth == 8 && header->Interlace == 0){
+        size_t inflated = inflateData(&zstrm, buffer, bufferloc, frame, rawsize);
 #if DEBUG
-    printf("frame=%x\n",frame);
-    printf("framesize=%i\n",framesize);
+        printf("frame=%x\n",frame);
+        printf("framesize=%zu\n",framesize);
 #endif
+        /* done when inflate() says it's done */
+        (void)inflateEnd(&zstrm);
+        if(inflated < rawsize){
+            sprintf(message, "Error: PNG image data is corrupt or ends early\n");
+            return -1;
+        }
+        
+        // Defilter the frame
+        int filtertype = defilterPNGFrame(width, height, frame, bytesPerPixel, keepalpha ? alpha : NULL);
+        if(filtertype != 0){
+            sprintf(message, "Error: unknown PNG filter type %d\n", filtertype);
+            return -1;
+        }
+        return 0;
+    }
     
-    /* done when inflate() says it's done */
+    // The buffers are sized for the widest pass, which is the full width but for Adam7 images of one column
+    size_t nsample = (size_t) getPNGChannels(header->ColorType)*width;
+    uint8_t* scanline = checkedMalloc(rowlength+1);
+    uint8_t* prior = checkedMalloc(rowlength);
+    uint8_t* samples = checkedMalloc(nsample);
+    uint8_t* passrow = header->Interlace == 1 ? checkedMalloc(outlength) : NULL;  // Unpacked row of a pass before it is scattered
+    uint8_t* passalpha = header->Interlace == 1 && keepalpha ? checkedMalloc(width) : NULL;
+    int8_t* rowdetail = NULL;
+    int8_t* passdetail = NULL;
+    if(detail != NULL && !keepindices && header->BitDepth == 16){
+        rowdetail = checkedMalloc(nsample);
+        passdetail = header->Interlace == 1 ? checkedMalloc(outlength) : NULL;
+    }
+    size_t pixelbytes = keepindices ? 1 : 3;
+    size_t inleft = bufferloc;
+    uint8_t maxindex = 0;
+    int status = 0;
+    zstrm.next_in = buffer;
+    
+    for(int k=0;k<getPNGPasses(header) && status == 0;k++){
+        PNGPass p;
+        getPNGPass(header, k, &p);
+        if(p.width == 0 || p.height == 0){
+            continue;
+        }
+        size_t passlength = getPNGRowBytes(header, p.width);
+        size_t passsamples = (size_t) getPNGChannels(header->ColorType)*p.width;
+        memset(prior, 0, passlength);  // scanline above each pass is always zeros
+        
+        for(uint32_t j=0;j<p.height;j++){
+            uint32_t y = p.y0 + j*p.dy;
+            uint8_t* out = frame + (size_t) y*outlength;
+            if(inflatePNGRow(&zstrm, scanline, passlength+1, &inleft) != 0){
+                sprintf(message, "Error: PNG image data is corrupt or ends early\n");
+                status = -1;
+                break;
+            }
+            int filtertype = defilterPNGRow(scanline, prior, passlength, bytesPerPixel);
+            if(filtertype != 0){
+                sprintf(message, "Error: unknown PNG filter type %d\n", filtertype);
+                status = -1;
+                break;
+            }
+            memcpy(prior, scanline+1, passlength);
+            
+            // Bring the row to a byte per sample, then unpack it as an 8-bit row, straight into the frame if the pass
+            // covers every pixel of it
+            uint8_t* row = normalizePNGRow(prior, samples, rowdetail, passsamples, header->ColorType, header->BitDepth, !keepindices);
+            uint8_t* unpacked = p.dx == 1 ? out : passrow;
+            if(keepindices){
+                uint8_t rowmax = unpackPNGIndices(row, unpacked, p.width, header->ColorType);
+                maxindex = rowmax > maxindex ? rowmax : maxindex;
+            }else{
+                unpackPNGRow(row, unpacked, p.width, header->ColorType, &plte);
+            }
+            if(p.dx > 1){
+                scatterPNGPixels(passrow, out + pixelbytes*p.x0, p.width, pixelbytes, p.dx);
+            }
+            if(rowdetail != NULL){
+                // The detail of gray is copied to all three colors and that of alpha dropped, just like the samples
+                int8_t* detailout = detail + (size_t) y*outlength;
+                unpackPNGRow((uint8_t*) rowdetail, (uint8_t*) (p.dx == 1 ? detailout : passdetail), p.width, header->ColorType, NULL);
+                if(p.dx > 1){
+                    scatterPNGPixels((uint8_t*) passdetail, (uint8_t*) detailout + 3*p.x0, p.width, 3, p.dx);
+                }
+            }
+            if(keepalpha){
+                uint8_t* alphaout = alpha + (size_t) y*width;
+                unpackPNGAlpha(row, p.dx == 1 ? alphaout : passalpha, p.width, header->ColorType);
+                if(p.dx > 1){
+                    scatterPNGPixels(passalpha, alphaout + p.x0, p.width, 1, p.dx);
+                }
+            }
+        }
+    }
     (void)inflateEnd(&zstrm);
+    free(scanline);
+    free(prior);
+    free(samples);
+    free(passrow);
+    free(passalpha);
+    free(rowdetail);
+    free(passdetail);
+    if(status != 0){
+        return -1;
+    }
     
-    // Defilter the frame
-    defilterPNGFrame(width, height, frame, bytesPerPixel);
+    if(keepindices){
+        // Grayscale images index a ramp of all gray levels, those of 16-bit images having been rounded to 8 bits
+        if(header->ColorType != 3){
+            int levels = header->BitDepth < 8 ? 1 << header->BitDepth : 256;
+            plte.Size = (uint16_t) levels;
+            for(int i=0;i<levels;i++){
+                memset(&plte.RGB[3*i], i*255/(levels-1), 3);
+            }
+        }
+        // Indices past the end of the palette are black
+        if(maxindex >= plte.Size){
+            plte.Size = maxindex+1;
+        }
+        *palette = plte;
+    }
+    return 0;
+}
+
+int inflatePNGRow(z_stream* zstrm, uint8_t* scanline, size_t length, size_t* inleft){
+    // Inflate the next length bytes of the image into scanline, taking more of the compressed data as needed
+    // zstrm->next_in points to the compressed data still to be inflated, of which inleft bytes are not yet handed to zlib
+    // Returns non-zero if the data is broken or ends early
+    int ret;
     
-    // Free allocated memory
-    free(chunk.Data);
-    free(buffer);
+    zstrm->next_out = scanline;
+    zstrm->avail_out = (uInt) length;
+    while(zstrm->avail_out > 0){
+        if(zstrm->avail_in == 0){
+            if(*inleft == 0){
+                return -1;
+            }
+            zstrm->avail_in = *inleft < ZLIB_MAXLEN ? (uInt) *inleft : ZLIB_MAXLEN;
+            *inleft -= zstrm->avail_in;
+        }
+        ret = inflate(zstrm, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END && zstrm->avail_out > 0){
+            return -1;
+        }
+        if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR){
+            zerr(ret == Z_NEED_DICT ? Z_DATA_ERROR : ret);
+            return -1;
+        }
+    }
+    return 0;
 }
 
-void readPNGChunk(FILE* fid, PNGChunk *chunk){
+int readPNGPalette(FILE* fid, PNGChunk* chunk, PNGPalette* palette, char* message){
+    // Read the colors of a PLTE chunk whose length and type have just been read
+    // Returns non-zero if the chunk is not a palette or is cut short, or if the CRC does not match, see checkPNGCRC
+    
+    if(chunk->Length % 3 != 0 || chunk->Length > 768){
+        sprintf(message, "Error: PNG PLTE chunk has %u bytes, expected up to 256 RGB colors\n", chunk->Length);
+        return -1;
+    }
+    memset(palette, 0, sizeof(PNGPalette));
+    palette->Size = (uint16_t) (chunk->Length/3);
+    if(fread(palette->RGB, 1, chunk->Length, fid) != chunk->Length || fread(chunk->CRC, 1, 4, fid) != 4){
+        sprintf(message, "Error: PNG PLTE chunk ends early\n");
+        return -1;
+    }
+    uint32_t crc = updatePNGCRC(0, (uint8_t*) chunk->Type, 4);
+    crc = updatePNGCRC(crc, palette->RGB, chunk->Length);
+    return checkPNGCRC(chunk->Type, crc, chunk->CRC, message);
+}
+
+static int readPNGControlData(FILE* fid, PNGChunk* chunk, uint8_t* data, uint32_t length, char* message){
+    // Read the data of a chunk whose length and type have just been read and that must have exactly length bytes
+    // Returns non-zero if the chunk has another length or is cut short, or if the CRC does not match, see checkPNGCRC
+    
+    if(chunk->Length != length){
+        sprintf(message, "Error: PNG %.4s chunk has %u bytes, expected %u\n", chunk->Type, chunk->Length, length);
+        return -1;
+    }
+    if(fread(data, 1, length, fid) != length || fread(chunk->CRC, 1, 4, fid) != 4){
+        sprintf(message, "Error: PNG %.4s chunk ends early\n", chunk->Type);
+        return -1;
+    }
+    uint32_t crc = updatePNGCRC(0, (uint8_t*) chunk->Type, 4);
+    crc = updatePNGCRC(crc, data, length);
+    return checkPNGCRC(chunk->Type, crc, chunk->CRC, message);
+}
+
+int readPNGFrameControl(FILE* fid, PNGChunk* chunk, PNGHeader* header, PNGFrameControl* control, char* message){
+    // Read an fcTL chunk whose length and type have just been read, checking that its rectangle is inside the image
+    // Returns non-zero if the chunk cannot be read, see readPNGControlData, or if it is not a valid frame
+    
+    uint8_t data[26];
+    if(readPNGControlData(fid, chunk, data, 26, message) != 0){
+        return -1;
+    }
+    control->width = (uint32_t) byteswap(&data[4]);
+    control->height = (uint32_t) byteswap(&data[8]);
+    control->x = (uint32_t) byteswap(&data[12]);
+    control->y = (uint32_t) byteswap(&data[16]);
+    control->delaynum = (uint16_t) ((data[20] << 8) | data[21]);
+    control->delayden = (uint16_t) ((data[22] << 8) | data[23]);
+    control->dispose = data[24];
+    control->blend = data[25];
+    if(control->width == 0 || control->height == 0 || (uint64_t) control->x+control->width > header->Width ||
+       (uint64_t) control->y+control->height > header->Height){
+        sprintf(message, "Error: PNG frame of %ux%u at (%u,%u) is not inside the %ux%u image\n", control->width,
+                control->height, control->x, control->y, header->Width, header->Height);
+        return -1;
+    }
+    if(control->dispose > 2 || control->blend > 1){
+        sprintf(message, "Error: PNG frame has dispose operation %u and blend operation %u, expected up to 2 and 1\n",
+                control->dispose, control->blend);
+        return -1;
+    }
+    return 0;
+}
+
+int findPNGChunk(FILE* fid, const char* type){
+    // Skip the chunks after the header up to the image data, returns non-zero if one of them has the given type
+    
+    PNGChunk chunk;
+    while(fread(chunk.DataLength, 1, 4, fid) == 4 && fread(chunk.Type, 1, 4, fid) == 4){
+        chunk.Length = byteswap(chunk.DataLength);
+        if(strncmp(chunk.Type, type, 4) == 0){
+            return 1;
+        }
+        if(strncmp(chunk.Type, "IDAT", 4) == 0 || fseek(fid, (long) chunk.Length + 4, SEEK_CUR) != 0){
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int skipPNGChunk(FILE* fid, PNGChunk* chunk, char* message){
+    // Skip the data and CRC of a chunk whose length and type have just been read, reading through it to check
+    // the CRC unless CRCs are not checked
+    // Returns non-zero if the CRC does not match, see checkPNGCRC
+    
+    if(pngcrccheck == CRCOff){
+        fseek(fid, (long) chunk->Length, SEEK_CUR);
+        fseek(fid, 4, SEEK_CUR);
+        return 0;
+    }
+    uint8_t data[4096];
+    uint32_t crc = updatePNGCRC(0, (uint8_t*) chunk->Type, 4);
+    uint32_t left = chunk->Length;
+    while(left > 0){
+        size_t n = left < sizeof(data) ? left : sizeof(data);
+        n = fread(data, 1, n, fid);
+        if(n == 0){
+            break;
+        }
+        crc = updatePNGCRC(crc, data, n);
+        left -= (uint32_t) n;
+    }
+    fread(chunk->CRC, 1, 4, fid);
+    return checkPNGCRC(chunk->Type, crc, chunk->CRC, message);
+}
+
+int readPNGChunk(FILE* fid, PNGChunk *chunk, char* message){
+    // Read the next chunk with its data, which the caller frees
+    // Returns non-zero if its CRC does not match, with the reason in message, in which case its data is already freed
     
 #if DEBUG
     printf("Reading chunk\n");
@@ -156,7 +677,8 @@ void readPNGChunk(FILE* fid, PNGChunk *chunk){
 #if DEBUG
         printf("Reached the end of the file\n");
 #endif
-        return;
+        chunk->Data = NULL;
+        return 0;
     }
     
     // Convert length from big to little endian and convert to int
@@ -169,25 +691,59 @@ void readPNGChunk(FILE* fid, PNGChunk *chunk){
 #endif
 
     // Allocate memory for the data
-    chunk->Data = malloc(sizeof(uint8_t)*chunk->Length);
+    chunk->Data = checkedMalloc(sizeof(uint8_t)*chunk->Length);
     
     // Read data
     fread(chunk->Data, 1, chunk->Length, fid);
     
-    // Read CRC
+    // Read and check CRC
     fread(chunk->CRC, 1, 4, fid);
+    uint32_t crc = updatePNGCRC(0, (uint8_t*) chunk->Type, 4);
+    crc = updatePNGCRC(crc, chunk->Data, chunk->Length);
+    if(checkPNGCRC(chunk->Type, crc, chunk->CRC, message) != 0){
+        free(chunk->Data);
+        chunk->Data = NULL;
+        return -1;
+    }
     
 #if DEBUG
     printf("chunk->length=%i\n", chunk->Length);
 #endif
-    
-    // Check CRC
-    // TODO
+    return 0;
+}
+
+static void defilterPNGAlphaRow(const uint8_t* scanline, uint8_t* alpha, const uint8_t* above, uint32_t width, uint8_t filtertype){
+    // Defilter the alpha bytes of one RGBA scanline into alpha, above is the alpha of the row above, NULL for the first row
+    // Each alpha byte is only predicted from the alpha bytes before and above it, so they can be defiltered on their own
+    for(uint32_t j=0;j<width;j++){
+        uint8_t x = scanline[4*j+3];
+        uint8_t a = j > 0 ? alpha[j-1] : 0;
+        uint8_t b = above != NULL ? above[j] : 0;
+        uint8_t c = above != NULL && j > 0 ? above[j-1] : 0;
+        switch(filtertype){
+            case 1:
+                x += a;
+                break;
+            case 2:
+                x += b;
+                break;
+            case 3:
+                x += (a+b)/2;
+                break;
+            case 4:
+                x += PaethPredictor(a, b, c);
+                break;
+            default:
+                break;
+        }
+        alpha[j] = x;
+    }
 }
 
-void defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel){
+int defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel, uint8_t* alpha){
     // Use the frame buffer and temporary scanline workspaces to process the data mostly in place
-    // If bytesPerPixel == 4 then just drop the alpha here since we won't use it later for GIFs (if we ever want to support outputing a different file format then this would need to change)
+    // If bytesPerPixel == 4 then the alpha is dropped from the frame, and is put in alpha instead unless it is NULL
+    // Returns the filter type of the first row whose type PNG does not define, 0 if there is none
     uint8_t* a;  // pixel before current index
     uint8_t* b;  // pixel above current index
     uint8_t* c;  // pixel before b
@@ -217,6 +773,12 @@ void defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t b
         printf("Filter %i used on line %i\n", filtertype, i);
 #endif
         
+        // The alpha bytes of the row are still all there until the RGB of the row is written over them
+        if(bytesPerPixel == 4 && alpha != NULL){
+            uint8_t* alpharow = alpha + (size_t) i*width;
+            defilterPNGAlphaRow(framereadptr, alpharow, i > 0 ? alpharow - width : NULL, width, filtertype);
+        }
+        
         // copy above scanline and scanline
         a = framewriteptr;
         b = nextb;
@@ -339,11 +901,419 @@ void defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t b
 #if DEBUG_FILTER
                 printf("Error: unknown filter type %d\n", filtertype);
 #endif
-                return;
+                return filtertype;
         }
         
     }
+    return 0;
+}
+
+void unpackPNGRow(uint8_t* row, uint8_t* rgb, uint32_t width, uint8_t colorType, PNGPalette* palette){
+    // Convert one defiltered scanline to RGB, gray is copied to all three colors and alpha is dropped
+    // palette is only used for palette images
+    uint32_t j;
+    
+    switch(colorType){
+        case 0:
+            for(j=0;j<width;j++){
+                rgb[3*j] = rgb[3*j+1] = rgb[3*j+2] = row[j];
+            }
+            break;
+        case 2:
+            memcpy(rgb, row, 3*(size_t) width);
+            break;
+        case 3:
+            for(j=0;j<width;j++){
+                memcpy(&rgb[3*j], &palette->RGB[3*row[j]], 3);
+            }
+            break;
+        case 4:
+            for(j=0;j<width;j++){
+                rgb[3*j] = rgb[3*j+1] = rgb[3*j+2] = row[2*j];
+            }
+            break;
+        case 6:
+            for(j=0;j<width;j++){
+                rgb[3*j] = row[4*j];
+                rgb[3*j+1] = row[4*j+1];
+                rgb[3*j+2] = row[4*j+2];
+            }
+            break;
+    }
+}
+
+uint8_t unpackPNGIndices(uint8_t* row, uint8_t* indices, uint32_t width, uint8_t colorType){
+    // Copy the palette indices or gray levels of one defiltered scanline of a palette or grayscale image, dropping alpha
+    // Returns the largest index, so that indices past the end of the palette can be found without another pass
+    uint8_t step = colorType == 4 ? 2 : 1;
+    uint8_t maxindex = 0;
+    
+    for(uint32_t j=0;j<width;j++){
+        uint8_t index = row[step*j];
+        indices[j] = index;
+        maxindex = index > maxindex ? index : maxindex;
+    }
+    return maxindex;
+}
+
+void unpackPNGAlpha(uint8_t* row, uint8_t* alpha, uint32_t width, uint8_t colorType){
+    // Copy the alpha of one defiltered scanline of a gray+alpha or RGBA image
+    uint8_t step = colorType == 4 ? 2 : 4;
+    
+    for(uint32_t j=0;j<width;j++){
+        alpha[j] = row[step*j+step-1];
+    }
+}
+
+static inline void scatterPixels1(const uint8_t* pixels, uint8_t* row, uint32_t n, const uint32_t step){
+    for(uint32_t i=0;i<n;i++){
+        row[i*step] = pixels[i];
+    }
+}
+
+static inline void scatterPixels3(const uint8_t* pixels, uint8_t* row, uint32_t n, const uint32_t step){
+    for(uint32_t i=0;i<n;i++){
+        uint8_t* out = row + 3*i*step;
+        out[0] = pixels[3*i];
+        out[1] = pixels[3*i+1];
+        out[2] = pixels[3*i+2];
+    }
+}
+
+void scatterPNGPixels(const uint8_t* pixels, uint8_t* row, uint32_t n, size_t pixelbytes, uint8_t step){
+    // Put the n unpacked pixels of one row of an interlace pass in every step'th pixel of the image row, from its first
+    // Each pass has a step of 8, 4 or 2, which is given to the loops as a constant so that they are unrolled for it
+    switch(step*pixelbytes){
+        case 8:
+            scatterPixels1(pixels, row, n, 8);
+            break;
+        case 4:
+            scatterPixels1(pixels, row, n, 4);
+            break;
+        case 2:
+            scatterPixels1(pixels, row, n, 2);
+            break;
+        case 24:
+            scatterPixels3(pixels, row, n, 8);
+            break;
+        case 12:
+            scatterPixels3(pixels, row, n, 4);
+            break;
+        case 6:
+            scatterPixels3(pixels, row, n, 2);
+            break;
+        default:
+            for(uint32_t i=0;i<n;i++){
+                memcpy(row + pixelbytes*i*step, pixels + pixelbytes*i, pixelbytes);
+            }
+            break;
+    }
+}
+
+uint8_t* normalizePNGRow(uint8_t* row, uint8_t* samples, int8_t* detail, size_t nsample, uint8_t colorType, uint8_t bitDepth, int scalegray){
+    // Bring the nsample samples of one defiltered scanline to a byte each, so that it can be unpacked like an 8-bit row
+    // 16-bit samples are rounded to 8 bits, keeping what was rounded off in detail unless it is NULL
+    // Samples of less than a byte are unpacked, gray levels are stretched to 0-255 if scalegray is set, palette indices never are
+    // Returns the row of bytes, which is row itself for 8-bit images and samples otherwise
+    switch(bitDepth){
+        case 8:
+            return row;
+        case 16:
+            convertPNG16Row(row, samples, detail, nsample);
+            return samples;
+        default:
+            expandPNGBits(row, samples, nsample, bitDepth, scalegray && colorType == 0);
+            return samples;
+    }
+}
+
+void expandPNGBits(const uint8_t* row, uint8_t* samples, size_t nsample, uint8_t bitDepth, int scale){
+    // Unpack samples of 1, 2 or 4 bits, packed from the high bits of each byte down, to a byte each
+    // With scale they are gray levels and are stretched to 0-255 (by 255, 85 or 17), otherwise they are kept as they are
+    uint8_t mask = (uint8_t) ((1 << bitDepth) - 1);
+    uint8_t perbyte = 8/bitDepth;
+    uint8_t levels[16];
+    size_t i = 0;
     
+    for(int v=0;v<=mask;v++){
+        levels[v] = (uint8_t) (scale ? v*(255/mask) : v);
+    }
+    for(;i+perbyte<=nsample;i+=perbyte){
+        uint8_t byte = *row++;
+        for(uint8_t k=0;k<perbyte;k++){
+            samples[i+k] = levels[(byte >> (8-bitDepth*(k+1))) & mask];
+        }
+    }
+    // Last byte of the row is only partly used
+    for(uint8_t k=0;i<nsample;i++,k++){
+        samples[i] = levels[(*row >> (8-bitDepth*(k+1))) & mask];
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i round16to8(__m128i v){
+    // Nearest 8-bit level of eight 16-bit samples, see convertPNG16Row
+    __m128i t = _mm_adds_epu16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_sub_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+#endif
+
+void convertPNG16Row(const uint8_t* row, uint8_t* samples, int8_t* detail, size_t nsample){
+    // Round nsample big-endian 16-bit samples to the nearest 8-bit level, v*255/65535 rounded, 16 at a time with SSE2
+    // With t = min(v+128, 65535) that is (t - t/256)/256, exact for every v
+    // detail, unless it is NULL, gets v - 257*level: what was rounded off in 1/257 of a level, -128 to 127 (128 is clamped)
+    size_t i = 0;
+#if defined(__SSE2__)
+    for(;i+16<=nsample;i+=16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(row+2*i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row+2*i+16));
+        // Big to little endian
+        a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+        b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+        __m128i qa = round16to8(a);
+        __m128i qb = round16to8(b);
+        _mm_storeu_si128((__m128i*)(samples+i), _mm_packus_epi16(qa, qb));
+        if(detail != NULL){
+            __m128i da = _mm_sub_epi16(a, _mm_add_epi16(_mm_slli_epi16(qa, 8), qa));
+            __m128i db = _mm_sub_epi16(b, _mm_add_epi16(_mm_slli_epi16(qb, 8), qb));
+            _mm_storeu_si128((__m128i*)(detail+i), _mm_packs_epi16(da, db));
+        }
+    }
+#endif
+    for(;i<nsample;i++){
+        uint32_t v = ((uint32_t) row[2*i] << 8) | row[2*i+1];
+        uint32_t t = v+128 > 65535 ? 65535 : v+128;
+        uint32_t q = (t - (t >> 8)) >> 8;
+        samples[i] = (uint8_t) q;
+        if(detail != NULL){
+            int32_t d = (int32_t) v - 257*(int32_t) q;
+            detail[i] = (int8_t) (d > 127 ? 127 : d);
+        }
+    }
+}
+
+void openPNGRows(PNGRowReader* reader, FILE* fid, PNGHeader* header){
+    // Get ready to read the image data of a PNG file whose header has just been read with readPNGHeader
+    
+    int ret;
+    uint32_t width = header->Width;
+    uint8_t bytesPerPixel = getPNGBytesPerPixel(header);
+    size_t rowlength = getPNGRowBytes(header, width);
+    size_t nsample = (size_t) getPNGChannels(header->ColorType)*width;
+    
+    printf("Reading PNG frame a strip at a time\n");
+    
+    reader->fid = fid;
+    reader->width = width;
+    reader->colorType = header->ColorType;
+    reader->bitDepth = header->BitDepth;
+    reader->bytesPerPixel = bytesPerPixel;
+    reader->rowlength = rowlength;
+    memset(&reader->palette, 0, sizeof(PNGPalette));
+    reader->input = checkedMalloc(PNGROW_INPUTSIZE);
+    reader->chunkleft = 0;
+    reader->idatfound = 0;
+    reader->lastchunk = 0;
+    reader->crc = 0;
+    reader->scanline = checkedMalloc(rowlength+1);
+    reader->prior = checkedCalloc(rowlength, 1);  // scanline above image is always zeros
+    reader->samples = checkedMalloc(nsample);
+    reader->detail = checkedMalloc(nsample);
+    
+    // allocate inflate state
+    reader->zstrm.zalloc = Z_NULL;
+    reader->zstrm.zfree = Z_NULL;
+    reader->zstrm.opaque = Z_NULL;
+    reader->zstrm.avail_in = 0;
+    reader->zstrm.next_in = Z_NULL;
+    ret = inflateInit(&reader->zstrm);
+    if (ret != Z_OK){
+        zerr(ret);
+        exit(-1);
+    }
+}
+
+void readPNGRows(PNGRowReader* reader, uint8_t* frame, int8_t* detail, uint8_t* alpha, uint32_t nrows){
+    // Inflate and defilter the next nrows rows of the image into frame as RGB
+    // If detail is given then the RGB values of 16-bit images are also kept to better than 8 bits, see convertPNG16Row
+    // If alpha is given then the alpha of images that have an alpha channel is kept as well, a byte per pixel
+    
+    size_t rowlength = reader->rowlength;
+    size_t nsample = (size_t) getPNGChannels(reader->colorType)*reader->width;
+    int8_t* rowdetail = detail != NULL && reader->bitDepth == 16 ? reader->detail : NULL;
+    z_stream* zstrm = &reader->zstrm;
+    int ret;
+    
+    for(uint32_t i=0;i<nrows;i++){
+        // Inflate one scanline and its filter type byte
+        zstrm->next_out = reader->scanline;
+        zstrm->avail_out = rowlength+1;
+        while(zstrm->avail_out > 0){
+            if(zstrm->avail_in == 0){
+                zstrm->avail_in = readPNGData(reader);
+                zstrm->next_in = reader->input;
+                if(zstrm->avail_in == 0){
+                    printf("Error: PNG image data ends early\n");
+                    exit(-1);
+                }
+            }
+            ret = inflate(zstrm, Z_NO_FLUSH);
+            if(ret == Z_STREAM_END && zstrm->avail_out > 0){
+                printf("Error: PNG image data ends early\n");
+                exit(-1);
+            }
+            if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR){
+                zerr(ret == Z_NEED_DICT ? Z_DATA_ERROR : ret);
+                exit(-1);
+            }
+        }
+        
+        int filtertype = defilterPNGRow(reader->scanline, reader->prior, rowlength, reader->bytesPerPixel);
+        if(filtertype != 0){
+            printf("Error: unknown PNG filter type %d\n", filtertype);
+            exit(-1);
+        }
+        memcpy(reader->prior, reader->scanline+1, rowlength);
+        
+        uint8_t* row = normalizePNGRow(reader->prior, reader->samples, rowdetail, nsample, reader->colorType, reader->bitDepth, 1);
+        unpackPNGRow(row, frame, reader->width, reader->colorType, &reader->palette);
+        frame += 3*(size_t) reader->width;
+        if(rowdetail != NULL){
+            unpackPNGRow((uint8_t*) rowdetail, (uint8_t*) detail, reader->width, reader->colorType, NULL);
+            detail += 3*(size_t) reader->width;
+        }
+        if(alpha != NULL && hasPNGAlpha(reader->colorType)){
+            unpackPNGAlpha(row, alpha, reader->width, reader->colorType);
+            alpha += reader->width;
+        }
+    }
+}
+
+void closePNGRows(PNGRowReader* reader){
+    (void)inflateEnd(&reader->zstrm);
+    free(reader->input);
+    free(reader->scanline);
+    free(reader->prior);
+    free(reader->samples);
+    free(reader->detail);
+}
+
+uint32_t readPNGData(PNGRowReader* reader){
+    // Read the next piece of compressed image data into reader->input, going on to the next IDAT chunk when needed
+    // Chunks before the first IDAT are skipped apart from PLTE, the IDAT chunks all follow each other
+    // Animated PNGs are not supported, since their frames after the first are in other chunks
+    // Returns the number of bytes read, 0 once there is no more image data
+    // Strips are written as they are read, so a corrupt chunk stops the conversion right here
+    
+    PNGChunk chunk;
+    char message[256];
+    int status = 0;
+    
+    while(reader->chunkleft == 0){
+        if(reader->lastchunk){
+            return 0;
+        }
+        
+        // Read length and type of the next chunk
+        if(fread(chunk.DataLength, 1, 4, reader->fid) < 4 || fread(chunk.Type, 1, 4, reader->fid) < 4){
+            reader->lastchunk = 1;
+            return 0;
+        }
+        chunk.Length = byteswap(chunk.DataLength);
+        if(strncmp(chunk.Type, "IDAT", 4) == 0){
+            if(!reader->idatfound && reader->colorType == 3 && reader->palette.Size == 0){
+                printf("Error: PNG palette image has no PLTE chunk\n");
+                exit(-1);
+            }
+            reader->chunkleft = chunk.Length;
+            reader->idatfound = 1;
+            reader->crc = updatePNGCRC(0, (uint8_t*) chunk.Type, 4);
+            if(chunk.Length == 0){
+                fread(chunk.CRC, 1, 4, reader->fid);
+                status = checkPNGCRC("IDAT", reader->crc, chunk.CRC, message);
+            }
+        }else if(reader->idatfound){
+            reader->lastchunk = 1;
+            return 0;
+        }else if(strncmp(chunk.Type, "PLTE", 4) == 0){
+            status = readPNGPalette(reader->fid, &chunk, &reader->palette, message);
+        }else if(strncmp(chunk.Type, "acTL", 4) == 0){
+            printf("Error: Animated PNGs cannot be read a strip of rows at a time (leave out -l)\n");
+            exit(-1);
+        }else{
+            // Skip the data and CRC of any other chunk
+            status = skipPNGChunk(reader->fid, &chunk, message);
+        }
+        if(status != 0){
+            printf("%s", message);
+            exit(-1);
+        }
+    }
+    
+    uint32_t n = reader->chunkleft < PNGROW_INPUTSIZE ? reader->chunkleft : PNGROW_INPUTSIZE;
+    n = (uint32_t) fread(reader->input, 1, n, reader->fid);
+    if(n == 0){
+        reader->lastchunk = 1;
+    }
+    reader->chunkleft -= n;
+    
+    // Check the chunk once its last byte has been read, which for chunks of up to PNGROW_INPUTSIZE bytes is before
+    // any of it is inflated
+    reader->crc = updatePNGCRC(reader->crc, reader->input, n);
+    if(reader->chunkleft == 0 && n > 0){
+        uint8_t stored[4];
+        fread(stored, 1, 4, reader->fid);
+        if(checkPNGCRC("IDAT", reader->crc, stored, message) != 0){
+            printf("%s", message);
+            exit(-1);
+        }
+    }
+    
+    return n;
+}
+
+int defilterPNGRow(uint8_t* scanline, uint8_t* prior, size_t length, uint8_t bytesPerPixel){
+    // Defilter one scanline in place, scanline starts with the filter type byte and prior is the defiltered scanline above
+    // Each byte is predicted from the same byte of the pixel before it, so alpha only affects alpha
+    // Returns the filter type if PNG does not define it, 0 otherwise
+    
+    uint8_t filtertype = scanline[0];
+    uint8_t* x = scanline+1;
+    size_t i;
+    
+    switch(filtertype){
+        case 0:  // None: Recon(x) = Filt(x)
+            break;
+        case 1:  // Sub:  Recon(x) = Filt(x) + Recon(a)
+            for(i=bytesPerPixel;i<length;i++){
+                x[i] += x[i-bytesPerPixel];
+            }
+            break;
+        case 2:  // Up:   Recon(x) = Filt(x) + Recon(b)
+            for(i=0;i<length;i++){
+                x[i] += prior[i];
+            }
+            break;
+        case 3:  // Average: Filt(x) + floor((Recon(a) + Recon(b)) / 2)
+            for(i=0;i<bytesPerPixel;i++){
+                x[i] += prior[i] >> 1;
+            }
+            for(;i<length;i++){
+                x[i] += (x[i-bytesPerPixel] + prior[i]) >> 1;
+            }
+            break;
+        case 4:  // Paeth: Filt(x) + PaethPredictor(Recon(a), Recon(b), Recon(c))
+            for(i=0;i<bytesPerPixel;i++){
+                x[i] += PaethPredictor(0, prior[i], 0);
+            }
+            for(;i<length;i++){
+                x[i] += PaethPredictor(x[i-bytesPerPixel], prior[i], prior[i-bytesPerPixel]);
+            }
+            break;
+        default:
+            return filtertype;
+    }
+    return 0;
 }
 
 uint8_t PaethPredictor(uint8_t a, uint8_t b, uint8_t c){
@@ -376,47 +1346,53 @@ int byteswap(uint8_t* bytes){
  invalid or incomplete, Z_VERSION_ERROR if the version of zlib.h and
  the version of the library linked do not match, or Z_ERRNO if there
  is an error reading or writing the files. */
-uint32_t inflateData(z_stream *zstrm, uint8_t *source, uint32_t sourcelen, uint8_t *dest, uint32_t destlen)
+size_t inflateData(z_stream *zstrm, uint8_t *source, size_t sourcelen, uint8_t *dest, size_t destlen)
 {
     int ret;
-    uint32_t have;
-        
-        zstrm->avail_in = sourcelen;
-        zstrm->next_in = source;
-        
-        /* run inflate() on input until output buffer not full */
-        do {
+    size_t inleft = sourcelen;  // Not yet handed to zlib, which takes at most ZLIB_MAXLEN bytes at a time
+    size_t outleft = destlen;
+    
+    zstrm->avail_in = 0;
+    zstrm->next_in = source;
+    zstrm->avail_out = 0;
+    zstrm->next_out = dest;
+    
+    /* run inflate() on input until output buffer full or stream ends */
+    do {
+        if (zstrm->avail_in == 0 && inleft > 0) {
+            zstrm->avail_in = inleft < ZLIB_MAXLEN ? (uInt) inleft : ZLIB_MAXLEN;
+            inleft -= zstrm->avail_in;
+        }
+        if (zstrm->avail_out == 0 && outleft > 0) {
+            zstrm->avail_out = outleft < ZLIB_MAXLEN ? (uInt) outleft : ZLIB_MAXLEN;
+            outleft -= zstrm->avail_out;
+        }
 #if DEBUG_INFLATE
-            printf("destlen=%d\n", destlen);
+        printf("outleft=%zu\n", outleft);
 #endif
-            zstrm->avail_out = destlen;
-            zstrm->next_out = dest;
-            ret = inflate(zstrm, Z_NO_FLUSH);
-            assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-            
-            have = destlen - zstrm->avail_out;
-            
-            switch (ret) {
-                case Z_NEED_DICT:
-                    ret = Z_DATA_ERROR;     /* and fall through */
-                case Z_DATA_ERROR:
-                case Z_MEM_ERROR:
-                    zerr(ret);
-                    return 0;
-                case Z_STREAM_END:
+        ret = inflate(zstrm, Z_NO_FLUSH);
+        assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+        
+        switch (ret) {
+            case Z_NEED_DICT:
+                ret = Z_DATA_ERROR;     /* and fall through */
+            case Z_DATA_ERROR:
+            case Z_MEM_ERROR:
+                zerr(ret);
+                return 0;
+            case Z_STREAM_END:
 #if DEBUG_INFLATE
-                    printf("Z_STREAM_END reached\n");
+                printf("Z_STREAM_END reached\n");
 #endif
-                    return have;
-            }
+                break;
+        }
 #if DEBUG_INFLATE
-            printf("strm.avail_in=%d\n", zstrm->avail_in);
-            printf("strm.avail_out=%d\n", zstrm->avail_out);
-            printf("strm.total_out=%lu\n", zstrm->total_out);
+        printf("strm.avail_in=%d\n", zstrm->avail_in);
+        printf("strm.avail_out=%d\n", zstrm->avail_out);
 #endif
-        } while (zstrm->avail_out == 0);
+    } while (ret != Z_STREAM_END && ret != Z_BUF_ERROR && (zstrm->avail_out > 0 || outleft > 0));
     
-    return have;
+    return (size_t) (zstrm->next_out - dest);
 }
 
 /* report a zlib or i/o error */
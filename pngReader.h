@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <zlib.h>
+#include "allocate.h"
 
 typedef struct _PNGHeader {
     uint32_t Width;
@@ -40,6 +41,44 @@ typedef struct _PNGHeader {
     uint8_t Interlace;
 } PNGHeader;
 
+typedef struct _PNGPass {
+    // Pixels of one pass of the image data: width x height of them, from (x0,y0) every dx columns and dy rows
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t dx;
+    uint32_t dy;
+    uint32_t width;
+    uint32_t height;
+} PNGPass;
+
+typedef struct _PNGPalette {
+    uint16_t Size;      // Number of colors
+    uint8_t RGB[768];   // Colors of the PLTE chunk, or the gray levels of a grayscale image, zeros past Size
+} PNGPalette;
+
+typedef struct _PNGFrameControl {
+    // Frame control (fcTL) of one frame of an animated PNG, or the whole image of one that is not animated
+    uint32_t width;     // Size of the frame, which covers this rectangle of the image from (x,y)
+    uint32_t height;
+    uint32_t x;
+    uint32_t y;
+    uint16_t delaynum;  // Frame delay is delaynum/delayden seconds, a delayden of 0 meaning 1/100 s
+    uint16_t delayden;
+    uint8_t dispose;    // What happens to the frame's rectangle before the next frame: 0 none, 1 background, 2 previous
+    uint8_t blend;      // How the frame goes onto the image: 0 replaces its rectangle, 1 is alpha blended over it
+} PNGFrameControl;
+
+typedef struct _PNGAnimation {
+    // Where readPNGFrame is in an animated PNG, kept between the frames, which are read one per call
+    int animated;             // Set once the animation control (acTL) chunk has been read
+    uint32_t nframes;         // Number of frames and of times the animation plays, 0 for forever, from acTL
+    uint32_t nplays;
+    PNGFrameControl control;  // Frame control of the frame just read
+    int hasnext;              // Set if the frame control of another frame follows, in next
+    PNGFrameControl next;
+    PNGPalette palette;       // Colors of the PLTE chunk, which comes once before the first frame
+} PNGAnimation;
+
 typedef struct _PNGChunk
 {
     uint8_t DataLength[4];   /* Size of Data field in bytes */
@@ -49,13 +88,73 @@ typedef struct _PNGChunk
     uint8_t CRC[4];          /* CRC-32 value of the Type and Data fields */
 } PNGChunk;
 
-void readPNGHeader(FILE* fid, PNGHeader *header);
-void readPNGFrame(FILE* fid, uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel);
-void readPNGChunk(FILE* fid, PNGChunk *chunk);
-void defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel);
+// Largest number of bytes handed to zlib at a time, since its lengths are 32-bit
+#define ZLIB_MAXLEN (1u << 30)
+// Bytes of compressed image data read from the file at a time by the row reader, and by readPNGFrame between CRC updates
+#define PNGROW_INPUTSIZE 65536
+
+// What to do when the CRC stored after a chunk does not match its data
+// CRCStrict: stop with an error (default)
+// CRCWarn: print a warning and use the chunk anyway
+// CRCOff: do not compute CRCs at all
+enum _CRCChecks {CRCStrict, CRCWarn, CRCOff};
+
+typedef struct _PNGRowReader {
+    // Reads the image a few rows at a time, so that only two scanlines are ever decoded at once
+    FILE* fid;
+    uint32_t width;
+    uint8_t colorType;
+    uint8_t bitDepth;
+    uint8_t bytesPerPixel;
+    size_t rowlength;     // Bytes of a defiltered scanline
+    PNGPalette palette;   // Colors of palette images, read from the PLTE chunk before the first IDAT
+    z_stream zstrm;
+    uint8_t* input;       // Compressed image data
+    uint32_t chunkleft;   // Bytes of the current IDAT chunk still to be read
+    int idatfound;        // Set once the first IDAT chunk has been found
+    int lastchunk;        // Set once the IDAT chunks have all been read
+    uint32_t crc;         // CRC of the current chunk so far
+    uint8_t* scanline;    // Filter type byte followed by the scanline
+    uint8_t* prior;       // Previous defiltered scanline, zeros above the image
+    uint8_t* samples;     // Scanline with a byte per sample, for images that are not 8-bit
+    int8_t* detail;       // What the samples of 16-bit images were rounded by
+} PNGRowReader;
+
+void setPNGCRCCheck(enum _CRCChecks check);
+uint32_t updatePNGCRC(uint32_t crc, const uint8_t* data, size_t length);
+int checkPNGCRC(const char* type, uint32_t crc, const uint8_t* stored, char* message);
+int readPNGHeader(FILE* fid, PNGHeader *header, char* message);
+int checkPNGFormat(PNGHeader* header, char* message);
+uint8_t getPNGChannels(uint8_t colorType);
+int hasPNGAlpha(uint8_t colorType);
+uint8_t getPNGBytesPerPixel(PNGHeader* header);
+size_t getPNGRowBytes(PNGHeader* header, uint32_t width);
+int getPNGPasses(PNGHeader* header);
+void getPNGPass(PNGHeader* header, int pass, PNGPass* p);
+size_t getPNGRawSize(PNGHeader* header);
+int readPNGFrame(FILE* fid, PNGHeader* header, PNGAnimation* anim, uint8_t* frame, PNGPalette* palette, int8_t* detail, uint8_t* alpha, ScratchBuffer* idat, char* message);
+int inflatePNGRow(z_stream* zstrm, uint8_t* scanline, size_t length, size_t* inleft);
+int readPNGChunk(FILE* fid, PNGChunk *chunk, char* message);
+int skipPNGChunk(FILE* fid, PNGChunk* chunk, char* message);
+int readPNGPalette(FILE* fid, PNGChunk* chunk, PNGPalette* palette, char* message);
+int readPNGFrameControl(FILE* fid, PNGChunk* chunk, PNGHeader* header, PNGFrameControl* control, char* message);
+int findPNGChunk(FILE* fid, const char* type);
+int defilterPNGFrame(uint32_t width, uint32_t height, uint8_t* frame, uint8_t bytesPerPixel, uint8_t* alpha);
+void unpackPNGRow(uint8_t* row, uint8_t* rgb, uint32_t width, uint8_t colorType, PNGPalette* palette);
+uint8_t unpackPNGIndices(uint8_t* row, uint8_t* indices, uint32_t width, uint8_t colorType);
+void unpackPNGAlpha(uint8_t* row, uint8_t* alpha, uint32_t width, uint8_t colorType);
+void scatterPNGPixels(const uint8_t* pixels, uint8_t* row, uint32_t n, size_t pixelbytes, uint8_t step);
+uint8_t* normalizePNGRow(uint8_t* row, uint8_t* samples, int8_t* detail, size_t nsample, uint8_t colorType, uint8_t bitDepth, int scalegray);
+void expandPNGBits(const uint8_t* row, uint8_t* samples, size_t nsample, uint8_t bitDepth, int scale);
+void convertPNG16Row(const uint8_t* row, uint8_t* samples, int8_t* detail, size_t nsample);
+void openPNGRows(PNGRowReader* reader, FILE* fid, PNGHeader* header);
+void readPNGRows(PNGRowReader* reader, uint8_t* frame, int8_t* detail, uint8_t* alpha, uint32_t nrows);
+void closePNGRows(PNGRowReader* reader);
+uint32_t readPNGData(PNGRowReader* reader);
+int defilterPNGRow(uint8_t* scanline, uint8_t* prior, size_t length, uint8_t bytesPerPixel);
 uint8_t PaethPredictor(uint8_t a, uint8_t b, uint8_t c);
 int byteswap(uint8_t* bytes);
-uint32_t inflateData(z_stream *zstrm, uint8_t *source, uint32_t sourcelen, uint8_t *dest, uint32_t destlen);
+size_t inflateData(z_stream *zstrm, uint8_t *source, size_t sourcelen, uint8_t *dest, size_t destlen);
 void zerr(int ret);
 
 #endif
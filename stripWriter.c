@@ -0,0 +1,215 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "stripWriter.h"
+#include "lzwStream.h"
+#include "dither.h"
+#include "palette.h"
+#include "allocate.h"
+
+#define DEBUG 0
+
+
+int isLargePNG(char* filename, int keepindices){
+    // Returns non-zero if the PNG has too many pixels to be encoded as one image in memory
+    // With keepindices, palette and grayscale PNGs are always read whole so that they keep their own colors
+    PNGHeader header;
+    char message[256];
+    FILE* fid = fopen(filename, "rb");
+    if(fid == NULL){
+        return 0;
+    }
+    // Files whose header cannot be read are left to the frame reader to report
+    if(readPNGHeader(fid, &header, message) != 0){
+        fclose(fid);
+        return 0;
+    }
+    // Animated PNGs have a frame per call of readPNGFrame, so they are read whole too
+    int animated = findPNGChunk(fid, "acTL");
+    fclose(fid);
+    if(animated || (keepindices && header.ColorType != 2 && header.ColorType != 6)){
+        return 0;
+    }
+    // Interlaced images only have their last rows once the last pass has been read, so they are always read whole
+    if(header.Interlace != 0){
+        return 0;
+    }
+    return (uint64_t) header.Width*header.Height > FRAME_MAXPIXELS;
+}
+
+void writeGIFStrips(FILE* fid, char** filenames, int nfile, GIFOptStruct gifopts){
+    // Write the header and all frames of a GIF with a global color table palette, reading the PNGs a strip of rows at a time
+    // Only the indices of the previous frame are needed for the transparent index, those are kept in temporary files
+    
+    PNGHeader header;
+    PNGRowReader reader;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    FILE* lastindices = NULL;
+    FILE* indices = NULL;
+    char message[256];
+    
+    // Frames with alpha are cleared before the next one instead, see writeGIFStripFrame
+    if(nfile > 1 && hasTransparentIndex(gifopts) && gifopts.alphathreshold == 0){
+        lastindices = tmpfile();
+        indices = tmpfile();
+        if(lastindices == NULL || indices == NULL){
+            printf("Error: Could not create a temporary file for the frame indices. Exiting.\n");
+            exit(-1);
+        }
+    }
+    
+    for(int i=0; i<nfile; i++){
+        printf("pngfilename=%s\n", filenames[i]);
+        FILE* pngfid = fopen(filenames[i], "rb");
+        
+        // Get png header and make sure the frame is the same size
+        // Check for supported PNG formats
+        if(readPNGHeader(pngfid, &header, message) != 0 || checkPNGFormat(&header, message) != 0){
+            printf("%s", message);
+            exit(-1);
+        }
+        if(header.Interlace != 0){
+            printf("Error: %s is interlaced, which cannot be read a strip at a time (leave out -l)\n", filenames[i]);
+            exit(-1);
+        }
+        if(i == 0){
+            width = header.Width;
+            height = header.Height;
+            
+            writeGIFHeader(fid, width, height, gifopts);
+            
+            // If more than one frame then write the application extension to enable looping animations
+            if(nfile > 1){
+                writeGIFAppExtension(fid);
+            }
+        }else if(header.Width != width || header.Height != height){
+            printf("Error: All PNG frames must be the same size (%ix%i expected, %ix%i found)\n", width, height, header.Width, header.Height);
+            exit(-1);
+        }
+        
+        openPNGRows(&reader, pngfid, &header);
+        writeGIFStripFrame(fid, &reader, lastindices, indices, width, height, gifopts, i == 0);
+        closePNGRows(&reader);
+        fclose(pngfid);
+        
+        // Send each frame on as soon as it is encoded
+        fflush(fid);
+        
+        // This frame's indices are compared against by the next frame
+        if(indices != NULL){
+            FILE* tmp = lastindices;
+            lastindices = indices;
+            indices = tmp;
+            rewind(lastindices);
+            rewind(indices);
+        }
+    }
+    
+    if(indices != NULL){
+        fclose(indices);
+        fclose(lastindices);
+    }
+}
+
+void writeGIFStripFrame(FILE* fid, PNGRowReader* reader, FILE* lastindices, FILE* indices, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame){
+    // Write one frame, STRIP_ROWS rows at a time: read, palettize or dither, then LZW encode each strip before the next is read
+    // Without dithering this gives exactly the same image as writeGIFImage
+    // lastindices holds the indices of the previous frame, indices gets the indices of this one (both NULL if not needed)
+    
+    int npalette = getPaletteSize(gifopts);
+    int transparent = isFirstFrame == 0 && lastindices != NULL;
+    uint8_t* strip = reserveScratch(&gifopts.scratch->strip, checkedSize(3*(size_t) width, STRIP_ROWS));
+    uint8_t* laststrip = NULL;
+    float* residual = NULL;
+    int8_t* detail = NULL;
+    uint8_t* alpha = NULL;
+    LZWStream stream;
+    
+    if(transparent){
+        laststrip = reserveScratch(&gifopts.scratch->laststrip, checkedSize(width, STRIP_ROWS));
+    }
+    if(gifopts.dither > 0){
+        printf("Dithering the frame\n");
+        residual = reserveScratch(&gifopts.scratch->residual, 6*(size_t) width*sizeof(float));
+        memset(residual, 0, 6*(size_t) width*sizeof(float));
+        if(reader->bitDepth == 16){
+            detail = reserveScratch(&gifopts.scratch->detail, checkedSize(3*(size_t) width, STRIP_ROWS));
+        }
+    }
+    
+    if(gifopts.alphathreshold > 0 && hasPNGAlpha(reader->colorType)){
+        alpha = reserveScratch(&gifopts.scratch->alpha, checkedSize(width, STRIP_ROWS));
+    }
+    
+    writeGIFImageDescriptor(fid, 0, width, height, gifopts, getTransparentIndex(gifopts, getPaletteBits(gifopts)));
+    fputc(0x00, fid);  // No local color table
+    
+    if(isFirstFrame && gifopts.paletteout != NULL){
+        writePaletteFile(gifopts.paletteout, gifopts.palette, npalette, hasTransparentIndex(gifopts));
+    }
+    
+    printf("Writing gif frame data\n");
+    startLZWStream(&stream, fid, getPaletteBits(gifopts), &gifopts.scratch->lzw);
+    stream.clearpolicy = gifopts.clearpolicy;
+    setLZWLossy(&stream, gifopts.palette, npalette, gifopts.lossy);
+    
+    for(uint32_t top=0; top<height; top+=STRIP_ROWS){
+        uint32_t nrows = (height-top) < STRIP_ROWS ? (height-top) : STRIP_ROWS;
+        size_t npixel = (size_t) width*nrows;
+#if DEBUG
+        printf("Strip at row %u, %u rows\n", top, nrows);
+#endif
+        
+        readPNGRows(reader, strip, detail, alpha, nrows);
+        
+        // Replace the RGB strip with its indices
+        if(gifopts.dither > 0){
+            ditherRows(gifopts.palette, npalette, strip, width, nrows, residual, detail, alpha, gifopts.alphathreshold);
+        }else{
+            palettizeFrame(strip, npixel, gifopts.palette, npalette);
+        }
+        if(alpha != NULL){
+            setAlphaTransparent(strip, alpha, npixel, gifopts.alphathreshold, 0xff);
+        }
+        
+        // Replace indices that are equal to the last frame with the transparent index
+        if(transparent){
+            if(fread(laststrip, 1, npixel, lastindices) != npixel){
+                printf("Error: Could not read the indices of the previous frame. Exiting.\n");
+                exit(-1);
+            }
+            setTransparent(strip, laststrip, npixel);
+        }
+        if(indices != NULL){
+            fwrite(strip, 1, npixel, indices);
+        }
+        
+        writeLZWStream(&stream, strip, npixel);
+    }
+    
+    finishLZWStream(&stream);
+}
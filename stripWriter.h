@@ -0,0 +1,42 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _STRIPWRITER_H_
+#define _STRIPWRITER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "gifWriter.h"
+#include "pngReader.h"
+
+// Rows of the image that are read, palettized and LZW encoded at a time
+// Memory use is about 4*width*STRIP_ROWS bytes, however tall the image is
+#define STRIP_ROWS 256
+
+int isLargePNG(char* filename, int keepindices);
+void writeGIFStrips(FILE* fid, char** filenames, int nfile, GIFOptStruct gifopts);
+void writeGIFStripFrame(FILE* fid, PNGRowReader* reader, FILE* lastindices, FILE* indices, uint32_t width, uint32_t height, GIFOptStruct gifopts, int isFirstFrame);
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Stand-alone GIF decoder used by the regression tests
+// Decodes every frame of a GIF with its own LZW decoder, composites it onto the logical screen and writes the RGB canvas of each frame to stdout
+// With -p, the decoded frames are instead compared pixel by pixel against the given PNG files
+// Any malformed data (bad codes, wrong pixel counts, missing blocks) is reported and gives a non-zero exit status
+
+#include <string.h>
+#include <getopt.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "../pngReader.h"
+
+#define MAXCODESIZE 12
+#define MAXREF 4096
+
+typedef struct _GIFDecoder {
+    FILE* fid;
+    uint32_t width;
+    uint32_t height;
+    uint8_t gct[768];
+    int gctsize;
+    uint8_t background;
+    // Graphics control extension state for the next image
+    int disposal;
+    int transparent;
+    uint8_t transparentindex;
+    // Rectangle of the last drawn image, which its disposal applies to
+    uint32_t imageleft;
+    uint32_t imagetop;
+    uint32_t imagewidth;
+    uint32_t imageheight;
+    // Canvas and the copy used for "restore to previous" disposal
+    uint8_t* canvas;
+    uint8_t* previous;
+} GIFDecoder;
+
+void decodeError(const char* message){
+    fprintf(stderr, "gifDecode: %s\n", message);
+    exit(1);
+}
+
+int readByte(FILE* fid){
+    int c = getc(fid);
+    if(c == EOF){
+        decodeError("unexpected end of file");
+    }
+    return c;
+}
+
+uint32_t readShort(FILE* fid){
+    // GIF values are little endian
+    uint32_t lo = readByte(fid);
+    uint32_t hi = readByte(fid);
+    return lo + (hi << 8);
+}
+
+uint8_t* readSubBlocks(FILE* fid, size_t* length){
+    // Concatenate data sub-blocks until the zero length terminator
+    size_t size = 4096;
+    uint8_t* data = malloc(size);
+    int n;
+    *length = 0;
+    while((n = readByte(fid)) != 0){
+        if(*length + n > size){
+            size *= 2;
+            data = realloc(data, size);
+        }
+        if(fread(&data[*length], 1, n, fid) != (size_t)n){
+            decodeError("unexpected end of file in data sub-block");
+        }
+        *length += n;
+    }
+    return data;
+}
+
+size_t decodeLZW(uint8_t* data, size_t length, int mincodesize, uint8_t* indices, size_t npixel){
+    // Standard variable width GIF LZW decoder
+    // Returns the number of indices decoded, which must match npixel
+    uint16_t prefix[1 << MAXCODESIZE];
+    uint8_t suffix[1 << MAXCODESIZE];
+    uint8_t stack[1 << MAXCODESIZE];
+    int clearcode = 1 << mincodesize;
+    int stopcode = clearcode + 1;
+    int nbits = mincodesize + 1;
+    int nextcode = clearcode + 2;
+    int oldcode = -1;
+    uint8_t firstchar = 0;
+    uint64_t bitbuffer = 0;
+    int nbitbuffer = 0;
+    size_t pos = 0;
+    size_t nout = 0;
+    int stopped = 0;
+    
+    if(mincodesize < 2 || mincodesize > 8){
+        decodeError("invalid LZW minimum code size");
+    }
+    for(int i=0;i<clearcode;i++){
+        prefix[i] = 0;
+        suffix[i] = i;
+    }
+    
+    while(!stopped){
+        // Refill the bit buffer, codes are packed least significant bit first
+        while(nbitbuffer < nbits){
+            if(pos >= length){
+                decodeError("LZW data ended without a stop code");
+            }
+            bitbuffer |= (uint64_t)data[pos++] << nbitbuffer;
+            nbitbuffer += 8;
+        }
+        int code = bitbuffer & ((1 << nbits)-1);
+        bitbuffer >>= nbits;
+        nbitbuffer -= nbits;
+        
+        if(code == clearcode){
+            nbits = mincodesize + 1;
+            nextcode = clearcode + 2;
+            oldcode = -1;
+            continue;
+        }
+        if(code == stopcode){
+            stopped = 1;
+            continue;
+        }
+        if(code > nextcode || (code == nextcode && oldcode < 0)){
+            decodeError("invalid LZW code");
+        }
+        
+        // Unwind the string for this code onto the stack
+        int sp = 0;
+        int cur = code;
+        if(code == nextcode){
+            // KwKwK case, the string is oldcode + first character of oldcode
+            stack[sp++] = firstchar;
+            cur = oldcode;
+        }
+        while(cur >= clearcode){
+            stack[sp++] = suffix[cur];
+            cur = prefix[cur];
+        }
+        stack[sp++] = cur;
+        firstchar = cur;
+        
+        if(nout + sp > npixel){
+            decodeError("LZW data decodes to more pixels than the image holds");
+        }
+        while(sp > 0){
+            indices[nout++] = stack[--sp];
+        }
+        
+        // Add the new string to the table, a full table is kept as is until the next clear code
+        if(oldcode >= 0 && nextcode < (1 << MAXCODESIZE)){
+            prefix[nextcode] = oldcode;
+            suffix[nextcode] = firstchar;
+            nextcode++;
+            if(nextcode == (1 << nbits) && nbits < MAXCODESIZE){
+                nbits++;
+            }
+        }
+        oldcode = code;
+    }
+    
+    return nout;
+}
+
+void readGIFHeader(GIFDecoder* gif){
+    uint8_t head[6];
+    if(fread(head, 1, 6, gif->fid) != 6 || (memcmp(head, "GIF89a", 6) != 0 && memcmp(head, "GIF87a", 6) != 0)){
+        decodeError("not a GIF file");
+    }
+    
+    // Logical screen descriptor
+    gif->width = readShort(gif->fid);
+    gif->height = readShort(gif->fid);
+    int packed = readByte(gif->fid);
+    gif->background = readByte(gif->fid);
+    readByte(gif->fid);  // Pixel aspect ratio
+    if(gif->width == 0 || gif->height == 0){
+        decodeError("logical screen has zero width or height");
+    }
+    
+    gif->gctsize = 0;
+    if(packed & 0x80){
+        gif->gctsize = 1 << ((packed & 0x07)+1);
+        if(fread(gif->gct, 3, gif->gctsize, gif->fid) != (size_t)gif->gctsize){
+            decodeError("unexpected end of file in global color table");
+        }
+    }
+    
+    gif->disposal = 0;
+    gif->transparent = 0;
+    gif->transparentindex = 0;
+    gif->canvas = malloc(sizeof(uint8_t)*3*gif->width*gif->height);
+    gif->previous = malloc(sizeof(uint8_t)*3*gif->width*gif->height);
+    
+    // Start from the background color
+    for(uint32_t i=0;i<gif->width*gif->height;i++){
+        if(gif->background < gif->gctsize){
+            memcpy(&gif->canvas[3*i], &gif->gct[3*gif->background], 3);
+        }else{
+            memset(&gif->canvas[3*i], 0, 3);
+        }
+    }
+}
+
+int readGIFImage(GIFDecoder* gif){
+    // Read blocks up to and including the next image, which is drawn onto the canvas
+    // Returns 0 when the trailer is reached
+    int block;
+    while((block = readByte(gif->fid)) != 0x3B){
+        if(block == 0x21){
+            // Extension
+            int label = readByte(gif->fid);
+            size_t length;
+            uint8_t* data = readSubBlocks(gif->fid, &length);
+            if(label == 0xF9){
+                if(length != 4){
+                    decodeError("invalid graphics control extension");
+                }
+                gif->disposal = (data[0] >> 2) & 0x07;
+                gif->transparent = data[0] & 0x01;
+                gif->transparentindex = data[3];
+            }
+            free(data);
+        }else if(block == 0x2C){
+            // Image descriptor
+            uint32_t left = readShort(gif->fid);
+            uint32_t top = readShort(gif->fid);
+            uint32_t width = readShort(gif->fid);
+            uint32_t height = readShort(gif->fid);
+            int packed = readByte(gif->fid);
+            uint8_t lct[768];
+            uint8_t* table = gif->gct;
+            int tablesize = gif->gctsize;
+            if(left + width > gif->width || top + height > gif->height || width == 0 || height == 0){
+                decodeError("image does not fit in the logical screen");
+            }
+            if(packed & 0x80){
+                tablesize = 1 << ((packed & 0x07)+1);
+                if(fread(lct, 3, tablesize, gif->fid) != (size_t)tablesize){
+                    decodeError("unexpected end of file in local color table");
+                }
+                table = lct;
+            }
+            if(tablesize == 0){
+                decodeError("image has no color table");
+            }
+            
+            // Image data
+            int mincodesize = readByte(gif->fid);
+            size_t length;
+            uint8_t* data = readSubBlocks(gif->fid, &length);
+            size_t npixel = (size_t)width*height;
+            uint8_t* indices = malloc(npixel);
+            if(decodeLZW(data, length, mincodesize, indices, npixel) != npixel){
+                decodeError("LZW data decodes to fewer pixels than the image holds");
+            }
+            
+            // Interlaced images store rows in four passes
+            uint32_t* rows = malloc(sizeof(uint32_t)*height);
+            if(packed & 0x40){
+                uint32_t n = 0;
+                const uint32_t start[4] = {0, 4, 2, 1};
+                const uint32_t step[4] = {8, 8, 4, 2};
+                for(int p=0;p<4;p++){
+                    for(uint32_t j=start[p];j<height;j+=step[p]){
+                        rows[n++] = j;
+                    }
+                }
+            }else{
+                for(uint32_t j=0;j<height;j++){
+                    rows[j] = j;
+                }
+            }
+            
+            // Draw onto the canvas
+            gif->imageleft = left;
+            gif->imagetop = top;
+            gif->imagewidth = width;
+            gif->imageheight = height;
+            memcpy(gif->previous, gif->canvas, sizeof(uint8_t)*3*gif->width*gif->height);
+            for(uint32_t j=0;j<height;j++){
+                for(uint32_t i=0;i<width;i++){
+                    uint8_t index = indices[j*width+i];
+                    if(gif->transparent && index == gif->transparentindex){
+                        continue;
+                    }
+                    if(index >= tablesize){
+                        decodeError("pixel index is outside of the color table");
+                    }
+                    memcpy(&gif->canvas[3*((top+rows[j])*gif->width+left+i)], &table[3*index], 3);
+                }
+            }
+            
+            free(rows);
+            free(indices);
+            free(data);
+            return 1;
+        }else{
+            decodeError("unknown block");
+        }
+    }
+    return 0;
+}
+
+void disposeGIFImage(GIFDecoder* gif){
+    // Apply the disposal method of the last drawn image
+    // Restoring to background only clears the rectangle of the image
+    if(gif->disposal == 2){
+        for(uint32_t j=gif->imagetop;j<gif->imagetop+gif->imageheight;j++){
+            for(uint32_t i=gif->imageleft;i<gif->imageleft+gif->imagewidth;i++){
+                uint8_t* pixel = &gif->canvas[3*((size_t)j*gif->width+i)];
+                if(gif->background < gif->gctsize){
+                    memcpy(pixel, &gif->gct[3*gif->background], 3);
+                }else{
+                    memset(pixel, 0, 3);
+                }
+            }
+        }
+    }else if(gif->disposal == 3){
+        memcpy(gif->canvas, gif->previous, sizeof(uint8_t)*3*gif->width*gif->height);
+    }
+    gif->disposal = 0;
+    gif->transparent = 0;
+}
+
+int compareFrame(GIFDecoder* gif, const char* filename, int frame){
+    // Compare the decoded canvas with a PNG, returns the number of differing pixels
+    PNGHeader header;
+    FILE* fid = fopen(filename, "rb");
+    if(fid == NULL){
+        fprintf(stderr, "gifDecode: cannot open %s\n", filename);
+        exit(1);
+    }
+    char message[256];
+    if(readPNGHeader(fid, &header, message) != 0){
+        fprintf(stderr, "gifDecode: %s: %s", filename, message);
+        exit(1);
+    }
+    if(header.Width != gif->width || header.Height != gif->height){
+        fprintf(stderr, "gifDecode: frame %i size %ix%i does not match %s size %ix%i\n", frame, gif->width, gif->height, filename, header.Width, header.Height);
+        exit(1);
+    }
+    if(checkPNGFormat(&header, message) != 0){
+        fprintf(stderr, "gifDecode: %s: %s", filename, message);
+        exit(1);
+    }
+    uint8_t* png = malloc(sizeof(uint8_t)*4*header.Width*header.Height+header.Height);
+    ScratchBuffer idat = {NULL, 0};
+    if(readPNGFrame(fid, &header, NULL, png, NULL, NULL, NULL, &idat, message) != 0){
+        fprintf(stderr, "gifDecode: %s: %s", filename, message);
+        exit(1);
+    }
+    freeScratch(&idat);
+    fclose(fid);
+    
+    int ndiff = 0;
+    for(uint32_t i=0;i<gif->width*gif->height;i++){
+        if(memcmp(&png[3*i], &gif->canvas[3*i], 3) != 0){
+            ndiff++;
+        }
+    }
+    free(png);
+    return ndiff;
+}
+
+int main(int argc, char **argv){
+    GIFDecoder gif;
+    char* refs[MAXREF];
+    int nref = 0;
+    int ch;
+    
+    while ((ch = getopt(argc, argv, "p:h")) != -1){
+        switch(ch){
+            case 'p':
+                if(nref < MAXREF){
+                    refs[nref++] = optarg;
+                }
+                break;
+            case 'h':
+            default:
+                printf("Usage: %s [-p ref1.png [-p ref2.png ...]] file.gif\n", argv[0]);
+                printf(" Decodes file.gif and writes the RGB canvas of each frame to stdout.\n");
+                printf(" With -p, each frame is compared pixel-exact with the corresponding PNG instead.\n");
+                exit(ch == 'h' ? 0 : 1);
+        }
+    }
+    if(optind != argc-1){
+        decodeError("expected exactly one GIF file");
+    }
+    
+    gif.fid = fopen(argv[optind], "rb");
+    if(gif.fid == NULL){
+        decodeError("cannot open GIF file");
+    }
+    
+    // Raw frames go to stdout, so make sure that it is binary and that the PNG reader messages stay out of it
+    FILE* out = stdout;
+    if(nref > 0){
+        out = NULL;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    
+    readGIFHeader(&gif);
+    
+    int nframe = 0;
+    int ndiff = 0;
+    while(readGIFImage(&gif)){
+        if(out != NULL){
+            fwrite(gif.canvas, 3, gif.width*gif.height, out);
+        }else if(nframe < nref){
+            int n = compareFrame(&gif, refs[nframe], nframe);
+            if(n > 0){
+                fprintf(stderr, "gifDecode: frame %i differs from %s in %i pixels\n", nframe, refs[nframe], n);
+                ndiff++;
+            }
+        }
+        disposeGIFImage(&gif);
+        nframe++;
+    }
+    
+    if(nref > 0 && nframe != nref){
+        fprintf(stderr, "gifDecode: %i frames decoded but %i reference PNGs given\n", nframe, nref);
+        ndiff++;
+    }
+    
+    fclose(gif.fid);
+    free(gif.canvas);
+    free(gif.previous);
+    
+    return ndiff > 0 ? 1 : 0;
+}
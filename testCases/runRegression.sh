@@ -0,0 +1,396 @@
+# MacOS and Linux
+# Byte-exact regression test for the GIF encoder
+# Every test case is converted with every palette and dither option, then both the SHA-256 of the GIF file and the SHA-256
+# of its decoded frames (from the bundled gifDecode LZW decoder) are compared against the goldens in golden.sha256.
+# A GIF that differs only in its file hash decodes to exactly the same pixels, i.e. it is an equivalent encoding.
+# Test cases that have few enough colors are also round-tripped, where the decoded GIF must match the PNG pixel for pixel.
+#
+# Build and run from the top directory with: ./buildme_linux.sh regression
+# Run from the testCases directory with: ./runRegression.sh [--update]
+#  --update rewrites golden.sha256 from the current output, only do this after an intended output change
+# Colors that tie in a sort are ordered by the whole color, so the goldens do not depend on the qsort of the C library
+export PNG2GIF="../png2gif"
+export GIFDECODE="../gifDecode"
+GOLDEN=golden.sha256
+
+if command -v sha256sum > /dev/null; then
+    SHA256="sha256sum"
+else
+    SHA256="shasum -a 256"
+fi
+
+UPDATE=0
+if [ "$1" = "--update" ]; then
+    UPDATE=1
+fi
+
+OUTDIR=$(mktemp -d)
+NEWGOLDEN="$OUTDIR/golden.sha256"
+: > "$NEWGOLDEN"
+NPASS=0
+NFAIL=0
+
+# Record the hashes of one conversion and compare them to the goldens
+check(){
+    name=$1
+    if [ ! -f "$OUTDIR/$name.gif" ]; then
+        echo "FAIL $name: no GIF was written"
+        NFAIL=$((NFAIL+1))
+        return
+    fi
+    filehash=$($SHA256 < "$OUTDIR/$name.gif" | cut -d' ' -f1)
+    if ! $GIFDECODE "$OUTDIR/$name.gif" > "$OUTDIR/$name.rgb"; then
+        echo "FAIL $name: GIF could not be decoded"
+        NFAIL=$((NFAIL+1))
+        return
+    fi
+    pixelhash=$($SHA256 < "$OUTDIR/$name.rgb" | cut -d' ' -f1)
+    rm "$OUTDIR/$name.rgb"
+    echo "$filehash $pixelhash $name" >> "$NEWGOLDEN"
+    
+    if [ $UPDATE -eq 1 ]; then
+        return
+    fi
+    golden=$(grep " $name\$" $GOLDEN)
+    if [ -z "$golden" ]; then
+        echo "FAIL $name: no golden"
+        NFAIL=$((NFAIL+1))
+    elif [ "$golden" = "$filehash $pixelhash $name" ]; then
+        NPASS=$((NPASS+1))
+    elif [ "$(echo $golden | cut -d' ' -f2)" = "$pixelhash" ]; then
+        echo "FAIL $name: file differs but decodes to identical pixels (equivalent encoding)"
+        NFAIL=$((NFAIL+1))
+    else
+        echo "FAIL $name: decoded pixels differ"
+        NFAIL=$((NFAIL+1))
+    fi
+}
+
+# Check that a GIF decodes to exactly the pixels of its PNG frames
+roundtrip(){
+    name=$1
+    shift
+    refs=""
+    for f in "$@"; do
+        refs="$refs -p $f"
+    done
+    if $GIFDECODE $refs "$OUTDIR/$name.gif" > /dev/null; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL $name: round trip is not pixel-exact"
+        NFAIL=$((NFAIL+1))
+    fi
+}
+
+PALETTES="685g 676g 884 web median wu octree gray grayT"
+IMAGES="file1b file1c file1d file1e file1f file1f_full file1g file1h file1i"
+MOVIE="movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png movie/file1a_f-06.png movie/file1a_f-07.png movie/file1a_f-08.png movie/file1a_f-09.png movie/file1a_f-10.png movie/file1a_f-11.png movie/file1a_f-12.png"
+
+# Single frames with every palette, with and without dithering
+for image in $IMAGES; do
+    for palette in $PALETTES; do
+        $PNG2GIF -s -c $palette "$OUTDIR/${image}_$palette.gif" $image.png
+        check ${image}_$palette
+        $PNG2GIF -s -d -c $palette "$OUTDIR/${image}_${palette}_d.gif" $image.png
+        check ${image}_${palette}_d
+    done
+    # Smaller tables and forced black and white
+    $PNG2GIF -s -c gray -n 2 "$OUTDIR/${image}_gray_n2.gif" $image.png
+    check ${image}_gray_n2
+    $PNG2GIF -s -c median -n 4 "$OUTDIR/${image}_median_n4.gif" $image.png
+    check ${image}_median_n4
+    $PNG2GIF -s -d -f -n 1 "$OUTDIR/${image}_bw_d.gif" $image.png
+    check ${image}_bw_d
+    # k-means refined palette
+    $PNG2GIF -s -c median -k 4 "$OUTDIR/${image}_median_k4.gif" $image.png
+    check ${image}_median_k4
+    # Strip encoding, dithered against the palette colors
+    $PNG2GIF -s -l -d -c 685g "$OUTDIR/${image}_strips_d.gif" $image.png
+    check ${image}_strips_d
+    # Lossy LZW
+    $PNG2GIF -s -c median -q 30 "$OUTDIR/${image}_median_q30.gif" $image.png
+    check ${image}_median_q30
+    # LZW bands encoded on separate threads
+    $PNG2GIF -s -c median -b 3 "$OUTDIR/${image}_median_b3.gif" $image.png
+    check ${image}_median_b3
+done
+
+# Animation
+for palette in $PALETTES; do
+    $PNG2GIF -s -t 0.02 -c $palette "$OUTDIR/movie_$palette.gif" $MOVIE
+    check movie_$palette
+done
+$PNG2GIF -s -t 0.02 -d -c median "$OUTDIR/movie_median_d.gif" $MOVIE
+check movie_median_d
+$PNG2GIF -s -t 0.02 -c 685g -q 60 "$OUTDIR/movie_685g_q60.gif" $MOVIE
+check movie_685g_q60
+# Clear code policies that keep the full string table
+for policy in adaptive never; do
+    $PNG2GIF -s -t 0.02 -c median -x $policy "$OUTDIR/movie_median_$policy.gif" $MOVIE
+    check movie_median_$policy
+done
+# Runs of one index with small tables
+$PNG2GIF -s -t 0.02 -c gray -n 1 -x adaptive "$OUTDIR/movie_gray_n1_adaptive.gif" $MOVIE
+check movie_gray_n1_adaptive
+$PNG2GIF -s -t 0.02 -c median -n 4 -b 3 "$OUTDIR/movie_median_n4_b3.gif" $MOVIE
+check movie_median_n4_b3
+
+# Palette, grayscale and gray with alpha PNGs, which keep their own colors unless a palette is given
+# These include 1, 2 and 16-bit images, and rows that end part way through a byte
+SMALLPNGS="file1e_plte8 file1g_gray8 file1i_graya8 file1g_plte1 file1c_gray2 file1e_gray16"
+for image in $SMALLPNGS; do
+    $PNG2GIF -s "$OUTDIR/$image.gif" $image.png
+    check $image
+    $PNG2GIF -s -c median "$OUTDIR/${image}_median.gif" $image.png
+    check ${image}_median
+done
+
+# 16-bit RGB and RGBA PNGs, which round to the 8-bit images they were made from and are dithered from all 16 bits
+for image in file1h_rgb16 file1i_rgba16; do
+    $PNG2GIF -s -c median "$OUTDIR/${image}_median.gif" $image.png
+    $PNG2GIF -s -l -c 685g "$OUTDIR/${image}_strips.gif" $image.png
+    $PNG2GIF -s -d -c median "$OUTDIR/${image}_median_d.gif" $image.png
+    check ${image}_median_d
+    $PNG2GIF -s -l -d -c 685g "$OUTDIR/${image}_strips_d.gif" $image.png
+    check ${image}_strips_d
+done
+
+# Adam7 interlaced PNGs, compared below with the PNGs they were made from
+for image in file1h_adam7 file1i_adam7; do
+    $PNG2GIF -s -c median "$OUTDIR/${image}_median.gif" $image.png
+    $PNG2GIF -s -d -c wu "$OUTDIR/${image}_wu_d.gif" $image.png
+done
+
+# PNGs with alpha, whose transparent pixels hold leftover colors that must not take up palette entries
+for palette in 685g 884 median wu octree; do
+    $PNG2GIF -s -a 128 -c $palette "$OUTDIR/file1j_sprite_$palette.gif" file1j_sprite.png
+    check file1j_sprite_$palette
+    $PNG2GIF -s -a 128 -d -c $palette "$OUTDIR/file1j_sprite_${palette}_d.gif" file1j_sprite.png
+    check file1j_sprite_${palette}_d
+done
+$PNG2GIF -s -a 128 -t 0.1 -c median "$OUTDIR/file1j_anim_median.gif" file1j_sprite.png file1j_sprite2.png
+check file1j_anim_median
+$PNG2GIF -s -a 128 -t 0.1 -c 685g "$OUTDIR/file1j_anim_685g.gif" file1j_sprite.png file1j_sprite2.png
+check file1j_anim_685g
+$PNG2GIF -s -a 128 -c median "$OUTDIR/file1j_spritega_median.gif" file1j_spritega.png
+check file1j_spritega_median
+
+# Animated PNGs, whose frames after the first only cover the rectangle that changed, or that clear their frames afterwards
+for palette in median 685g; do
+    $PNG2GIF -s -c $palette "$OUTDIR/movie_apng_$palette.gif" movie/file1a_apng.png
+    check movie_apng_$palette
+done
+$PNG2GIF -s -a 128 -c median "$OUTDIR/file1k_sprites_median.gif" file1k_sprites.png
+check file1k_sprites_median
+
+# Lossless round trips (these all have no more than 256 colors)
+if [ $UPDATE -eq 0 ]; then
+    for image in file1b file1c file1d file1e; do
+        roundtrip ${image}_median $image.png
+    done
+    for image in $SMALLPNGS; do
+        roundtrip $image $image.png
+    done
+    for image in file1h_rgb16 file1i_rgba16; do
+        if cmp -s "$OUTDIR/${image}_median.gif" "$OUTDIR/${image%_*}_median.gif" && cmp -s "$OUTDIR/${image}_strips.gif" "$OUTDIR/${image%_*}_685g.gif"; then
+            NPASS=$((NPASS+1))
+        else
+            echo "FAIL $image: 16-bit PNG differs from the 8-bit PNG it rounds to"
+            NFAIL=$((NFAIL+1))
+        fi
+    done
+    for image in file1h_adam7 file1i_adam7; do
+        if cmp -s "$OUTDIR/${image}_median.gif" "$OUTDIR/${image%_*}_median.gif" && cmp -s "$OUTDIR/${image}_wu_d.gif" "$OUTDIR/${image%_*}_wu_d.gif"; then
+            NPASS=$((NPASS+1))
+        else
+            echo "FAIL $image: interlaced PNG differs from the progressive PNG it was made from"
+            NFAIL=$((NFAIL+1))
+        fi
+    done
+    # Transparent pixels show the white background of the adaptive palettes, frame after frame
+    for palette in median wu octree; do
+        roundtrip file1j_sprite_$palette file1j_sprite_ref.png
+    done
+    roundtrip file1j_sprite_median_d file1j_sprite_ref.png
+    roundtrip file1j_anim_median file1j_sprite_ref.png file1j_sprite2_ref.png
+    # Alpha is read the same from 16-bit and interlaced PNGs and in strips, and leaves the leftover colors out of the palette
+    $PNG2GIF -s -a 128 -c median "$OUTDIR/file1j_sprite16_median.gif" file1j_sprite16.png
+    $PNG2GIF -s -a 128 -c median "$OUTDIR/file1j_sprite_adam7_median.gif" file1j_sprite_adam7.png
+    $PNG2GIF -s -a 128 -l -c 685g "$OUTDIR/file1j_sprite_strips.gif" file1j_sprite.png
+    $PNG2GIF -s -a 128 -l -c 685g "$OUTDIR/file1j_sprite16_strips.gif" file1j_sprite16.png
+    $PNG2GIF -s -c median "$OUTDIR/file1j_sprite_noalpha.gif" file1j_sprite.png
+    if cmp -s "$OUTDIR/file1j_sprite16_median.gif" "$OUTDIR/file1j_sprite_median.gif" && cmp -s "$OUTDIR/file1j_sprite_adam7_median.gif" "$OUTDIR/file1j_sprite_median.gif" \
+        && cmp -s "$OUTDIR/file1j_sprite_strips.gif" "$OUTDIR/file1j_sprite_685g.gif" && cmp -s "$OUTDIR/file1j_sprite16_strips.gif" "$OUTDIR/file1j_sprite_685g.gif" \
+        && [ $(wc -c < "$OUTDIR/file1j_sprite_median.gif") -lt $(wc -c < "$OUTDIR/file1j_sprite_noalpha.gif") ]; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL file1j_sprite: alpha read differently from 16-bit or interlaced PNGs or in strips, or it did not shrink the GIF"
+        NFAIL=$((NFAIL+1))
+    fi
+    # Interlaced PNGs cannot be read in strips, which must be an error rather than a broken GIF
+    if $PNG2GIF -s -l -c 685g "$OUTDIR/file1h_adam7_strips.gif" file1h_adam7.png; then
+        echo "FAIL file1h_adam7_strips: interlaced PNG was read in strips"
+        NFAIL=$((NFAIL+1))
+    else
+        NPASS=$((NPASS+1))
+    fi
+    # A palette PNG given a palette is converted just like the truecolor PNG it was made from
+    if cmp -s "$OUTDIR/file1e_plte8_median.gif" "$OUTDIR/file1e_median.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL file1e_plte8_median: palette PNG differs from truecolor PNG with the same pixels"
+        NFAIL=$((NFAIL+1))
+    fi
+    $PNG2GIF -s -t 0.02 -c median "$OUTDIR/movie_roundtrip.gif" movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    roundtrip movie_roundtrip movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    $PNG2GIF -s -t 0.02 -c median -b 4 "$OUTDIR/movie_roundtrip_b4.gif" movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    roundtrip movie_roundtrip_b4 movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    for policy in adaptive never; do
+        $PNG2GIF -s -t 0.02 -c median -x $policy "$OUTDIR/movie_roundtrip_$policy.gif" movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+        roundtrip movie_roundtrip_$policy movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    done
+    
+    # Each frame of an animated PNG is drawn where its frame control puts it, and takes its delay from it unless one is given
+    roundtrip movie_apng_median movie/file1a_f-01.png movie/file1a_f-02.png movie/file1a_f-03.png movie/file1a_f-04.png movie/file1a_f-05.png
+    roundtrip file1k_sprites_median file1k_sprites_ref1.png file1k_sprites_ref2.png file1k_sprites_ref3.png
+    $PNG2GIF -s -t 0.02 -c median "$OUTDIR/movie_apng_t.gif" movie/file1a_apng.png
+    $PNG2GIF -s -t 0.05 -c median "$OUTDIR/movie_apng_t5.gif" movie/file1a_apng.png
+    if cmp -s "$OUTDIR/movie_apng_t.gif" "$OUTDIR/movie_apng_median.gif" && ! cmp -s "$OUTDIR/movie_apng_t5.gif" "$OUTDIR/movie_apng_median.gif" \
+        && [ $(wc -c < "$OUTDIR/movie_apng_median.gif") -lt $(wc -c < "$OUTDIR/movie_roundtrip.gif") ]; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL movie_apng: frame delays not taken from the animated PNG, or its frame rectangles did not shrink the GIF"
+        NFAIL=$((NFAIL+1))
+    fi
+    if $PNG2GIF -s -l -c 685g "$OUTDIR/file1k_sprites_strips.gif" file1k_sprites.png; then
+        echo "FAIL file1k_sprites_strips: animated PNG was read in strips"
+        NFAIL=$((NFAIL+1))
+    else
+        NPASS=$((NPASS+1))
+    fi
+    
+    # Raw frames from stdin must give the same GIF as the PNG frames they were decoded from
+    $GIFDECODE "$OUTDIR/movie_roundtrip.gif" | $PNG2GIF -s -t 0.02 -c median -r rgb24 -z 400x300 "$OUTDIR/movie_raw.gif"
+    if cmp -s "$OUTDIR/movie_raw.gif" "$OUTDIR/movie_roundtrip.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL movie_raw: raw rgb24 input differs from PNG input"
+        NFAIL=$((NFAIL+1))
+    fi
+    
+    # Streaming to stdout must give the same GIF as writing the file
+    $PNG2GIF -s -t 0.02 -c median -o - $MOVIE > "$OUTDIR/movie_stdout.gif"
+    if cmp -s "$OUTDIR/movie_stdout.gif" "$OUTDIR/movie_median.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL movie_stdout: GIF written to stdout differs from GIF file"
+        NFAIL=$((NFAIL+1))
+    fi
+    
+    # Strip encoding must give the same GIF as encoding whole frames
+    for palette in 685g 676g 884 web grayT; do
+        $PNG2GIF -s -l -t 0.02 -c $palette "$OUTDIR/movie_strips_$palette.gif" $MOVIE
+        if cmp -s "$OUTDIR/movie_strips_$palette.gif" "$OUTDIR/movie_$palette.gif"; then
+            NPASS=$((NPASS+1))
+        else
+            echo "FAIL movie_strips_$palette: strip encoded GIF differs from whole frame GIF"
+            NFAIL=$((NFAIL+1))
+        fi
+    done
+    
+    # A PNG with a corrupt chunk CRC must be rejected, and must convert as before when CRC checks are off
+    cp movie/file1a_f-01.png "$OUTDIR/corrupt.png"
+    printf '\000' | dd of="$OUTDIR/corrupt.png" bs=1 seek=29 conv=notrunc 2> /dev/null
+    $PNG2GIF -s -c median "$OUTDIR/corrupt_strict.gif" "$OUTDIR/corrupt.png"
+    strict=$?
+    $PNG2GIF -s -c median "$OUTDIR/corrupt_reference.gif" movie/file1a_f-01.png
+    $PNG2GIF -s -y off -c median "$OUTDIR/corrupt_off.gif" "$OUTDIR/corrupt.png"
+    if [ $strict -ne 0 ] && cmp -s "$OUTDIR/corrupt_off.gif" "$OUTDIR/corrupt_reference.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_crc: corrupt PNG was not rejected, or was converted differently with -y off"
+        NFAIL=$((NFAIL+1))
+    fi
+    # A corrupt frame in the middle of a movie is read on the decoder thread, and must be reported from there
+    $PNG2GIF -c median "$OUTDIR/corrupt_movie.gif" movie/file1a_f-01.png "$OUTDIR/corrupt.png" movie/file1a_f-03.png > "$OUTDIR/corrupt_movie.txt"
+    if [ $? -ne 0 ] && grep -q "PNG IHDR chunk is corrupt" "$OUTDIR/corrupt_movie.txt"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_crc_movie: corrupt frame in a movie was not rejected with its error"
+        NFAIL=$((NFAIL+1))
+    fi
+    # The stored deflate copy has the filter type of its first row at byte 48, which is set to one PNG does not define,
+    # with CRC checks off so that the row gets defiltered
+    cp file1c_gray2_stored.png "$OUTDIR/corrupt_filter.png"
+    printf '\007' | dd of="$OUTDIR/corrupt_filter.png" bs=1 seek=48 conv=notrunc 2> /dev/null
+    $PNG2GIF -s -c median "$OUTDIR/stored.gif" file1c_gray2_stored.png
+    $PNG2GIF -s -c median "$OUTDIR/stored_reference.gif" file1c_gray2.png
+    $PNG2GIF -y off -c median "$OUTDIR/corrupt_filter.gif" file1c_gray2.png "$OUTDIR/corrupt_filter.png" > "$OUTDIR/corrupt_filter.txt"
+    if [ $? -ne 0 ] && grep -q "unknown PNG filter type 7" "$OUTDIR/corrupt_filter.txt" && cmp -s "$OUTDIR/stored.gif" "$OUTDIR/stored_reference.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_filter: unknown filter type was not rejected with its error, or stored deflate was read differently"
+        NFAIL=$((NFAIL+1))
+    fi
+    # Likewise for a palette that is not a whole number of colors
+    cp file1e_plte8.png "$OUTDIR/corrupt_plte.png"
+    printf '\364' | dd of="$OUTDIR/corrupt_plte.png" bs=1 seek=36 conv=notrunc 2> /dev/null
+    $PNG2GIF -c median "$OUTDIR/corrupt_plte.gif" file1e_plte8.png "$OUTDIR/corrupt_plte.png" > "$OUTDIR/corrupt_plte.txt"
+    if [ $? -ne 0 ] && grep -q "PNG PLTE chunk has 500 bytes" "$OUTDIR/corrupt_plte.txt"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_plte_movie: palette of the wrong length was not rejected with its error"
+        NFAIL=$((NFAIL+1))
+    fi
+    # Image data cut short must be rejected rather than converted with black rows, even with CRC checks off
+    head -c 8000 file1g_gray8.png > "$OUTDIR/corrupt_short.png"
+    $PNG2GIF -y off -c median "$OUTDIR/corrupt_short.gif" "$OUTDIR/corrupt_short.png" > "$OUTDIR/corrupt_short.txt"
+    if [ $? -ne 0 ] && grep -q "PNG image data is corrupt or ends early" "$OUTDIR/corrupt_short.txt"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_short: image data that ends early was not rejected with its error"
+        NFAIL=$((NFAIL+1))
+    fi
+    # And for an animated PNG whose third frame has an unknown dispose operation, with CRC checks off so that it is read
+    cp movie/file1a_apng.png "$OUTDIR/corrupt_apng.png"
+    printf '\005' | dd of="$OUTDIR/corrupt_apng.png" bs=1 seek=156234 conv=notrunc 2> /dev/null
+    $PNG2GIF -y off -c median "$OUTDIR/corrupt_apng.gif" "$OUTDIR/corrupt_apng.png" > "$OUTDIR/corrupt_apng.txt"
+    if [ $? -ne 0 ] && grep -q "PNG frame has dispose operation 5" "$OUTDIR/corrupt_apng.txt"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL corrupt_apng: frame control with an unknown dispose operation was not rejected with its error"
+        NFAIL=$((NFAIL+1))
+    fi
+
+    # A saved palette loaded back in must give the same GIF as the palette it was saved from
+    $PNG2GIF -s -t 0.02 -c web -e "$OUTDIR/web.act" "$OUTDIR/movie_web_saved.gif" $MOVIE
+    $PNG2GIF -s -t 0.02 -p "$OUTDIR/web.act" "$OUTDIR/movie_web_loaded.gif" $MOVIE
+    if cmp -s "$OUTDIR/movie_web_saved.gif" "$OUTDIR/movie_web.gif" && cmp -s "$OUTDIR/movie_web_loaded.gif" "$OUTDIR/movie_web.gif"; then
+        NPASS=$((NPASS+1))
+    else
+        echo "FAIL movie_palette_file: GIF from a saved palette differs"
+        NFAIL=$((NFAIL+1))
+    fi
+    # -f would replace a palette file with median cut, so the two cannot be combined
+    if $PNG2GIF -s -f -p "$OUTDIR/web.act" "$OUTDIR/movie_web_forcebw.gif" movie/file1a_f-01.png; then
+        echo "FAIL movie_palette_file_forcebw: palette file was accepted with -f"
+        NFAIL=$((NFAIL+1))
+    else
+        NPASS=$((NPASS+1))
+    fi
+fi
+
+if [ $UPDATE -eq 1 ]; then
+    cp "$NEWGOLDEN" $GOLDEN
+    echo "Wrote $(wc -l < $GOLDEN | tr -d ' ') goldens to $GOLDEN"
+    rm -rf "$OUTDIR"
+    exit 0
+fi
+
+echo "$NPASS passed, $NFAIL failed"
+if [ $NFAIL -gt 0 ]; then
+    echo "Output kept in $OUTDIR"
+    exit 1
+fi
+rm -rf "$OUTDIR"
+exit 0
@@ -0,0 +1,331 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "wuQuant.h"
+#include "allocate.h"
+
+#define DEBUG 0
+
+// Cut directions
+#define WU_R 0
+#define WU_G 1
+#define WU_B 2
+
+#define WUIND(r,g,b) (((r)*WUSIZE+(g))*WUSIZE+(b))
+
+
+void wuQuant(SortedPixel* unique, uint32_t length, int tablebitsize, SortedPixel* palette){
+    // Find an optimal color set using Wu's variance minimizing quantizer (Graphics Gems II, 1991)
+    // The unique colors are binned into a 32x32x32 histogram whose cumulative moments give the color variance of any box in constant time
+    // The box with the largest variance is then cut repeatedly along the plane that minimizes the summed variance of the two halves
+    // The run time depends on the histogram size and number of unique colors, not on how the colors are spread
+    // Once finished, each unique color is set to the mean color of its box, same as medianCut
+    
+    int tablesize = 1 << tablebitsize;  // = 2^tablebitsize
+    
+    // If length <= tablesize, then we don't need to do any cutting, each unique color gets its own colorindex
+    if(length <= tablesize){
+        for(int i=0;i<tablesize;i++){
+            memset(&palette[i], 0, sizeof(SortedPixel));
+            palette[i].colorindex = i;
+            if(i < length){
+                unique[i].colorindex = i;
+                palette[i].pixel = unique[i].pixel;
+                palette[i].R = unique[i].R;
+                palette[i].G = unique[i].G;
+                palette[i].B = unique[i].B;
+            }
+        }
+        return;
+    }
+    
+    // Build the cumulative moments
+    WuMoments moments;
+    size_t histsize = sizeof(int64_t)*WUSIZE*WUSIZE*WUSIZE;
+    moments.wt = checkedCalloc(5, histsize);
+    moments.mr = moments.wt + WUSIZE*WUSIZE*WUSIZE;
+    moments.mg = moments.mr + WUSIZE*WUSIZE*WUSIZE;
+    moments.mb = moments.mg + WUSIZE*WUSIZE*WUSIZE;
+    moments.m2 = moments.mb + WUSIZE*WUSIZE*WUSIZE;
+    wuHistogram(&moments, unique, length);
+    wuCumulate(moments.wt);
+    wuCumulate(moments.mr);
+    wuCumulate(moments.mg);
+    wuCumulate(moments.mb);
+    wuCumulate(moments.m2);
+    
+    // Start with the whole color space and keep cutting the box with the largest variance
+    WuBox box[tablesize];
+    double variance[tablesize];
+    box[0].r0 = box[0].g0 = box[0].b0 = 0;
+    box[0].r1 = box[0].g1 = box[0].b1 = WUSIZE-1;
+    int nbox = tablesize;
+    int next = 0;
+    for(int i=1;i<tablesize;i++){
+        if(wuCut(&box[next], &box[i], &moments)){
+            // Boxes of a single cell cannot be cut any further
+            variance[next] = wuCells(&box[next]) > 1 ? wuVariance(&box[next], &moments) : 0.0;
+            variance[i] = wuCells(&box[i]) > 1 ? wuVariance(&box[i], &moments) : 0.0;
+        }else{
+            // Could not cut this box, so try the next one instead
+            variance[next] = 0.0;
+            i--;
+        }
+        
+        // Find the box with the largest variance
+        next = 0;
+        double maxvariance = variance[0];
+        for(int k=1;k<=i;k++){
+            if(variance[k] > maxvariance){
+                maxvariance = variance[k];
+                next = k;
+            }
+        }
+        if(maxvariance <= 0.0){
+            nbox = i+1;
+            break;
+        }
+    }
+#if DEBUG
+    printf("Wu quantizer made %i boxes\n", nbox);
+#endif
+    
+    // Find the mean color of each box and label the histogram cells with their box
+    uint8_t* tag = checkedMalloc(sizeof(uint8_t)*WUSIZE*WUSIZE*WUSIZE);
+    for(int i=0;i<tablesize;i++){
+        memset(&palette[i], 0, sizeof(SortedPixel));
+        palette[i].colorindex = i;
+        if(i >= nbox){
+            continue;
+        }
+        
+        int64_t weight = wuVolume(&box[i], moments.wt);
+        if(weight > 0){
+            palette[i].R = (uint8_t) ((wuVolume(&box[i], moments.mr) + weight/2) / weight);
+            palette[i].G = (uint8_t) ((wuVolume(&box[i], moments.mg) + weight/2) / weight);
+            palette[i].B = (uint8_t) ((wuVolume(&box[i], moments.mb) + weight/2) / weight);
+            palette[i].pixel = (palette[i].B << 16) + (palette[i].G << 8) + (palette[i].R << 0);
+        }
+#if DEBUG
+        printf("box #%i weight=%lli color=%i,%i,%i\n", i, (long long) weight, palette[i].R, palette[i].G, palette[i].B);
+#endif
+        
+        for(int r=box[i].r0+1;r<=box[i].r1;r++){
+            for(int g=box[i].g0+1;g<=box[i].g1;g++){
+                for(int b=box[i].b0+1;b<=box[i].b1;b++){
+                    tag[WUIND(r,g,b)] = i;
+                }
+            }
+        }
+    }
+    
+    // Set the box mean as color for each unique color in the box
+    for(int i=0;i<length;i++){
+        uint8_t index = tag[WUIND((unique[i].R >> 3) + 1, (unique[i].G >> 3) + 1, (unique[i].B >> 3) + 1)];
+        unique[i].pixel = palette[index].pixel;
+        unique[i].R = palette[index].R;
+        unique[i].G = palette[index].G;
+        unique[i].B = palette[index].B;
+        unique[i].colorindex = index;
+    }
+    
+    free(tag);
+    free(moments.wt);
+}
+
+void wuHistogram(WuMoments* moments, SortedPixel* unique, uint32_t length){
+    // Bin the unique colors by their upper 5 bits, weighted by their number of pixels
+    // Index 0 of each channel is left empty for the cumulative moments
+    for(int i=0;i<length;i++){
+        int ind = WUIND((unique[i].R >> 3) + 1, (unique[i].G >> 3) + 1, (unique[i].B >> 3) + 1);
+        int64_t w = unique[i].npixel;
+        int64_t R = unique[i].R;
+        int64_t G = unique[i].G;
+        int64_t B = unique[i].B;
+        moments->wt[ind] += w;
+        moments->mr[ind] += w*R;
+        moments->mg[ind] += w*G;
+        moments->mb[ind] += w*B;
+        moments->m2[ind] += w*(R*R + G*G + B*B);
+    }
+}
+
+void wuCumulate(int64_t* moment){
+    // Turn the histogram into cumulative moments, so that each cell holds the sum over all cells with lower or equal indices
+    int64_t area[WUSIZE];
+    
+    for(int r=1;r<WUSIZE;r++){
+        memset(area, 0, sizeof(area));
+        for(int g=1;g<WUSIZE;g++){
+            int64_t line = 0;
+            for(int b=1;b<WUSIZE;b++){
+                line += moment[WUIND(r,g,b)];
+                area[b] += line;
+                moment[WUIND(r,g,b)] = moment[WUIND(r-1,g,b)] + area[b];
+            }
+        }
+    }
+}
+
+int wuCells(WuBox* box){
+    // Number of histogram cells in a box
+    return (box->r1-box->r0)*(box->g1-box->g0)*(box->b1-box->b0);
+}
+
+int64_t wuVolume(WuBox* box, int64_t* moment){
+    // Sum of a moment over a box
+    return moment[WUIND(box->r1,box->g1,box->b1)] - moment[WUIND(box->r1,box->g1,box->b0)]
+         - moment[WUIND(box->r1,box->g0,box->b1)] + moment[WUIND(box->r1,box->g0,box->b0)]
+         - moment[WUIND(box->r0,box->g1,box->b1)] + moment[WUIND(box->r0,box->g1,box->b0)]
+         + moment[WUIND(box->r0,box->g0,box->b1)] - moment[WUIND(box->r0,box->g0,box->b0)];
+}
+
+int64_t wuBottom(WuBox* box, int dir, int64_t* moment){
+    // Part of the box sum that does not depend on where the box is cut along dir
+    switch(dir){
+        case WU_R:
+            return - moment[WUIND(box->r0,box->g1,box->b1)] + moment[WUIND(box->r0,box->g1,box->b0)]
+                   + moment[WUIND(box->r0,box->g0,box->b1)] - moment[WUIND(box->r0,box->g0,box->b0)];
+        case WU_G:
+            return - moment[WUIND(box->r1,box->g0,box->b1)] + moment[WUIND(box->r1,box->g0,box->b0)]
+                   + moment[WUIND(box->r0,box->g0,box->b1)] - moment[WUIND(box->r0,box->g0,box->b0)];
+        case WU_B:
+        default:
+            return - moment[WUIND(box->r1,box->g1,box->b0)] + moment[WUIND(box->r1,box->g0,box->b0)]
+                   + moment[WUIND(box->r0,box->g1,box->b0)] - moment[WUIND(box->r0,box->g0,box->b0)];
+    }
+}
+
+int64_t wuTop(WuBox* box, int dir, int pos, int64_t* moment){
+    // Part of the box sum that depends on the cut position pos along dir
+    switch(dir){
+        case WU_R:
+            return moment[WUIND(pos,box->g1,box->b1)] - moment[WUIND(pos,box->g1,box->b0)]
+                 - moment[WUIND(pos,box->g0,box->b1)] + moment[WUIND(pos,box->g0,box->b0)];
+        case WU_G:
+            return moment[WUIND(box->r1,pos,box->b1)] - moment[WUIND(box->r1,pos,box->b0)]
+                 - moment[WUIND(box->r0,pos,box->b1)] + moment[WUIND(box->r0,pos,box->b0)];
+        case WU_B:
+        default:
+            return moment[WUIND(box->r1,box->g1,pos)] - moment[WUIND(box->r1,box->g0,pos)]
+                 - moment[WUIND(box->r0,box->g1,pos)] + moment[WUIND(box->r0,box->g0,pos)];
+    }
+}
+
+double wuVariance(WuBox* box, WuMoments* moments){
+    // Weighted color variance of a box
+    double dR = (double) wuVolume(box, moments->mr);
+    double dG = (double) wuVolume(box, moments->mg);
+    double dB = (double) wuVolume(box, moments->mb);
+    double xx = (double) wuVolume(box, moments->m2);
+    
+    return xx - (dR*dR + dG*dG + dB*dB) / (double) wuVolume(box, moments->wt);
+}
+
+double wuMaximize(WuBox* box, int dir, int first, int last, int* cut, int64_t wholeR, int64_t wholeG, int64_t wholeB, int64_t wholeW, WuMoments* moments){
+    // Find the cut along dir that minimizes the variance of the two halves, which is the same as maximizing the sum of their squared means
+    // Returns the maximized value, cut is set to -1 if the box cannot be cut along dir
+    int64_t baseR = wuBottom(box, dir, moments->mr);
+    int64_t baseG = wuBottom(box, dir, moments->mg);
+    int64_t baseB = wuBottom(box, dir, moments->mb);
+    int64_t baseW = wuBottom(box, dir, moments->wt);
+    double max = 0.0;
+    *cut = -1;
+    
+    for(int i=first;i<last;i++){
+        // Lower half of the box
+        double halfR = (double) (baseR + wuTop(box, dir, i, moments->mr));
+        double halfG = (double) (baseG + wuTop(box, dir, i, moments->mg));
+        double halfB = (double) (baseB + wuTop(box, dir, i, moments->mb));
+        int64_t halfW = baseW + wuTop(box, dir, i, moments->wt);
+        if(halfW == 0){
+            // Box is empty below the cut
+            continue;
+        }
+        double temp = (halfR*halfR + halfG*halfG + halfB*halfB) / (double) halfW;
+        
+        // Upper half of the box
+        halfR = (double) wholeR - halfR;
+        halfG = (double) wholeG - halfG;
+        halfB = (double) wholeB - halfB;
+        halfW = wholeW - halfW;
+        if(halfW == 0){
+            // Box is empty above the cut
+            continue;
+        }
+        temp += (halfR*halfR + halfG*halfG + halfB*halfB) / (double) halfW;
+        
+        if(temp > max){
+            max = temp;
+            *cut = i;
+        }
+    }
+    
+    return max;
+}
+
+int wuCut(WuBox* box1, WuBox* box2, WuMoments* moments){
+    // Cut box1 in two, the upper half is put in box2
+    // Returns 0 if the box cannot be cut
+    int cutR, cutG, cutB;
+    int64_t wholeR = wuVolume(box1, moments->mr);
+    int64_t wholeG = wuVolume(box1, moments->mg);
+    int64_t wholeB = wuVolume(box1, moments->mb);
+    int64_t wholeW = wuVolume(box1, moments->wt);
+    
+    double maxR = wuMaximize(box1, WU_R, box1->r0+1, box1->r1, &cutR, wholeR, wholeG, wholeB, wholeW, moments);
+    double maxG = wuMaximize(box1, WU_G, box1->g0+1, box1->g1, &cutG, wholeR, wholeG, wholeB, wholeW, moments);
+    double maxB = wuMaximize(box1, WU_B, box1->b0+1, box1->b1, &cutB, wholeR, wholeG, wholeB, wholeW, moments);
+    
+    // Cut along the direction with the largest gain (bias against B with R over G in tiebreaker, same as medianCut)
+    int dir;
+    if(maxR >= maxG && maxR >= maxB){
+        dir = WU_R;
+        if(cutR < 0){
+            // Box cannot be split
+            return 0;
+        }
+    }else if(maxG >= maxR && maxG >= maxB){
+        dir = WU_G;
+    }else{
+        dir = WU_B;
+    }
+    
+    *box2 = *box1;
+    switch(dir){
+        case WU_R:
+            box2->r0 = box1->r1 = cutR;
+            break;
+        case WU_G:
+            box2->g0 = box1->g1 = cutG;
+            break;
+        case WU_B:
+            box2->b0 = box1->b1 = cutB;
+            break;
+    }
+    
+    return 1;
+}
@@ -0,0 +1,64 @@
+/*
+ Copyright (c) 2019, Cory Rupp
+ 
+ This code is released under the MIT License:
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _WUQUANT_H_
+#define _WUQUANT_H_
+
+#include <stdlib.h>
+#include "pixel.h"
+
+// Histogram cells per color channel, 5 bits of each channel plus a zero row for the cumulative moments
+#define WUSIZE 33
+
+typedef struct _WuBox {
+    // Box in histogram cells, lower bounds are exclusive and upper bounds inclusive
+    int r0;
+    int r1;
+    int g0;
+    int g1;
+    int b0;
+    int b1;
+} WuBox;
+
+typedef struct _WuMoments {
+    // Cumulative moments of the color histogram, WUSIZE^3 cells each
+    int64_t* wt;  // Number of pixels
+    int64_t* mr;  // Sum of R
+    int64_t* mg;  // Sum of G
+    int64_t* mb;  // Sum of B
+    int64_t* m2;  // Sum of R^2+G^2+B^2
+} WuMoments;
+
+void wuQuant(SortedPixel* unique, uint32_t length, int tablebitsize, SortedPixel* palette);
+void wuHistogram(WuMoments* moments, SortedPixel* unique, uint32_t length);
+void wuCumulate(int64_t* moment);
+int wuCells(WuBox* box);
+int64_t wuVolume(WuBox* box, int64_t* moment);
+int64_t wuBottom(WuBox* box, int dir, int64_t* moment);
+int64_t wuTop(WuBox* box, int dir, int pos, int64_t* moment);
+double wuVariance(WuBox* box, WuMoments* moments);
+double wuMaximize(WuBox* box, int dir, int first, int last, int* cut, int64_t wholeR, int64_t wholeG, int64_t wholeB, int64_t wholeW, WuMoments* moments);
+int wuCut(WuBox* box1, WuBox* box2, WuMoments* moments);
+
+#endif